@@ -1,28 +1,189 @@
 #pragma once
-#include "esp_adc/adc_cali.h"
-#include "esp_adc/adc_cali_scheme.h"
-#include "esp_adc/adc_continuous.h" // Include for continuous mode
-#include "esp_adc/adc_oneshot.h"
-#include "esp_err.h"
-#include "esp_timer.h" // Include for high-resolution timer
+#include "ED_adc_clock.h"
+#include "ED_adc_driver.h"
+#include "ED_adc_histogram.h"
+#include "ED_adc_memory.h"
+#include "ED_adc_port.h"
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <vector>
 
 namespace ED_ADC {
 
+/// @brief why a sampling call returned
+enum class StopReason : uint8_t {
+  Complete,    // all requested samples / the full duration were collected
+  Cancelled,   // the CancelToken passed in CaptureOptions was triggered
+  Deadline,    // the absolute deadline in CaptureOptions was reached
+  Fault,       // the driver failed and the capture could not go on
+  MemoryLimit, // storing more samples would exceed a memory limit
+};
+
 // Define a struct to hold the results of the ADC reading
 typedef struct {
   int average_mv;
   int min_mv;
   int max_mv;
-  int p30_width_mv; // Width of the 50th percentile
-  int p60_width_mv; // Width of the 50th percentile
+  int p30_width_mv; // 70th minus 30th percentile
+  int p60_width_mv; // 60th minus 40th percentile
+  int sample_count; // number of samples the figures above are based on
+  bool partial;     // true if the read stopped before sample_count samples
+  StopReason stop_reason;
+  int error_count;   // failed conversions, retried ones included
+  int skipped_count; // samples given up after their last retry
 } ADCReadResult;
 
+/**
+ * @brief cooperative cancellation flag for read() and sampleForDuration().
+ * cancel() can be called from any task; the sampling loop checks the flag
+ * between samples (oneshot) and between frames (continuous).
+ */
+class CancelToken {
+public:
+  /// @param clock [in] time base of the latency measurement; use the
+  /// unit's clock (ADCUnit::clock()) when it is simulated
+  explicit CancelToken(Clock &clock = SystemClock::instance())
+      : _clock(clock) {}
+
+  /// @brief requests the running capture to stop as soon as possible
+  void cancel();
+  /// @brief clears the flag so the token can be reused for a new capture
+  void reset();
+  bool isCancelled() const;
+  /// @brief time in us between cancel() and the sampling loop stopping, as
+  /// measured on the last cancelled capture. -1 if none was observed yet.
+  int64_t lastLatencyUs() const;
+
+private:
+  friend class ADCChannel;
+  void acknowledge();
+
+  Clock &_clock;
+  std::atomic<bool> _cancelled{false};
+  std::atomic<int64_t> _requested_at_us{0};
+  std::atomic<int64_t> _latency_us{-1};
+};
+
+/// @brief what a oneshot read does when a conversion fails, e.g. with
+/// ESP_ERR_TIMEOUT while Wi-Fi holds ADC2
+struct RetryPolicy {
+  uint32_t max_retries = 0;     // further attempts per sample
+  uint32_t backoff_ms = 1;      // delay before the first retry, doubled
+  uint32_t max_backoff_ms = 50; // for each further one up to this
+  // after the last retry: skip the sample and go on, or abort the read
+  bool skip_failed = false;
+
+  /// @brief delay before retry number attempt (0-based)
+  uint32_t delayMs(uint32_t attempt) const {
+    uint32_t delay = backoff_ms;
+    for (uint32_t i = 0; i < attempt && delay < max_backoff_ms; i++) {
+      delay *= 2;
+    }
+    return std::min(delay, max_backoff_ms);
+  }
+};
+
+/// @brief what sampleForDuration() does when its samples would exceed
+/// CaptureOptions::memory_budget
+enum class OverBudget : uint8_t {
+  StopEarly, // keep the first samples that fit, stop with MemoryLimit
+  Decimate,  // keep one sample in n, n chosen (and doubled) to fit
+  Summary,   // keep no samples, only the statistics in CaptureInfo
+};
+
+/// @brief optional controls shared by the sampling calls
+struct CaptureOptions {
+  CancelToken *cancel = nullptr; // checked between samples/frames
+  // absolute, in the unit's clock time base (esp_timer_get_time() on
+  // target). 0 = none
+  int64_t deadline_us = 0;
+  // continuous-mode watchdog: the driver is restarted when no frame arrived
+  // for frame_timeout_ms or max_read_errors reads in a row failed, at most
+  // max_recoveries times per capture. 0 disables the respective check
+  uint32_t frame_timeout_ms = 200;
+  uint32_t max_read_errors = 8;
+  uint32_t max_recoveries = 3;
+  // oneshot reads: retries and skipping of failed conversions
+  RetryPolicy retry;
+  // sampleForDuration(): bytes its sample vector may hold, 0 = unbounded,
+  // and what to do when the capture would need more
+  size_t memory_budget = 0;
+  OverBudget over_budget = OverBudget::StopEarly;
+};
+
+/// @brief outcome of a sampleForDuration() / captureFrames() call
+typedef struct {
+  bool partial; // true if the capture ended before duration_ms
+  StopReason stop_reason;
+  int64_t elapsed_us;      // time from converter start to converter stop
+  uint64_t samples;        // samples delivered
+  uint32_t read_errors;    // failed driver reads, other than timeouts
+  uint32_t overflows;      // driver pool overflows during the capture
+  uint32_t recoveries;     // driver restarts by the watchdog
+  int64_t downtime_us;     // time without frames that led to the restarts
+  int32_t first_gap_index; // index of the first sample after a restart,
+                           // -1 if there was none
+  esp_err_t error; // why the capture could not start or went on failing
+                   // (stop_reason MemoryLimit / Fault), else ESP_OK
+  // sampleForDuration() only:
+  uint64_t expected_samples; // duration x sample rate, reserved up front
+  uint32_t decimation;       // 1 if every sample was kept, n if one in n
+  bool summarized;           // the budget left only the summary below
+  ADCReadResult summary;     // average, min, max of all samples taken
+} CaptureInfo;
+
+/// @brief in-place reconfigurations of a channel, see
+/// ADCChannel::setAttenuation()
+typedef struct {
+  uint32_t switches;        // calls that changed the configuration
+  uint32_t cali_cache_hits; // switches served by a cached calibration
+  uint32_t cali_created;    // calibration schemes created by switches
+  int64_t last_switch_us;   // latency of the last switch
+  int64_t max_switch_us;
+  int64_t total_switch_us;
+} ReconfigStats;
+
+/// @brief how ADCChannel::measureSettling() probes a channel switch
+struct SettlingConfig {
+  int samples = 16;     // conversions taken after each switch
+  int repeats = 8;      // switches averaged
+  int tolerance_mv = 2; // settled once within this of the final value
+  bool apply = true;    // set the learned discard count on the channel
+};
+
+/// @brief outcome of ADCChannel::measureSettling()
+typedef struct {
+  int discard;        // conversions to drop after a switch
+  int first_error_mv; // mean error of the first conversion after a switch
+  int settled_mv;     // mean of the settled conversions
+} SettlingResult;
+
+/// @brief continuous driver restarts of a unit, see
+/// ADCUnit::recoverContinuous()
+typedef struct {
+  uint32_t recoveries;       // successful restarts
+  uint32_t failed;           // restarts that could not re-create the driver
+  int64_t last_downtime_us;  // from the last frame to the restart
+  int64_t max_downtime_us;
+  int64_t total_downtime_us;
+} RecoveryStats;
+
 // Forward declaration
 class ADCUnit;
 
+// awaitable API, see ED_adc_async.h (requires C++20 coroutines)
+#if defined(__cpp_impl_coroutine)
+#define ED_ADC_HAS_COROUTINES 1
+template <typename T> class Task;
+class Executor;
+class FrameStream;
+#else
+#define ED_ADC_HAS_COROUTINES 0
+#endif
+
 class ADCChannel {
 public:
   /**
@@ -30,9 +191,9 @@ public:
    *
    *
    * // ADC Setup
-  ADCUnit *ADC = ADCUnit::create();
-  ADCChannel *ADC0 = ADCChannel::create(
-      ADC, ADC_CHANNEL_0, ADC_ATTEN_DB_6); // MAX voltage: plan for 1300mV
+  std::unique_ptr<ADCUnit> ADC = ADCUnit::create();
+  std::unique_ptr<ADCChannel> ADC0 = ADCChannel::create(
+      ADC.get(), ADC_CHANNEL_0, ADC_ATTEN_DB_6); // MAX voltage: plan for 1300mV
 
   ADCReadResult reading = {};
   ADC0->read(200, 10, reading);
@@ -65,45 +226,390 @@ public:
    * ADC_ATTEN_DB_6     | 6 dB        | 0 – 1300              | ±10
    *  | Slightly above Vref ADC_ATTEN_DB_12    | 12 dB       | 0 – 2500
    *      | ±35              | Max usable range; higher error
-   * @return ADCChannel* A pointer to the initialized ADCChannel object.
+   * @return the initialized channel, nullptr if it could not be configured
    */
-  static ADCChannel *create(ADCUnit *unit, adc_channel_t channel,
-                            adc_atten_t atten);
+  static std::unique_ptr<ADCChannel> create(ADCUnit *unit,
+                                            adc_channel_t channel,
+                                            adc_atten_t atten);
+  /// @brief same, for a shared unit from ADCUnit::acquire(): the channel
+  /// keeps the unit alive
+  static std::unique_ptr<ADCChannel>
+  create(const std::shared_ptr<ADCUnit> &unit, adc_channel_t channel,
+         adc_atten_t atten);
+
+  /**
+   * @brief channels are also plain values, e.g. to keep them contiguous:
+   * @example
+   *
+  std::array<ADCChannel, 2> channels = {
+      ADCChannel(unit, ADC_CHANNEL_0, ADC_ATTEN_DB_12),
+      ADCChannel(unit, ADC_CHANNEL_1, ADC_ATTEN_DB_12)};
+   *
+   * Check isInitialized() when constructing directly. A channel refers to
+   * its unit by address, so the unit must outlive it; a channel must not be
+   * moved while a stream, task or sampler uses it.
+   */
+  ADCChannel(ADCUnit *unit, adc_channel_t channel, adc_atten_t atten);
+  ADCChannel(const std::shared_ptr<ADCUnit> &unit, adc_channel_t channel,
+             adc_atten_t atten);
+  /// @brief an unconfigured channel, to be assigned later
+  ADCChannel() = default;
+  ADCChannel(ADCChannel &&other) noexcept;
+  ADCChannel &operator=(ADCChannel &&other) noexcept;
+  ADCChannel(const ADCChannel &) = delete;
+  ADCChannel &operator=(const ADCChannel &) = delete;
+  /// @brief releases the calibration scheme
+  ~ADCChannel();
+
+  /// @brief true if the channel and its calibration are configured
+  bool isInitialized() const;
+
+  /**
+   * @brief changes the attenuation in place, without recreating the
+   * channel. Nothing is done if it does not change. Otherwise the cost is
+   * one oneshot channel configuration, plus creating a calibration scheme
+   * the first time an attenuation/bitwidth pair is used; schemes are cached
+   * until the channel is destroyed, so switching back and forth only pays
+   * the configuration. switchStats() reports the latency measured on the
+   * running hardware.
+   * @return esp_err_t error of the driver; the previous configuration stays
+   * active on failure
+   */
+  esp_err_t setAttenuation(adc_atten_t atten);
+  /// @brief changes the oneshot bitwidth in place, as setAttenuation()
+  esp_err_t setBitwidth(adc_bitwidth_t bitwidth);
+  adc_atten_t attenuation() const { return _atten; }
+  adc_bitwidth_t bitwidth() const { return _bitwidth; }
+  adc_channel_t channel() const { return _channel; }
+  adc_unit_t unitId() const;
+  ReconfigStats switchStats() const { return _reconfig_stats; }
+
+  /**
+   * @brief caps the heap the channel's sampling calls may hold at once
+   * (sample vectors and frame buffers). sampleForDuration() stops with
+   * StopReason::MemoryLimit when growing its vector would exceed the cap,
+   * and returns the samples it has; read() fails with ESP_ERR_NO_MEM. The
+   * unit's limit (ADCUnit::setMemoryLimit()) applies on top.
+   * @param bytes [in] 0 (default) for no limit
+   */
+  void setMemoryLimit(size_t bytes) { _memory.setLimit(bytes); }
+  /// @brief heap held by the sampling calls: current, peak and largest
+  /// allocation. Vectors returned to the caller are no longer counted.
+  MemoryStats memoryStats() const { return _memory.stats(); }
+  void resetMemoryStats() { _memory.resetStats(); }
   /**
    * @brief performs a sequence of reading from the Analogue channel
    *
+   * The delay between readings is slept in slices of at most
+   * CANCEL_POLL_MS, so a cancellation or deadline is honoured within one
+   * slice plus one conversion. If the read is stopped early the statistics
+   * cover the samples taken so far and result.partial is set.
+   * A failed conversion is retried and then skipped or aborts the read as
+   * options.retry says; result counts the errors and skipped samples.
+   *
    * @param sample_count [in] number of readings
    * @param sample_delay_ms [in] delay in ms between readings
    * @param result [out] the result of the reading
-   * @return esp_err_t
+   * @param options [in] cancellation token, deadline and retry policy
+   * @return esp_err_t ESP_OK if at least one sample was taken,
+   * ESP_ERR_TIMEOUT / ESP_ERR_INVALID_STATE if the deadline / cancellation
+   * hit before the first sample, or the driver error that aborted the read
+   * (result then holds the samples taken before, with
+   * StopReason::Fault)
+   */
+  esp_err_t read(int sample_count, int sample_delay_ms, ADCReadResult &result,
+                 const CaptureOptions &options = {});
+  /**
+   * @brief read() for large counts, e.g. millions of samples integrated in
+   * the background: the samples are not stored but summed in 64 bits and
+   * counted in a 1 mV CodeHistogram (16 KB, accounted like read()'s
+   * vector), so memory does not grow with sample_count. Average, min and
+   * max are exact; the percentile widths too, for samples within 0 to
+   * 4095 mV.
+   * @return esp_err_t as read(); ESP_ERR_NO_MEM if the memory limit
+   * refuses the histogram
    */
-  esp_err_t read(int sample_count, int sample_delay_ms, ADCReadResult &result);
+  esp_err_t readStreamed(int sample_count, int sample_delay_ms,
+                         ADCReadResult &result,
+                         const CaptureOptions &options = {});
 
   /**
    * @brief Samples the channel for a given duration using continuous mode.
+   * The converter is stopped as soon as the options' token is cancelled or
+   * the deadline passes; the samples collected until then are returned.
    * @param duration_ms The total time to sample in milliseconds.
+   * A watchdog restarts the driver when frames stop arriving or reads keep
+   * failing (see CaptureOptions); the samples of the gap are missing and
+   * info reports where it is.
+   * The vector is reserved once for the samples the unit's sample rate
+   * yields in duration_ms. If they would not fit options.memory_budget,
+   * options.over_budget decides: stop early, decimate, or keep only the
+   * summary statistics; info reports which happened. Sample indexes in
+   * info (first_gap_index) count all samples taken, before decimation.
+   * @example
+   *
+  CaptureOptions options;
+  options.memory_budget = 64 * 1024; // 16384 samples
+  options.over_budget = OverBudget::Decimate;
+  CaptureInfo info = {};
+  std::vector<int> mv = ADC0->sampleForDuration(60000, options, &info);
+  // 60 s at 20 kHz: info.decimation == 74, info.summary covers all
+   *
+   * @param options cancellation token, deadline, watchdog limits and
+   * memory budget
+   * @param info [out, optional] whether the capture was complete and why it
+   * stopped, decimation and summary of the samples; a capture that could
+   * not start is partial, with the error in info->error
    * @return A vector of calibrated voltage readings (in mV).
    */
-  std::vector<int> sampleForDuration(uint32_t duration_ms);
+  std::vector<int> sampleForDuration(uint32_t duration_ms,
+                                     const CaptureOptions &options = {},
+                                     CaptureInfo *info = nullptr);
+
+  /// @brief receives the raw 12-bit codes of one driver read and the time
+  /// (clock() base) the read completed
+  using FrameCallback =
+      std::function<void(const uint16_t *codes, size_t count, int64_t t_us)>;
+
+  /**
+   * @brief continuous capture like sampleForDuration(), but each frame is
+   * handed to on_frame as it arrives instead of being stored, so captures
+   * of any length run in constant memory. codes is only valid during the
+   * call; convert with rawToVoltage() if needed.
+   * @return esp_err_t ESP_ERR_NO_MEM / the driver error if the capture
+   * could not start (info then reports it as partial, StopReason::
+   * MemoryLimit / Fault); how it ended is reported in info
+   */
+  esp_err_t captureFrames(uint32_t duration_ms, const FrameCallback &on_frame,
+                          const CaptureOptions &options = {},
+                          CaptureInfo *info = nullptr);
+
+  /**
+   * @brief counts sample_count oneshot conversions into hist, taken as
+   * read() takes them (delay, cancellation, retries) but without storing
+   * them
+   * @param hist [in/out] counts raw codes or calibrated mV according to its
+   * unit; it is not cleared, so successive captures accumulate
+   * @return esp_err_t ESP_OK if at least one sample was counted, otherwise
+   * as read()
+   */
+  esp_err_t readHistogram(int sample_count, int sample_delay_ms,
+                          CodeHistogram &hist,
+                          const CaptureOptions &options = {});
+  /**
+   * @brief counts duration_ms of continuous samples into hist, frame by
+   * frame through captureFrames(), in constant memory whatever the
+   * duration. A HistogramUnit::RawCode histogram skips calibration.
+   * @return esp_err_t as captureFrames()
+   */
+  esp_err_t histogramForDuration(uint32_t duration_ms, CodeHistogram &hist,
+                                 const CaptureOptions &options = {},
+                                 CaptureInfo *info = nullptr);
+
+  /**
+   * @brief a single calibrated oneshot conversion, without statistics
+   * @param voltage [out] calibrated voltage in mV
+   * @return esp_err_t error of adc_oneshot_read()
+   */
+  esp_err_t readVoltage(int &voltage);
+
+  /**
+   * @brief a single uncalibrated oneshot conversion
+   * @param raw [out] raw code as returned by the driver
+   * @return esp_err_t error of adc_oneshot_read()
+   */
+  esp_err_t readRaw(int &raw);
+
+  /**
+   * @brief number of conversions thrown away when this channel is read
+   * right after the unit converted another channel or attenuation, to let
+   * the sampling capacitor settle. 0 (default) disables it.
+   */
+  void setSettlingDiscard(int count) { _settle_discard = std::max(count, 0); }
+  int settlingDiscard() const { return _settle_discard; }
+  /// @brief conversions dropped so far because of a switch
+  uint32_t discardedSamples() const { return _discarded; }
+
+  /**
+   * @brief measures how many conversions this channel needs to settle
+   * after the unit converted other: alternates between the two channels,
+   * averages the conversions following each switch and finds the first
+   * one within tolerance_mv of the settled value. Both channels must be on
+   * the same unit and their inputs steady during the measurement.
+   * @param other [in] channel switched away to before each probe
+   * @param result [out] learned discard count and the error it removes
+   * @param config [in] probe size; with apply, setSettlingDiscard() is
+   * called with the result
+   * @return esp_err_t ESP_ERR_INVALID_ARG if other is on another unit or
+   * config is out of range, else the error of the first failed conversion
+   */
+  esp_err_t measureSettling(ADCChannel &other, SettlingResult &result,
+                            const SettlingConfig &config = {});
+
+  /// @brief converts a raw code of this channel to mV using its calibration
+  int rawToVoltage(int raw) const;
+  /// @brief time base of the unit's driver, simulated with a SimDriver
+  Clock &clock() const { return _driver->clock(); }
+
+  /// upper bound in ms of a single sleep between oneshot readings
+  static constexpr int CANCEL_POLL_MS = 10;
+  /// bytes read from the continuous driver at a time, 2 per sample
+  static constexpr uint32_t FRAME_BUFFER_BYTES = 1024;
+
+#if ED_ADC_HAS_COROUTINES
+  /**
+   * @brief awaitable version of read(): the delay between readings suspends
+   * the coroutine on the executor instead of blocking the task, so many
+   * channels can be serviced from one task.
+   * @example
+   *
+  Task<void> poll(Executor &exec, ADCChannel &ch) {
+    ADCReadResult reading = {};
+    if (co_await ch.readAsync(exec, 200, 10, reading) == ESP_OK) { ... }
+  }
+   *
+   * @param executor [in] executor that resumes the coroutine
+   * @param sample_count [in] number of readings
+   * @param sample_delay_ms [in] delay in ms between readings
+   * @param result [out] the result of the reading; must outlive the task
+   * @param options [in] cancellation token and deadline
+   * @return Task<esp_err_t> same codes as read()
+   */
+  Task<esp_err_t> readAsync(Executor &executor, int sample_count,
+                            int sample_delay_ms, ADCReadResult &result,
+                            CaptureOptions options = {});
+
+  /**
+   * @brief starts the continuous converter and returns a stream whose
+   * nextFrame() can be co_awaited
+   * @param executor [in] executor that resumes waiting coroutines
+   * @param options [in] cancellation token and deadline for the stream
+   */
+  FrameStream openStream(Executor &executor,
+                         const CaptureOptions &options = {});
+#endif
 
 private:
+#if ED_ADC_HAS_COROUTINES
+  friend class FrameStream;
+#endif
+  /// @brief StopReason::Complete as long as the capture may go on
+  StopReason checkStop(const CaptureOptions &options) const;
+  /// @brief sleeps delay_ms in slices, returning early if the capture must
+  /// stop
+  StopReason interruptibleDelay(int delay_ms,
+                                const CaptureOptions &options) const;
+#if ED_ADC_HAS_COROUTINES
+  /// @brief interruptibleDelay() suspending on executor
+  Task<StopReason> interruptibleSleep(Executor &executor, int delay_ms,
+                                      const CaptureOptions &options) const;
+#endif
+  /// @brief records the cancel latency if reason is StopReason::Cancelled
+  static void acknowledgeStop(const CaptureOptions &options,
+                              StopReason reason);
+  /// @brief running figures of a oneshot read, kept by sampleStep().
+  /// read(), accumulate() and readAsync() only differ in how they wait and
+  /// where the values go
+  struct ReadLoop {
+    int64_t sum = 0;
+    int count = 0; // samples taken
+    int min = INT32_MAX;
+    int max = INT32_MIN;
+    int errors = 0;  // failed conversions
+    int skipped = 0; // samples given up
+    esp_err_t fault = ESP_OK;
+    StopReason reason = StopReason::Complete;
+    uint32_t attempt = 0;    // of the current sample
+    uint32_t backoff_ms = 0; // wait before the next attempt
+  };
+  enum class SampleStep : uint8_t {
+    Taken,   // value is valid and counted
+    Retry,   // wait loop.backoff_ms, then call sampleStep() again
+    Skipped, // retries exhausted, options.retry.skip_failed
+    Stop,    // retries exhausted: loop.fault and loop.reason are set
+  };
+  /**
+   * @brief one conversion attempt of the current sample, under
+   * options.retry
+   * @param value [out] calibrated mV, or the raw code if raw is set
+   */
+  SampleStep sampleStep(ReadLoop &loop, int &value,
+                        const CaptureOptions &options, bool raw = false);
+  /**
+   * @brief fills result from the samples of a (possibly partial) read
+   * @return esp_err_t as documented for read()
+   */
+  esp_err_t finishRead(std::vector<int> &voltages, const ReadLoop &loop,
+                       ADCReadResult &result);
+  /**
+   * @brief the sampling loop of readHistogram() and readStreamed(): counts
+   * each conversion in hist and fills result's average, min, max and
+   * counters (not the percentile widths)
+   * @return esp_err_t as documented for read()
+   */
+  esp_err_t accumulate(int sample_count, int sample_delay_ms,
+                       CodeHistogram &hist, const CaptureOptions &options,
+                       ADCReadResult &result);
   /**
    * @brief calculates the xth percentile to give an idea of the concentration
-   * of data
+   * of data: the distance between the values at the ranks of
+   * percentileRanks(), so x and 100 - x give the same width
    *
-   * @param data
+   * @param data sorted in place
    * @param percentile percentile value - valid range 10 to 90
    * @return int the calculated percentile
    */
   int calculatePercWidth(std::vector<int> &data, int8_t percentile = 50);
-  ADCChannel(ADCUnit *unit, adc_channel_t channel, adc_atten_t atten);
-  ~ADCChannel();
-  bool isInitialized() const;
+  /// @brief releases what the channel owns and resets it
+  void release();
+  /**
+   * @brief grows voltages to hold capacity samples, accounted in _memory
+   * @return bool false, with voltages unchanged, if the memory limit
+   * refuses it
+   */
+  bool reserveSamples(std::vector<int> &voltages, size_t capacity);
+  /// @brief stops accounting voltages (freed, or handed to the caller)
+  void releaseSamples(const std::vector<int> &voltages);
+  /**
+   * @brief frees space in the full vector of sampleForDuration(): grows it
+   * if options has no memory budget, otherwise applies over_budget
+   * @param pending [in] samples left in the current frame
+   * @param decimation [in/out] doubled when every other sample is dropped
+   * @param summarized [out] set when the samples were given up
+   * @return bool false if the capture has to stop
+   */
+  bool makeRoom(std::vector<int> &voltages, size_t pending,
+                const CaptureOptions &options, uint32_t &decimation,
+                bool &summarized);
+  /// @brief one oneshot conversion, recorded as the unit's last one
+  esp_err_t convert(int &raw);
+  /// @brief applies atten/bitwidth to the driver and selects (or creates)
+  /// the matching calibration
+  esp_err_t reconfigure(adc_atten_t atten, adc_bitwidth_t bitwidth);
+  /// @brief calibration scheme of atten/bitwidth, created on first use
+  esp_err_t calibrationFor(adc_atten_t atten, adc_bitwidth_t bitwidth,
+                           adc_cali_handle_t &handle, bool &created);
 
-  adc_oneshot_unit_handle_t _oneshot_handle;
-  adc_continuous_handle_t _cont_handle;
-  adc_channel_t _channel;
-  adc_cali_handle_t _cali_handle;
+  struct CaliEntry {
+    adc_atten_t atten;
+    adc_bitwidth_t bitwidth;
+    adc_cali_handle_t handle;
+  };
+
+  ADCUnit *_unit = nullptr;
+  std::shared_ptr<ADCUnit> _unit_ref; // set if the unit is shared
+  Driver *_driver = nullptr;
+  adc_oneshot_unit_handle_t _oneshot_handle = nullptr;
+  adc_channel_t _channel = ADC_CHANNEL_0;
+  adc_atten_t _atten = ADC_ATTEN_DB_12;
+  adc_bitwidth_t _bitwidth = ADC_BITWIDTH_12;
+  adc_cali_handle_t _cali_handle = nullptr; // scheme in use
+  std::vector<CaliEntry> _cali_cache;       // owns every scheme
+  ReconfigStats _reconfig_stats = {};
+  int _settle_discard = 0;
+  uint32_t _discarded = 0;
+  MemoryTracker _memory;       // parent: the unit's
+  bool _out_of_memory = false; // set by a capture callback to stop it
   bool _is_initialized = false;
 };
 
@@ -113,9 +619,42 @@ public:
   /// please notice ADC_UNIT_2 has just 1 channel, and speecial features,
   /// usually just the channels of UNIT1 will be used in ESP. Check tech doc.
   /// @param unit_id
-  /// @return a pointer to the initialized unit
-  static ADCUnit *create(adc_unit_t unit_id = ADC_UNIT_1);
+  /// @param ulp_mode ADC_ULP_MODE_FSM / ADC_ULP_MODE_RISCV hands the unit to
+  /// the ULP coprocessor (chips with a ULP only), see ED_adc_ulp.h
+  /// @param driver backend of the unit: the ESP-IDF driver by default, or a
+  /// SimDriver to run against simulated hardware and time
+  /// @return the initialized unit, nullptr if the driver refused it or the
+  /// unit is already in use (created, or acquired with acquire()); use
+  /// acquire() when several components need the same unit
+  static std::unique_ptr<ADCUnit>
+  create(adc_unit_t unit_id = ADC_UNIT_1,
+         adc_ulp_mode_t ulp_mode = ADC_ULP_MODE_DISABLE,
+         Driver &driver = defaultDriver());
+  /**
+   * @brief returns the process-wide instance of a unit, creating it on the
+   * first call. Components that acquire the same unit share it; the driver
+   * unit is deleted when the last reference (including channels created
+   * from it) is released.
+   * @example
+   *
+  std::shared_ptr<ADCUnit> adc = ADCUnit::acquire(ADC_UNIT_1);
+  auto ADC0 = ADCChannel::create(adc, ADC_CHANNEL_0, ADC_ATTEN_DB_6);
+   *
+   * @param unit_id
+   * @param ulp_mode must match the mode of an existing instance
+   * @param driver backend; instances are kept per driver
+   * @return the shared unit, nullptr if it could not be created or exists
+   * with another ulp_mode
+   */
+  static std::shared_ptr<ADCUnit>
+  acquire(adc_unit_t unit_id = ADC_UNIT_1,
+          adc_ulp_mode_t ulp_mode = ADC_ULP_MODE_DISABLE,
+          Driver &driver = defaultDriver());
+  /// @brief releases the continuous and oneshot driver units
   ~ADCUnit();
+  // channels refer to their unit by address
+  ADCUnit(const ADCUnit &) = delete;
+  ADCUnit &operator=(const ADCUnit &) = delete;
   // Getters for both types of handles
   /**
    * @brief Get the Oneshot Handle for one shot readings of the Analog channel
@@ -133,17 +672,58 @@ public:
 
   adc_unit_t getUnitId() const;
 
+  /**
+   * @brief restarts a running continuous driver that stopped delivering
+   * frames: stop, deinit, re-create and start again. getContinuousHandle()
+   * returns the new handle afterwards.
+   * @param stalled_since_us time of the last good frame, in clock() time;
+   * the downtime is measured from there
+   * @param downtime_us [out, optional] measured downtime
+   * @return esp_err_t error of re-creating or starting the driver; the
+   * handle is released in that case and created again on next use
+   */
+  esp_err_t recoverContinuous(int64_t stalled_since_us,
+                              int64_t *downtime_us = nullptr);
+  RecoveryStats recoveryStats() const { return _recovery_stats; }
+
+  /// @brief caps the heap all channels of the unit may hold at once for
+  /// sampling, see ADCChannel::setMemoryLimit(). 0 (default): no limit
+  void setMemoryLimit(size_t bytes) { _memory.setLimit(bytes); }
+  /// @brief heap held by the sampling calls of all channels of the unit
+  MemoryStats memoryStats() const { return _memory.stats(); }
+
+  Driver &driver() const { return _driver; }
+  /// @brief settings the continuous driver is created with
+  const ContinuousConfig &continuousConfig() const { return _cont_config; }
+  /// @brief time base used by the unit's channels
+  Clock &clock() const { return _driver.clock(); }
+
 private:
-  ADCUnit(adc_unit_t unit_id);
+  friend class ADCChannel;
+  friend class FrameStream;
+  ADCUnit(adc_unit_t unit_id, adc_ulp_mode_t ulp_mode, Driver &driver);
+  /// @brief records a oneshot conversion; true if the unit converted
+  /// another channel or attenuation before it
+  bool noteConversion(adc_channel_t channel, adc_atten_t atten);
   bool isInitialized() const;
   esp_err_t ensureContinuousInitialized(); // Fixed indentation
 
   // Fixed member declaration order to match constructor initialization list
   bool _is_initialized = false;
+  Driver &_driver;
   adc_unit_t _unit_id;
+  adc_ulp_mode_t _ulp_mode;
   adc_continuous_handle_t _cont_handle;
+  ContinuousConfig _cont_config;
   bool _continuous_initialized = false; // Added default initialization
   adc_oneshot_unit_handle_t _oneshot_handle;
+  bool _owned = false; // made by create(), registered until destroyed
+  RecoveryStats _recovery_stats = {};
+  MemoryTracker _memory; // sum of the channels' trackers
+  // input the sampling capacitor was last connected to
+  bool _has_last_conversion = false;
+  adc_channel_t _last_channel = ADC_CHANNEL_0;
+  adc_atten_t _last_atten = ADC_ATTEN_DB_0;
 };
 
 } // namespace ED_ADC
\ No newline at end of file
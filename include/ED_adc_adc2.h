@@ -0,0 +1,114 @@
+#pragma once
+#include "ED_adc.h"
+#include "ED_adc_clock.h"
+#include <functional>
+#include <vector>
+
+namespace ED_ADC {
+
+/// @brief timing of an Adc2Scheduler
+struct Adc2SchedulerConfig {
+  uint32_t retry_ms = 1;      // wait after the first refused read, doubled
+  uint32_t max_retry_ms = 16; // for each further one up to this
+  uint32_t max_wait_ms = 500; // a queued read fails with ESP_ERR_TIMEOUT
+                              // after waiting this long
+  size_t queue_depth = 8;     // reads that can be queued at once
+};
+
+/// @brief what an Adc2Scheduler has seen so far
+typedef struct {
+  uint32_t submitted;
+  uint32_t completed;   // reads that delivered a voltage
+  uint32_t expired;     // reads given up after max_wait_ms
+  uint32_t rejected;    // submit() with a full queue
+  uint32_t contentions; // conversions refused because the radio held ADC2
+  int64_t max_wait_us;  // from submit() to completion
+  int64_t total_wait_us;
+  int64_t max_busy_us;  // longest observed radio-busy stretch
+} Adc2Stats;
+
+/**
+ * @brief serialises oneshot reads of ADC2 channels around Wi-Fi.
+ * While the radio holds ADC2 the driver refuses conversions with
+ * ESP_ERR_TIMEOUT. The scheduler treats that as contention: it keeps the
+ * read queued, backs off, and drains the whole queue as soon as a
+ * conversion succeeds again, so queued reads land in the same radio-idle
+ * window. Each read reports how long it waited.
+ * Not thread-safe: submit() and poll() must be called from the same task.
+ * On host, SimDriver::setAdc2Contention() provides the radio activity.
+ * @example
+ *
+  auto adc2 = ADCUnit::create(ADC_UNIT_2);
+  auto ch = ADCChannel::create(adc2.get(), ADC_CHANNEL_0, ADC_ATTEN_DB_12);
+  Adc2Scheduler scheduler(*adc2);
+  scheduler.submit(*ch, [](esp_err_t err, int mv, int64_t wait_us) { ... });
+  while (scheduler.pending()) {
+    scheduler.poll();
+    vTaskDelay(1);
+  }
+ *
+ */
+class Adc2Scheduler {
+public:
+  /// @brief err, calibrated voltage (mV) and time spent queued
+  using Callback =
+      std::function<void(esp_err_t err, int voltage_mv, int64_t wait_us)>;
+
+  explicit Adc2Scheduler(ADCUnit &unit,
+                         const Adc2SchedulerConfig &config = {});
+
+  /**
+   * @brief queues a read of channel, which must belong to the unit
+   * @return esp_err_t ESP_ERR_INVALID_ARG if channel is on another unit,
+   * ESP_ERR_NO_MEM if the queue is full
+   */
+  esp_err_t submit(ADCChannel &channel, Callback callback);
+
+  /**
+   * @brief services the queue without blocking: tries the oldest read if
+   * its retry time has come and, on success, every other queued read
+   * @return size_t reads completed or expired by this call
+   */
+  size_t poll();
+
+  /**
+   * @brief blocking read that waits for a radio-idle window, polling on
+   * the unit's clock
+   * @param wait_us [out, optional] time spent waiting
+   * @return esp_err_t ESP_ERR_TIMEOUT if no window opened within
+   * max_wait_ms, or an error of submit()
+   */
+  esp_err_t read(ADCChannel &channel, int &voltage,
+                 int64_t *wait_us = nullptr);
+
+  size_t pending() const { return _count; }
+  /// @brief time (unit clock) at which poll() will next try a conversion
+  int64_t nextAttemptUs() const { return _next_attempt_us; }
+  /// @brief true while the last conversion was refused by the radio
+  bool contended() const { return _busy_since_us >= 0; }
+
+  Adc2Stats stats() const { return _stats; }
+  void resetStats() { _stats = {}; }
+
+private:
+  struct Request {
+    ADCChannel *channel;
+    Callback callback;
+    int64_t submitted_us;
+  };
+
+  void complete(esp_err_t err, int voltage, int64_t now_us);
+
+  Clock &_clock;
+  adc_unit_t _unit_id;
+  Adc2SchedulerConfig _config;
+  std::vector<Request> _queue; // ring of queue_depth entries
+  size_t _head = 0;
+  size_t _count = 0;
+  uint32_t _retries = 0; // refusals in a row
+  int64_t _next_attempt_us = 0;
+  int64_t _busy_since_us = -1; // first refusal of the current stretch
+  Adc2Stats _stats = {};
+};
+
+} // namespace ED_ADC
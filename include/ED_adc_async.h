@@ -0,0 +1,239 @@
+#pragma once
+#include "ED_adc.h"
+#include "ED_adc_pm.h"
+
+#if ED_ADC_HAS_COROUTINES
+#include <coroutine>
+#include <cstdlib>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ED_ADC {
+
+namespace detail {
+
+// Shared part of the Task promises: a task is started lazily when awaited
+// and hands control back to its awaiter (symmetric transfer) when it ends.
+struct TaskPromiseBase {
+  std::coroutine_handle<> continuation;
+
+  struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<P> h) const noexcept {
+      std::coroutine_handle<> next = h.promise().continuation;
+      return next ? next : std::noop_coroutine();
+    }
+    void await_resume() const noexcept {}
+  };
+
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  FinalAwaiter final_suspend() const noexcept { return {}; }
+  // the library is built without exceptions on target
+  void unhandled_exception() const noexcept { std::abort(); }
+};
+
+template <typename T> struct TaskPromise : TaskPromiseBase {
+  T value{};
+  void return_value(T v) { value = std::move(v); }
+};
+
+template <> struct TaskPromise<void> : TaskPromiseBase {
+  void return_void() const noexcept {}
+};
+
+} // namespace detail
+
+/**
+ * @brief lazily started coroutine returning a T.
+ * Either co_await it from another coroutine or hand it to
+ * Executor::spawn() to run it at top level.
+ */
+template <typename T = void> class Task {
+public:
+  struct promise_type : detail::TaskPromise<T> {
+    Task get_return_object() {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+  };
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  Task() = default;
+  Task(Task &&other) noexcept : _handle(std::exchange(other._handle, {})) {}
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      if (_handle)
+        _handle.destroy();
+      _handle = std::exchange(other._handle, {});
+    }
+    return *this;
+  }
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+  ~Task() {
+    if (_handle)
+      _handle.destroy();
+  }
+
+  bool done() const { return !_handle || _handle.done(); }
+
+  /// @brief gives up ownership of the coroutine frame (used by Executor)
+  handle_type release() { return std::exchange(_handle, {}); }
+
+  bool await_ready() const noexcept { return done(); }
+  std::coroutine_handle<>
+  await_suspend(std::coroutine_handle<> awaiting) noexcept {
+    _handle.promise().continuation = awaiting;
+    return _handle;
+  }
+  T await_resume() {
+    if constexpr (!std::is_void_v<T>)
+      return std::move(_handle.promise().value);
+  }
+
+private:
+  explicit Task(handle_type handle) : _handle(handle) {}
+  handle_type _handle;
+};
+
+/**
+ * @brief minimal single-task cooperative executor.
+ * Coroutines suspended on sleepFor() or on a FrameStream are queued with
+ * their wake-up time; run() resumes them in time order and blocks the
+ * calling FreeRTOS task only while nothing is due. Not thread safe: schedule
+ * and spawn from the task that runs the executor.
+ * @example
+ *
+  Executor exec;
+  exec.spawn(pollSensor(exec, ADC0));  // Task<void> pollSensor(...)
+  exec.spawn(pollSensor(exec, ADC1));
+  exec.run();
+ *
+ */
+class Executor {
+public:
+  class SleepAwaiter {
+  public:
+    SleepAwaiter(Executor &executor, int64_t wake_at_us)
+        : _executor(executor), _wake_at_us(wake_at_us) {}
+    bool await_ready() const noexcept;
+    void await_suspend(std::coroutine_handle<> h) const;
+    void await_resume() const noexcept {}
+
+  private:
+    Executor &_executor;
+    int64_t _wake_at_us;
+  };
+
+  /// @param clock [in] time base for sleepFor(); the channels' clock
+  explicit Executor(Clock &clock = SystemClock::instance()) : _clock(clock) {}
+  Executor(const Executor &) = delete;
+  Executor &operator=(const Executor &) = delete;
+  /// @brief destroys the frames of spawned tasks that did not finish
+  ~Executor();
+
+  /// @brief takes ownership of a task and schedules it to start
+  template <typename T> void spawn(Task<T> &&task) {
+    std::coroutine_handle<> handle = task.release();
+    _owned.push_back(handle);
+    schedule(handle);
+  }
+
+  /// @brief queues a coroutine to be resumed at wake_at_us (0 = now)
+  void schedule(std::coroutine_handle<> handle, int64_t wake_at_us = 0);
+
+  /// @brief suspends the calling coroutine for at least ms milliseconds
+  SleepAwaiter sleepFor(uint32_t ms);
+
+  /**
+   * @brief resumes every coroutine that is due, without blocking
+   * @return the number of coroutines resumed
+   */
+  size_t runOnce();
+
+  /// @brief runs until no coroutine is queued any more
+  void run();
+
+  size_t pending() const { return _queue.size(); }
+  Clock &clock() const { return _clock; }
+
+private:
+  struct Entry {
+    int64_t wake_at_us;
+    std::coroutine_handle<> handle;
+  };
+  void reap();
+
+  Clock &_clock;
+  std::vector<Entry> _queue;
+  std::vector<std::coroutine_handle<>> _owned;
+};
+
+/**
+ * @brief continuous-mode capture delivered frame by frame to a coroutine.
+ * Obtained from ADCChannel::openStream(); the converter runs from
+ * construction until the stream is destroyed or stop() is called.
+ * The read buffer and the frame count against the channel's memory limit
+ * until the stream is destroyed; if they do not fit it never starts.
+ */
+class FrameStream {
+public:
+  FrameStream(FrameStream &&other) noexcept;
+  FrameStream &operator=(FrameStream &&) = delete;
+  FrameStream(const FrameStream &) = delete;
+  FrameStream &operator=(const FrameStream &) = delete;
+  ~FrameStream();
+
+  /**
+   * @brief waits, without blocking the task, until the driver has a frame
+   * and converts it to mV. The result is available through frame().
+   * A stalled or failing driver is restarted as in sampleForDuration().
+   * @return Task<esp_err_t> ESP_OK when a frame was delivered,
+   * ESP_ERR_INVALID_STATE if the stream is stopped or cancelled,
+   * ESP_ERR_TIMEOUT if the options' deadline passed, or the error of a
+   * failed driver restart (the stream is stopped then)
+   */
+  Task<esp_err_t> nextFrame();
+
+  /// @brief calibrated voltages (mV) of the last frame delivered
+  const std::vector<int> &frame() const { return _frame; }
+  /// @brief true if the driver was restarted between the previous frame
+  /// and frame(), i.e. samples are missing before it
+  bool gapBefore() const { return _gap_before; }
+  /// @brief driver restarts of this stream so far
+  uint32_t recoveries() const { return _recoveries; }
+
+  /// @brief stops the converter; pending nextFrame() calls fail
+  void stop();
+
+  bool isRunning() const { return _running; }
+
+  /// delay in ms between two driver polls while no frame is ready
+  static constexpr uint32_t POLL_INTERVAL_MS = 1;
+
+private:
+  friend class ADCChannel;
+  FrameStream(ADCChannel &channel, Executor &executor,
+              const CaptureOptions &options);
+  bool tryRead();
+  /// @brief restarts the driver if the watchdog limits are exceeded
+  esp_err_t checkWatchdog();
+
+  ADCChannel *_channel;
+  Executor *_executor;
+  CaptureOptions _options;
+  std::vector<uint8_t> _buffer;
+  std::vector<int> _frame;
+  PmLock::Guard _pm_guard; // held while the converter runs
+  bool _running = false;
+  int64_t _last_frame_us = 0;
+  uint32_t _consecutive_errors = 0;
+  uint32_t _recoveries = 0;
+  bool _gap_before = false;
+};
+
+} // namespace ED_ADC
+
+#endif // ED_ADC_HAS_COROUTINES
@@ -0,0 +1,120 @@
+#pragma once
+#include "ED_adc_port.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace ED_ADC {
+
+static constexpr size_t BENCH_NAME_SIZE = 24; // terminator included
+
+/// @brief how runBenchmarks() measures
+struct BenchConfig {
+  uint32_t samples = 20000; // per call of each hot path; the capture
+                            // benchmarks store up to 4 bytes per sample
+  uint32_t min_run_us = 100000; // calls are repeated until a run lasts this
+  uint32_t runs = 21;           // after one warm-up run
+  double tolerance = 0.15; // slowdown compareBench() reports on top of the
+                           // baseline's own spread, 0.15 = 15%
+  uint32_t retries = 2;    // gateBench() re-runs of a regressed benchmark
+};
+
+/// @brief cost of one hot path, from runBenchmarks()
+typedef struct {
+  char name[BENCH_NAME_SIZE];
+  uint64_t samples; // per run, repeats included
+  uint32_t runs;
+  double ns_per_sample;     // median run
+  double min_ns_per_sample; // fastest run
+} BenchResult;
+
+/// @brief one benchmark of a run against its baseline, from compareBench()
+typedef struct {
+  char name[BENCH_NAME_SIZE];
+  double baseline_ns; // fastest run, per sample; 0 if the baseline lacks
+                      // the benchmark
+  double current_ns;  // fastest run, per sample; 0 if the run lacks it
+  double change;      // current / baseline - 1
+  double limit;       // change allowed: tolerance plus the baseline's spread
+  bool regressed;     // fastest and median run above the limit
+  bool missing;       // in the baseline but not in the run; a failure too
+} BenchComparison;
+
+/**
+ * @brief times the per-sample hot paths of the library on a SimDriver, so
+ * only the library's own work is measured and the results can be compared
+ * across builds and machines of the same kind:
+ *  - read: read(), i.e. oneshot conversion, calibration, average, min/max
+ *    and percentile widths
+ *  - read_streamed: readStreamed(), the same without sample storage
+ *  - capture_decode: captureFrames(), frame decoding only
+ *  - capture_calibrate: sampleForDuration(), decoding, calibration, storage
+ *  - histogram_raw: histogramForDuration() into raw codes
+ *  - stream_pack: SampleStreamer packing, CRC and COBS framing
+ * Captures run in simulated time, so a run takes as long as the work.
+ * Runs on host and on target; time is taken from SystemClock. Other load
+ * on the machine shows up as slowdowns, so gate on a quiet one and keep
+ * baselines per machine. On host, the ed_adc_bench runner of test/ wraps
+ * the example below (targets bench_record and bench_check).
+ * @example
+ *
+  // on an accepted build: the baseline
+  writeBenchResults(stdout, runBenchmarks());
+
+  // on a release candidate: gate against the baseline
+  std::vector<BenchResult> baseline, current;
+  FILE *file = fopen("bench_baseline.csv", "r");
+  readBenchResults(file, baseline);
+  std::vector<BenchComparison> report;
+  size_t failures = gateBench(baseline, {}, current, report);
+  writeBenchComparison(stderr, report);
+  return failures > 0 ? 1 : 0;
+ *
+ * @param only [in, optional] name of the one benchmark to run
+ */
+std::vector<BenchResult> runBenchmarks(const BenchConfig &config = {},
+                                       const char *only = nullptr);
+
+/// @brief writes results as CSV: a header line, then one line per
+/// benchmark: name, ns_per_sample, min_ns_per_sample, samples, runs
+esp_err_t writeBenchResults(FILE *file,
+                            const std::vector<BenchResult> &results);
+/// @return bool false if the file does not start with the header written by
+/// writeBenchResults() or a line is malformed
+bool readBenchResults(FILE *file, std::vector<BenchResult> &results);
+
+/**
+ * @brief matches current against baseline by name. A benchmark regressed
+ * if both its fastest and its median run are slower than its limit: the
+ * tolerance plus the baseline's spread (median over fastest run), so a
+ * benchmark that was noisy when recorded is given the room it needed.
+ * The fastest run is the least disturbed by other load on the machine,
+ * and the median confirms the slowdown is not a single lucky baseline run.
+ * @param tolerance [in] fraction a benchmark may be slower than its
+ * baseline, on top of the spread, before it counts as a regression
+ * @param report [out] one entry per benchmark of either set, baseline
+ * order first
+ * @return size_t failures: regressions plus benchmarks of the baseline
+ * missing from current; new benchmarks are only reported
+ */
+size_t compareBench(const std::vector<BenchResult> &baseline,
+                    const std::vector<BenchResult> &current,
+                    double tolerance, std::vector<BenchComparison> &report);
+
+/**
+ * @brief runs the benchmarks and compares them with baseline, re-running
+ * each regressed one up to config.retries times and keeping its best runs,
+ * so a burst of load on the machine is not reported as a regression
+ * @param current [out] results, re-runs merged in
+ * @return size_t failures, as compareBench()
+ */
+size_t gateBench(const std::vector<BenchResult> &baseline,
+                 const BenchConfig &config, std::vector<BenchResult> &current,
+                 std::vector<BenchComparison> &report);
+
+/// @brief writes a report as a human-readable table
+void writeBenchComparison(FILE *file,
+                          const std::vector<BenchComparison> &report);
+
+} // namespace ED_ADC
@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+namespace ED_ADC {
+
+/**
+ * @brief source of time and sleeping for code that has to run both on the
+ * target and against simulated time.
+ */
+class Clock {
+public:
+  virtual ~Clock() = default;
+  /// @brief monotonic time in us
+  virtual int64_t nowUs() = 0;
+  /// @brief blocks the calling task for ms milliseconds
+  virtual void delayMs(uint32_t ms) = 0;
+  /// @brief sleeps us microseconds allowing the chip to enter light sleep.
+  /// Defaults to delayMs() rounded up.
+  virtual void lightSleepUs(int64_t us) {
+    if (us > 0)
+      delayMs((us + 999) / 1000);
+  }
+};
+
+/// @brief esp_timer / FreeRTOS / esp_sleep based clock
+class SystemClock : public Clock {
+public:
+  static SystemClock &instance();
+  int64_t nowUs() override;
+  void delayMs(uint32_t ms) override;
+  /// @brief forced light sleep woken by the RTC timer. Other tasks are
+  /// suspended for the duration.
+  void lightSleepUs(int64_t us) override;
+};
+
+/**
+ * @brief clock that only moves when slept on or advanced, so time-dependent
+ * logic runs deterministically and as fast as the host allows.
+ */
+class VirtualClock : public Clock {
+public:
+  explicit VirtualClock(int64_t start_us = 0) : _now_us(start_us) {}
+  int64_t nowUs() override { return _now_us; }
+  void delayMs(uint32_t ms) override { advanceUs((int64_t)ms * 1000); }
+  void lightSleepUs(int64_t us) override { advanceUs(us); }
+  void advanceUs(int64_t us) {
+    if (us > 0)
+      _now_us += us;
+  }
+
+private:
+  std::atomic<int64_t> _now_us;
+};
+
+} // namespace ED_ADC
@@ -0,0 +1,291 @@
+#pragma once
+#include "ED_adc_clock.h"
+#include "ED_adc_port.h"
+#include <atomic>
+#include <functional>
+#include <vector>
+
+namespace ED_ADC {
+
+/// @brief continuous-mode settings of a unit
+struct ContinuousConfig {
+  uint32_t sample_freq_hz = 20000;
+  uint32_t max_store_buf_size = 1024; // driver pool, bytes
+  uint32_t conv_frame_size = 256;     // bytes per frame
+  adc_channel_t channel = ADC_CHANNEL_0;
+  adc_atten_t atten = ADC_ATTEN_DB_12;
+};
+
+/**
+ * @brief the ADC driver calls used by ADCUnit/ADCChannel, and the clock the
+ * library times itself with. IdfDriver forwards to ESP-IDF; SimDriver
+ * produces samples in simulated time so captures are reproducible on host.
+ * Continuous frames use the ADC_DIGI_OUTPUT_FORMAT_TYPE2 layout decoded by
+ * ADCChannel (2 bytes per sample, 12-bit code in the low bits).
+ */
+class Driver {
+public:
+  virtual ~Driver() = default;
+
+  virtual Clock &clock() = 0;
+
+  virtual esp_err_t oneshotNewUnit(adc_unit_t unit, adc_ulp_mode_t ulp_mode,
+                                   adc_oneshot_unit_handle_t *handle) = 0;
+  virtual esp_err_t oneshotDelUnit(adc_oneshot_unit_handle_t handle) = 0;
+  virtual esp_err_t oneshotConfigChannel(adc_oneshot_unit_handle_t handle,
+                                         adc_channel_t channel,
+                                         adc_atten_t atten,
+                                         adc_bitwidth_t bitwidth) = 0;
+  virtual esp_err_t oneshotRead(adc_oneshot_unit_handle_t handle,
+                                adc_channel_t channel, int *raw) = 0;
+
+  virtual esp_err_t caliCreate(adc_unit_t unit, adc_channel_t channel,
+                               adc_atten_t atten, adc_bitwidth_t bitwidth,
+                               adc_cali_handle_t *handle) = 0;
+  virtual esp_err_t caliDelete(adc_cali_handle_t handle) = 0;
+  virtual esp_err_t caliRawToVoltage(adc_cali_handle_t handle, int raw,
+                                     int *voltage) = 0;
+
+  /// @brief creates and configures the continuous handle
+  virtual esp_err_t continuousNew(adc_unit_t unit,
+                                  const ContinuousConfig &config,
+                                  adc_continuous_handle_t *handle) = 0;
+  virtual esp_err_t continuousDeinit(adc_continuous_handle_t handle) = 0;
+  virtual esp_err_t continuousStart(adc_continuous_handle_t handle) = 0;
+  virtual esp_err_t continuousRead(adc_continuous_handle_t handle,
+                                   uint8_t *buffer, uint32_t length,
+                                   uint32_t *bytes_read,
+                                   uint32_t timeout_ms) = 0;
+  virtual esp_err_t continuousStop(adc_continuous_handle_t handle) = 0;
+  /// @brief number of times the driver pool overflowed since the handle
+  /// was created
+  virtual uint32_t continuousOverflows(adc_continuous_handle_t handle) = 0;
+};
+
+#if defined(ESP_PLATFORM)
+/// @brief the ESP-IDF adc_oneshot / adc_continuous / adc_cali drivers
+class IdfDriver : public Driver {
+public:
+  static IdfDriver &instance();
+
+  Clock &clock() override { return SystemClock::instance(); }
+
+  esp_err_t oneshotNewUnit(adc_unit_t unit, adc_ulp_mode_t ulp_mode,
+                           adc_oneshot_unit_handle_t *handle) override;
+  esp_err_t oneshotDelUnit(adc_oneshot_unit_handle_t handle) override;
+  esp_err_t oneshotConfigChannel(adc_oneshot_unit_handle_t handle,
+                                 adc_channel_t channel, adc_atten_t atten,
+                                 adc_bitwidth_t bitwidth) override;
+  esp_err_t oneshotRead(adc_oneshot_unit_handle_t handle,
+                        adc_channel_t channel, int *raw) override;
+  esp_err_t caliCreate(adc_unit_t unit, adc_channel_t channel,
+                       adc_atten_t atten, adc_bitwidth_t bitwidth,
+                       adc_cali_handle_t *handle) override;
+  esp_err_t caliDelete(adc_cali_handle_t handle) override;
+  esp_err_t caliRawToVoltage(adc_cali_handle_t handle, int raw,
+                             int *voltage) override;
+  esp_err_t continuousNew(adc_unit_t unit, const ContinuousConfig &config,
+                          adc_continuous_handle_t *handle) override;
+  esp_err_t continuousDeinit(adc_continuous_handle_t handle) override;
+  esp_err_t continuousStart(adc_continuous_handle_t handle) override;
+  esp_err_t continuousRead(adc_continuous_handle_t handle, uint8_t *buffer,
+                           uint32_t length, uint32_t *bytes_read,
+                           uint32_t timeout_ms) override;
+  esp_err_t continuousStop(adc_continuous_handle_t handle) override;
+  uint32_t continuousOverflows(adc_continuous_handle_t handle) override;
+
+private:
+  static bool onPoolOverflow(adc_continuous_handle_t handle,
+                             const adc_continuous_evt_data_t *edata,
+                             void *user_data);
+
+  // one continuous handle exists per ADC controller
+  std::atomic<uint32_t> _overflows{0};
+};
+#endif
+
+/// @brief counters of a SimDriver
+typedef struct {
+  uint64_t oneshot_reads;
+  uint64_t samples_produced; // continuous samples converted
+  uint64_t samples_dropped;  // lost because the pool was full
+  uint32_t pool_overflows;   // times the pool filled up
+  uint64_t adc2_contentions; // ADC2 reads refused because of the radio
+} SimStats;
+
+/**
+ * @brief deterministic stand-in for the ADC hardware, driven by a
+ * VirtualClock. Continuous samples are produced at sample_freq_hz as
+ * simulated time passes and stored in a pool of max_store_buf_size bytes;
+ * when it is full the newest samples are dropped, as the real driver does.
+ * A read that finds no complete frame advances the clock to the next frame
+ * (the time the caller would have spent waiting) and returns
+ * ESP_ERR_TIMEOUT when timeout_ms is 0.
+ * A 10 s capture at 20 kHz thus runs in simulated time, in milliseconds.
+ */
+class SimDriver : public Driver {
+public:
+  /// @brief signal source: raw 12-bit code of channel at time t_us
+  using Signal = std::function<int(adc_channel_t channel, int64_t t_us)>;
+
+  explicit SimDriver(VirtualClock &clock);
+
+  /// @brief replaces the default signal (mid-scale code 2048)
+  void setSignal(Signal signal) { _signal = std::move(signal); }
+  /// @brief simulated duration of a oneshot conversion
+  void setConversionTimeUs(int64_t us) { _conversion_us = us; }
+  /// @brief fraction of the previous conversion's charge the sampling
+  /// capacitor keeps: each oneshot result is pulled that far towards the
+  /// previous one, so the first samples after a channel switch are biased
+  /// (0 = ideal source, default)
+  void setChargeRetention(float fraction) { _retention = fraction; }
+  /// @brief radio activity: true while Wi-Fi holds ADC2 at time t_us.
+  /// ADC2 oneshot reads then fail with ESP_ERR_TIMEOUT, as on target
+  using Contention = std::function<bool(int64_t t_us)>;
+  void setAdc2Contention(Contention contention) {
+    _contention = std::move(contention);
+  }
+  /// @brief radio busy for busy_us at the start of every period_us
+  static Contention periodicContention(int64_t period_us, int64_t busy_us);
+  SimStats stats() const { return _stats; }
+
+  Clock &clock() override { return _clock; }
+
+  esp_err_t oneshotNewUnit(adc_unit_t unit, adc_ulp_mode_t ulp_mode,
+                           adc_oneshot_unit_handle_t *handle) override;
+  esp_err_t oneshotDelUnit(adc_oneshot_unit_handle_t handle) override;
+  esp_err_t oneshotConfigChannel(adc_oneshot_unit_handle_t handle,
+                                 adc_channel_t channel, adc_atten_t atten,
+                                 adc_bitwidth_t bitwidth) override;
+  esp_err_t oneshotRead(adc_oneshot_unit_handle_t handle,
+                        adc_channel_t channel, int *raw) override;
+  /// @brief linear calibration: full scale of the attenuation over 4095
+  esp_err_t caliCreate(adc_unit_t unit, adc_channel_t channel,
+                       adc_atten_t atten, adc_bitwidth_t bitwidth,
+                       adc_cali_handle_t *handle) override;
+  esp_err_t caliDelete(adc_cali_handle_t handle) override;
+  esp_err_t caliRawToVoltage(adc_cali_handle_t handle, int raw,
+                             int *voltage) override;
+  esp_err_t continuousNew(adc_unit_t unit, const ContinuousConfig &config,
+                          adc_continuous_handle_t *handle) override;
+  esp_err_t continuousDeinit(adc_continuous_handle_t handle) override;
+  esp_err_t continuousStart(adc_continuous_handle_t handle) override;
+  esp_err_t continuousRead(adc_continuous_handle_t handle, uint8_t *buffer,
+                           uint32_t length, uint32_t *bytes_read,
+                           uint32_t timeout_ms) override;
+  esp_err_t continuousStop(adc_continuous_handle_t handle) override;
+  uint32_t continuousOverflows(adc_continuous_handle_t handle) override;
+
+protected:
+  /// @brief moves the samples due by now into the pool
+  void produce();
+  int sample(adc_channel_t channel, int64_t t_us);
+
+  VirtualClock &_clock;
+  Signal _signal;
+  Contention _contention;
+  int64_t _conversion_us = 20;
+  float _retention = 0.0f;
+  float _held = 0.0f; // charge of the sampling capacitor, as a code
+  SimStats _stats = {};
+
+  // a single continuous handle is simulated
+  ContinuousConfig _cont_config;
+  bool _cont_created = false;
+  bool _cont_running = false;
+  int64_t _next_sample_us = 0;
+  std::vector<uint8_t> _pool;
+};
+
+/// @brief faults a FaultInjectingDriver adds. Rates are probabilities in
+/// [0, 1] per call (per sample for stuck values).
+struct FaultConfig {
+  float oneshot_error_rate = 0.0f;   // oneshot read fails with oneshot_error
+  esp_err_t oneshot_error = ESP_FAIL;
+  float oneshot_timeout_rate = 0.0f; // ESP_ERR_TIMEOUT, as ADC2 under Wi-Fi
+  float read_error_rate = 0.0f;      // continuous read fails with ESP_FAIL
+  float read_timeout_rate = 0.0f;    // continuous read times out, data kept
+  float overflow_rate = 0.0f;        // continuous read loses its data to a
+                                     // pool overflow
+  float stuck_rate = 0.0f;           // sample repeats the previous value
+  float stall_rate = 0.0f;           // continuous driver stops delivering
+                                     // frames until it is re-created
+  uint32_t seed = 1;                 // same seed, same fault sequence
+};
+
+/// @brief faults injected so far
+typedef struct {
+  uint32_t oneshot_errors;
+  uint32_t oneshot_timeouts;
+  uint32_t read_errors;
+  uint32_t read_timeouts;
+  uint32_t overflows;
+  uint32_t stuck_samples;
+  uint32_t stalls;
+} FaultStats;
+
+/**
+ * @brief decorator that injects errors, timeouts, pool overflows and stuck
+ * values into another driver's results, from a seeded pseudo-random
+ * sequence. Over a SimDriver the recovery behaviour and throughput under
+ * faults are fully deterministic; over IdfDriver it can exercise the error
+ * paths on target.
+ * @example
+ *
+  VirtualClock clock;
+  SimDriver sim(clock);
+  FaultConfig faults;
+  faults.overflow_rate = 0.01f;
+  FaultInjectingDriver driver(sim, faults);
+  auto unit = ADCUnit::create(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, driver);
+ *
+ */
+class FaultInjectingDriver : public Driver {
+public:
+  FaultInjectingDriver(Driver &inner, const FaultConfig &config = {});
+
+  void setConfig(const FaultConfig &config);
+  FaultStats stats() const { return _stats; }
+
+  Clock &clock() override { return _inner.clock(); }
+
+  esp_err_t oneshotNewUnit(adc_unit_t unit, adc_ulp_mode_t ulp_mode,
+                           adc_oneshot_unit_handle_t *handle) override;
+  esp_err_t oneshotDelUnit(adc_oneshot_unit_handle_t handle) override;
+  esp_err_t oneshotConfigChannel(adc_oneshot_unit_handle_t handle,
+                                 adc_channel_t channel, adc_atten_t atten,
+                                 adc_bitwidth_t bitwidth) override;
+  esp_err_t oneshotRead(adc_oneshot_unit_handle_t handle,
+                        adc_channel_t channel, int *raw) override;
+  esp_err_t caliCreate(adc_unit_t unit, adc_channel_t channel,
+                       adc_atten_t atten, adc_bitwidth_t bitwidth,
+                       adc_cali_handle_t *handle) override;
+  esp_err_t caliDelete(adc_cali_handle_t handle) override;
+  esp_err_t caliRawToVoltage(adc_cali_handle_t handle, int raw,
+                             int *voltage) override;
+  esp_err_t continuousNew(adc_unit_t unit, const ContinuousConfig &config,
+                          adc_continuous_handle_t *handle) override;
+  esp_err_t continuousDeinit(adc_continuous_handle_t handle) override;
+  esp_err_t continuousStart(adc_continuous_handle_t handle) override;
+  esp_err_t continuousRead(adc_continuous_handle_t handle, uint8_t *buffer,
+                           uint32_t length, uint32_t *bytes_read,
+                           uint32_t timeout_ms) override;
+  esp_err_t continuousStop(adc_continuous_handle_t handle) override;
+  uint32_t continuousOverflows(adc_continuous_handle_t handle) override;
+
+private:
+  /// @brief true with probability rate
+  bool roll(float rate);
+
+  Driver &_inner;
+  FaultConfig _config;
+  FaultStats _stats = {};
+  uint32_t _rng_state;
+  int _last_raw = 0;
+  bool _stalled = false;
+};
+
+/// @brief the driver used when none is given to ADCUnit::create()
+Driver &defaultDriver();
+
+} // namespace ED_ADC
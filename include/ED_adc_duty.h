@@ -0,0 +1,97 @@
+#pragma once
+#include "ED_adc.h"
+#include "ED_adc_clock.h"
+#include <functional>
+#include <vector>
+
+namespace ED_ADC {
+
+/// @brief schedule of a DutyCycleSampler
+struct DutyCycleConfig {
+  uint32_t period_ms = 1000; // wake-up interval, start to start
+  int burst_samples = 1;     // conversions per wake-up
+  size_t batch_size = 16;    // samples handed to the callback at once
+  // true: forced light sleep between bursts (all tasks stop).
+  // false: plain task delay, light sleep only if the PM auto light sleep is
+  // configured
+  bool light_sleep = true;
+};
+
+/// @brief rough supply currents used to turn the counters into energy.
+/// Replace the defaults with figures measured on the actual board.
+struct EnergyModel {
+  float supply_v = 3.3f;
+  float active_ma = 20.0f;  // CPU awake, radio off
+  float sleep_ma = 0.13f;   // light sleep
+  float adc_ma = 1.0f;      // extra while converting
+  uint32_t conversion_us = 20;
+};
+
+/// @brief what a DutyCycleSampler has done so far
+typedef struct {
+  uint32_t wakeups;
+  uint32_t samples;
+  uint32_t errors;
+  uint32_t batches;
+  int64_t active_us; // from wake-up to the start of the next sleep
+  int64_t sleep_us;  // time spent sleeping between bursts
+} DutyCycleCounters;
+
+/**
+ * @brief low-energy sampling: wakes on a timer, takes a short burst of
+ * oneshot conversions, then sleeps again until the next period. Samples are
+ * batched so the consumer only runs once every batch_size samples.
+ * Runs on the calling task; with a VirtualClock it runs in simulated time.
+ * @example
+ *
+  DutyCycleConfig cfg;
+  cfg.period_ms = 5000;
+  DutyCycleSampler sampler(*ADC0, cfg);
+  sampler.run(120, [](const std::vector<int> &batch_mv) { ... });
+  float uj = sampler.energyPerMeasurementUj();
+ *
+ */
+class DutyCycleSampler {
+public:
+  using BatchCallback = std::function<void(const std::vector<int> &)>;
+
+  /// @brief schedules, sleeps and accounts energy in the channel's clock,
+  /// so a SimDriver's VirtualClock drives the samples and the bursts alike
+  explicit DutyCycleSampler(ADCChannel &channel,
+                            const DutyCycleConfig &config = {});
+  /// @param clock [in] time base to use instead of the channel's
+  DutyCycleSampler(ADCChannel &channel, const DutyCycleConfig &config,
+                   Clock &clock);
+
+  /**
+   * @brief performs wakeup_count sleep/burst cycles. A partially filled
+   * batch is delivered before returning.
+   * @param wakeup_count [in] number of bursts
+   * @param callback [in] receives each batch of calibrated voltages (mV)
+   * @param options [in] cancellation token and deadline (in the clock's
+   * time base), checked at each wake-up
+   * @return esp_err_t ESP_OK, or the reason it stopped early as in
+   * ADCChannel::read()
+   */
+  esp_err_t run(uint32_t wakeup_count, const BatchCallback &callback,
+                const CaptureOptions &options = {});
+
+  DutyCycleCounters counters() const { return _counters; }
+  void resetCounters() { _counters = {}; }
+
+  /// @brief estimated energy per sample (uJ) from the counters
+  float energyPerMeasurementUj(const EnergyModel &model = {}) const;
+  /// @brief average supply current (mA) over the counted time
+  float averageCurrentMa(const EnergyModel &model = {}) const;
+
+private:
+  float totalEnergyUj(const EnergyModel &model) const;
+
+  ADCChannel &_channel;
+  DutyCycleConfig _config;
+  Clock &_clock;
+  DutyCycleCounters _counters = {};
+  std::vector<int> _batch;
+};
+
+} // namespace ED_ADC
@@ -0,0 +1,140 @@
+#pragma once
+#include "ED_adc_port.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ED_ADC {
+
+/// @brief what the bins of a CodeHistogram count
+enum class HistogramUnit : uint8_t {
+  RawCode,    // bin i: raw 12-bit code i
+  Millivolts, // bin i: calibrated mV in [i * bin_width, (i + 1) * bin_width)
+};
+
+/**
+ * @brief ranks (0-based, into n sorted samples) a percentile width is
+ * taken between: (n-1)*p/100 and (n-1)*(100-p)/100, rounded down and
+ * ordered so lower <= upper. Shared by ADCChannel::read() and
+ * CodeHistogram so both give the same width for the same samples.
+ * @param n [in] at least 1
+ */
+inline void percentileRanks(uint64_t n, int8_t percentile, uint64_t &lower,
+                            uint64_t &upper) {
+  const uint64_t a = (n - 1) * percentile / 100;
+  const uint64_t b = (n - 1) * (100 - percentile) / 100;
+  lower = a < b ? a : b;
+  upper = a < b ? b : a;
+}
+
+/**
+ * @brief code-density histogram of 4096 bins, filled directly from the
+ * sampling loop (ADCChannel::readHistogram(), histogramForDuration()) so
+ * the distribution of any number of samples is kept in a fixed 16 KB.
+ * Values outside the bins are counted in the first / last bin and in
+ * clipped(). Bin counts are 32-bit and saturate; counts lost to a full
+ * bin are kept in saturated().
+ * Captures accumulate: a histogram is only emptied by clear().
+ * @example
+ *
+  CodeHistogram hist(HistogramUnit::Millivolts, 1);
+  ADC0->histogramForDuration(1000, hist);
+  ADC0->histogramForDuration(1000, hist); // 2 s in total
+  int noise_mv = hist.percentileWidth(30);
+
+  std::vector<uint8_t> packed(hist.encode(nullptr, 0));
+  hist.encode(packed.data(), packed.size());
+ *
+ */
+class CodeHistogram {
+public:
+  static constexpr size_t BINS = 4096;
+
+  /// @param bin_width [in] mV per bin for HistogramUnit::Millivolts, at
+  /// least 1; ignored (1) for raw codes
+  explicit CodeHistogram(HistogramUnit unit = HistogramUnit::RawCode,
+                         uint16_t bin_width = 1);
+
+  HistogramUnit unit() const { return _unit; }
+  uint16_t binWidth() const { return _bin_width; }
+
+  /// @brief counts a value in the histogram's unit
+  void add(int value) {
+    int bin = _bin_width == 1 ? value : value / _bin_width;
+    if (value < 0 || bin >= (int)BINS) {
+      bin = value < 0 ? 0 : (int)BINS - 1;
+      _clipped++;
+    }
+    increment(_bins[bin]);
+    _total++;
+  }
+  /// @brief counts raw 12-bit codes (HistogramUnit::RawCode)
+  void addCodes(const uint16_t *codes, size_t count);
+
+  /// @brief adds the counts of other
+  /// @return esp_err_t ESP_ERR_INVALID_ARG if unit or bin width differ
+  esp_err_t merge(const CodeHistogram &other);
+  void clear();
+
+  uint32_t count(size_t bin) const { return bin < BINS ? _bins[bin] : 0; }
+  /// @brief samples counted
+  uint64_t total() const { return _total; }
+  /// @brief samples counted in the first / last bin although outside them
+  uint64_t clipped() const { return _clipped; }
+  /// @brief samples in total() that a full bin could not count
+  uint64_t saturated() const { return _saturated; }
+  /// @brief lowest value of a bin
+  int binValue(size_t bin) const { return (int)bin * _bin_width; }
+
+  /// @brief lowest / highest value counted (bin lower edge), 0 if empty
+  int minValue() const;
+  int maxValue() const;
+  /// @brief mean of the bin centres, 0 if empty
+  double mean() const;
+  /// @brief value of the rank-th smallest sample (0-based, bin lower
+  /// edge), as data[rank] of the sorted samples
+  int valueAtRank(uint64_t rank) const;
+  /**
+   * @brief spread of the middle of the distribution, as ADCReadResult's
+   * p30_width_mv: value at the upper minus value at the lower rank of
+   * percentileRanks()
+   * @param percentile valid range 10 to 90
+   */
+  int percentileWidth(int8_t percentile) const;
+
+  /**
+   * @brief sparse run-length export: "EDH1", unit, 0, bin width (uint16),
+   * clipped (varint), then runs until the last non-empty bin, each the
+   * number of empty bins, the number of non-empty bins that follow and
+   * their counts, all unsigned LEB128 varints. A typical noise
+   * distribution of a few dozen codes takes well under 100 bytes.
+   * @param out [out] may be nullptr when size is 0
+   * @return size_t bytes of the encoding; nothing is written if it exceeds
+   * size
+   */
+  size_t encode(uint8_t *out, size_t size) const;
+  /// @brief replaces hist by an encoded histogram
+  /// @return bool false if data is not a valid encoding; hist is cleared
+  static bool decode(const uint8_t *data, size_t size, CodeHistogram &hist);
+
+private:
+  void increment(uint32_t &bin) {
+    if (bin == UINT32_MAX) {
+      _saturated++;
+    } else {
+      bin++;
+    }
+  }
+  /// @brief encodes into the bytes of out that fit in size
+  /// @return size_t bytes of the whole encoding
+  size_t write(uint8_t *out, size_t size) const;
+
+  HistogramUnit _unit;
+  uint16_t _bin_width;
+  std::vector<uint32_t> _bins;
+  uint64_t _total = 0;
+  uint64_t _clipped = 0;
+  uint64_t _saturated = 0;
+};
+
+} // namespace ED_ADC
@@ -0,0 +1,347 @@
+#pragma once
+#include "ED_adc.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#if defined(ESP_PLATFORM)
+#include "ED_adc_task.h"
+#include "esp_partition.h"
+#endif
+
+namespace ED_ADC {
+
+/*
+ * Flash layout of a DataLogger, little endian. The storage is a ring of
+ * segments (files or partition regions) made of fixed-size pages. A
+ * segment is erased when the logger enters it, so the oldest data is
+ * overwritten once the ring is full.
+ *
+ * page:    offset  size  field
+ *          0       2     magic (LOG_PAGE_MAGIC)
+ *          2       2     CRC-16/CCITT-FALSE of bytes 4 to used - 1
+ *          4       1     version (LOG_VERSION)
+ *          5       1     reserved
+ *          6       4     page sequence, +1 per page written
+ *          10      2     used: header and records, in bytes
+ *          12      ...   records, then 0xFF up to the page size
+ *
+ * record:  0       1     type (LogRecordType)
+ *          1       1     channel id
+ *          2       2     payload length
+ *          4       8     timestamp, us (int64)
+ *          12      ...   payload
+ *
+ * Result payload: average, min, max, p30 width, p60 width, sample count,
+ * error count, skipped count as int32, then partial and stop reason as
+ * uint8. Samples payload: sample period in us (uint32), then the codes
+ * 12-bit packed as in ED_adc_stream.h.
+ */
+static constexpr uint16_t LOG_PAGE_MAGIC = 0xAD1C;
+static constexpr uint8_t LOG_VERSION = 1;
+static constexpr size_t LOG_PAGE_HEADER_SIZE = 12;
+static constexpr size_t LOG_RECORD_HEADER_SIZE = 12;
+
+enum class LogRecordType : uint8_t {
+  Result = 1,  // an ADCReadResult
+  Samples = 2, // a burst of raw codes
+  User = 0x80, // first type free for the application
+};
+
+/**
+ * @brief page-addressed storage of a DataLogger: a ring of segment_count
+ * segments of pages_per_segment pages each. Pages are only written after
+ * their segment was erased, and in order within a segment.
+ */
+class LogStorage {
+public:
+  virtual ~LogStorage() = default;
+
+  size_t pageSize() const { return _page_size; }
+  size_t segmentCount() const { return _segment_count; }
+  size_t pagesPerSegment() const { return _pages_per_segment; }
+
+  virtual esp_err_t erase(size_t segment) = 0;
+  virtual esp_err_t writePage(size_t segment, size_t page,
+                              const uint8_t *data) = 0;
+  /// @brief reads a whole page; a page never written reads as 0xFF
+  virtual esp_err_t readPage(size_t segment, size_t page, uint8_t *data) = 0;
+
+protected:
+  LogStorage(size_t page_size, size_t segment_count, size_t pages_per_segment)
+      : _page_size(page_size), _segment_count(segment_count),
+        _pages_per_segment(pages_per_segment) {}
+
+  size_t _page_size;
+  size_t _segment_count;
+  size_t _pages_per_segment;
+};
+
+/// @brief storage in RAM, as flash would behave (erased bytes are 0xFF).
+/// Lost on reset; meant for host runs.
+class RamLogStorage : public LogStorage {
+public:
+  RamLogStorage(size_t segment_count, size_t pages_per_segment,
+                size_t page_size = 4096);
+
+  esp_err_t erase(size_t segment) override;
+  esp_err_t writePage(size_t segment, size_t page,
+                      const uint8_t *data) override;
+  esp_err_t readPage(size_t segment, size_t page, uint8_t *data) override;
+
+  std::vector<uint8_t> &data() { return _data; }
+
+private:
+  std::vector<uint8_t> _data;
+};
+
+/**
+ * @brief one file per segment, named <path_prefix><index>.log, e.g. on a
+ * FAT or LittleFS mount ("/data/adc" gives /data/adc0.log, ...) or in a
+ * host directory. Erasing a segment truncates its file.
+ */
+class FileLogStorage : public LogStorage {
+public:
+  FileLogStorage(const char *path_prefix, size_t segment_count,
+                 size_t pages_per_segment, size_t page_size = 4096);
+  ~FileLogStorage() override;
+  FileLogStorage(const FileLogStorage &) = delete;
+  FileLogStorage &operator=(const FileLogStorage &) = delete;
+
+  esp_err_t erase(size_t segment) override;
+  esp_err_t writePage(size_t segment, size_t page,
+                      const uint8_t *data) override;
+  esp_err_t readPage(size_t segment, size_t page, uint8_t *data) override;
+
+private:
+  std::string path(size_t segment) const;
+
+  std::string _prefix;
+  FILE *_file = nullptr; // segment being written, kept open
+  size_t _file_segment = 0;
+};
+
+#if defined(ESP_PLATFORM)
+/**
+ * @brief raw flash partition without a file system: pages are flash
+ * sectors and a segment is pages_per_segment sectors, so every erase and
+ * write is aligned and nothing else shares the sectors.
+ */
+class PartitionLogStorage : public LogStorage {
+public:
+  explicit PartitionLogStorage(const esp_partition_t *partition,
+                               size_t pages_per_segment = 4);
+
+  esp_err_t erase(size_t segment) override;
+  esp_err_t writePage(size_t segment, size_t page,
+                      const uint8_t *data) override;
+  esp_err_t readPage(size_t segment, size_t page, uint8_t *data) override;
+
+private:
+  size_t offset(size_t segment, size_t page) const;
+
+  const esp_partition_t *_partition;
+};
+#endif
+
+/// @brief RAM held by a DataLogger between capture and storage
+struct LoggerConfig {
+  size_t buffer_pages = 4; // pages queued for the writer before records
+                           // are dropped
+};
+
+/// @brief what a DataLogger has done so far
+typedef struct {
+  uint32_t records;         // records accepted
+  uint32_t dropped_records; // rejected because every buffer page was full
+  uint64_t logged_bytes;    // record bytes accepted, headers included
+  uint32_t pages_written;
+  uint64_t bytes_written; // pages_written * page size
+  uint32_t erases;        // segments erased
+  uint32_t write_errors;
+  float write_amplification; // bytes_written / logged_bytes
+} LoggerStats;
+
+/**
+ * @brief logging sink for channel results and raw bursts. Records are
+ * packed into page-sized RAM buffers; only full pages (or the last one, on
+ * seal()) reach the storage, so each flash write is one whole page.
+ * The log*() calls copy into the buffer and never wait for the storage: if
+ * the writer falls behind and every buffer page is queued, the record is
+ * dropped and counted.
+ * The writer is pump(): on target startWriter() runs it on a low-priority
+ * task, on host it is called directly. log*() must be called from one
+ * task, pump() from one (possibly different) task.
+ * A new logger resumes after the newest page found in the storage, in a
+ * fresh segment.
+ * @example
+ *
+  const esp_partition_t *part = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "adclog");
+  PartitionLogStorage flash(part);
+  DataLogger logger(flash);
+  TaskConfig cfg;
+  cfg.priority = 1;
+  logger.startWriter(cfg);
+
+  ADCReadResult r = {};
+  ADC0->read(100, 1, r);
+  logger.logResult(0, r, esp_timer_get_time());
+ *
+ */
+class DataLogger {
+public:
+  DataLogger(LogStorage &storage, const LoggerConfig &config = {});
+  ~DataLogger();
+  DataLogger(const DataLogger &) = delete;
+  DataLogger &operator=(const DataLogger &) = delete;
+
+  /// @return bool false if the record was dropped
+  bool logResult(uint8_t channel_id, const ADCReadResult &result,
+                 int64_t t_us);
+
+  /**
+   * @brief logs raw codes, split into as many records as needed
+   * @param t_us [in] timestamp of codes[0]; the following samples are
+   * sample_period_us apart
+   * @return size_t samples logged; the rest were dropped
+   */
+  size_t logSamples(uint8_t channel_id, const uint16_t *codes, size_t count,
+                    int64_t t_us, uint32_t sample_period_us);
+
+  /**
+   * @brief logs an application record
+   * @param type [in] LogRecordType::User or above
+   * @return bool false if the record was dropped or does not fit in a page
+   */
+  bool append(LogRecordType type, uint8_t channel_id, const void *payload,
+              size_t length, int64_t t_us);
+
+  /// @brief queues the page being filled, even if not full
+  void seal();
+
+  /**
+   * @brief writes every queued page to the storage; called by the writer
+   * task, or directly when there is none
+   * @return size_t pages written
+   */
+  size_t pump();
+
+  /// @brief seals the current page and waits until everything is written
+  /// (by the writer task if it runs, else by calling pump())
+  void flush();
+
+  LoggerStats stats() const;
+
+#if defined(ESP_PLATFORM)
+  /// @brief default of startWriter(): just above the idle task, so page
+  /// writes only run when the capture and the application have nothing to do
+  static TaskConfig writerTaskConfig() {
+    TaskConfig config;
+    config.name = "ed_adc_log";
+    config.priority = tskIDLE_PRIORITY + 1;
+    return config;
+  }
+  /// @brief starts a task that writes pages as soon as they are queued.
+  /// Give it a lower priority than the capture.
+  esp_err_t startWriter(const TaskConfig &config = writerTaskConfig());
+  void stopWriter();
+  /// @brief see WorkerTask::stackHighWater()
+  uint32_t stackHighWater() const { return _writer.stackHighWater(); }
+#endif
+
+private:
+  struct Page {
+    std::vector<uint8_t> data;
+    size_t used = 0; // header included
+    std::atomic<bool> ready{false};
+  };
+
+  /// @brief room for a record of length payload bytes, in the current page
+  /// or a new one; nullptr if no page is free
+  uint8_t *reserve(LogRecordType type, uint8_t channel_id, size_t length,
+                   int64_t t_us);
+  /// @brief payload bytes left in the open page, 0 if none is open
+  size_t room() const;
+  void resume();
+  void notifyWriter();
+
+  LogStorage &_storage;
+  std::vector<Page> _pages;
+  size_t _fill = 0;   // page the producer writes
+  size_t _send = 0;   // page the writer takes next
+  bool _open = false; // _pages[_fill] holds records
+
+  size_t _segment = 0;   // where the writer goes next
+  size_t _next_page = 0; // 0: the segment must be erased first
+  uint32_t _page_sequence = 0;
+
+  std::atomic<uint32_t> _records{0};
+  std::atomic<uint32_t> _dropped{0};
+  std::atomic<uint64_t> _logged_bytes{0};
+  std::atomic<uint32_t> _pages_written{0};
+  std::atomic<uint32_t> _erases{0};
+  std::atomic<uint32_t> _write_errors{0};
+
+#if defined(ESP_PLATFORM)
+  WorkerTask _writer; // last: stopped before the members pump() uses
+#endif
+};
+
+/// @brief one record read back by a LogReader; payload points into the
+/// reader's page buffer and is valid during the callback only
+typedef struct {
+  LogRecordType type;
+  uint8_t channel_id;
+  int64_t t_us;
+  const uint8_t *payload;
+  size_t length;
+} LogRecord;
+
+/// @brief what a LogReader found
+typedef struct {
+  uint32_t pages;
+  uint32_t records;
+  uint32_t corrupt_pages; // bad CRC or layout; skipped
+} LogReaderStats;
+
+/**
+ * @brief reads a DataLogger storage back, oldest page first, also after
+ * the page sequence wrapped around
+ * @example
+ *
+  LogReader reader(flash);
+  reader.forEach([](const LogRecord &rec) {
+    ADCReadResult r;
+    if (LogReader::decodeResult(rec, r))
+      printf("%lld %d\n", (long long)rec.t_us, r.average_mv);
+  });
+ *
+ */
+class LogReader {
+public:
+  using Callback = std::function<void(const LogRecord &record)>;
+
+  explicit LogReader(LogStorage &storage) : _storage(storage) {}
+
+  /// @return size_t records visited
+  size_t forEach(const Callback &callback);
+  LogReaderStats stats() const { return _stats; }
+
+  static bool decodeResult(const LogRecord &record, ADCReadResult &result);
+  /// @brief appends the codes of a Samples record to codes
+  /// @return size_t codes decoded, 0 if the record is not a Samples record
+  static size_t decodeSamples(const LogRecord &record,
+                              std::vector<uint16_t> &codes,
+                              uint32_t *sample_period_us = nullptr);
+
+private:
+  LogStorage &_storage;
+  LogReaderStats _stats = {};
+};
+
+} // namespace ED_ADC
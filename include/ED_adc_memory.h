@@ -0,0 +1,58 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace ED_ADC {
+
+/// @brief heap used by a channel or unit for sample storage and buffers
+typedef struct {
+  size_t current_bytes;      // held right now
+  size_t peak_bytes;         // highest current_bytes seen
+  size_t largest_allocation; // biggest single allocation
+  uint32_t allocations;
+  uint32_t refused;   // allocations refused by the limit
+  size_t limit_bytes; // 0: unlimited
+} MemoryStats;
+
+/**
+ * @brief accounts the allocations of a channel or unit against an optional
+ * limit. A tracker can have a parent (a channel's is its unit's): an
+ * allocation is only granted if it fits both, and is counted in both.
+ * A growing buffer is accounted as acquire(new size) before the copy and
+ * release(old size) after it, so the peak includes the moment both exist.
+ * Lock-free; acquire() and release() may be called from any task.
+ */
+class MemoryTracker {
+public:
+  explicit MemoryTracker(MemoryTracker *parent = nullptr)
+      : _parent(parent) {}
+  MemoryTracker(const MemoryTracker &) = delete;
+  MemoryTracker &operator=(const MemoryTracker &) = delete;
+
+  MemoryTracker *parent() const { return _parent; }
+  void setParent(MemoryTracker *parent) { _parent = parent; }
+  /// @brief bytes this tracker may hold at once; 0 removes the limit
+  void setLimit(size_t bytes) { _limit = bytes; }
+  size_t limit() const { return _limit; }
+
+  /// @return bool false, with nothing accounted, if bytes would exceed the
+  /// limit of this tracker or of a parent
+  bool acquire(size_t bytes);
+  void release(size_t bytes);
+
+  MemoryStats stats() const;
+  /// @brief restarts peak, largest allocation and counters from now
+  void resetStats();
+
+private:
+  MemoryTracker *_parent;
+  std::atomic<size_t> _limit{0};
+  std::atomic<size_t> _current{0};
+  std::atomic<size_t> _peak{0};
+  std::atomic<size_t> _largest{0};
+  std::atomic<uint32_t> _allocations{0};
+  std::atomic<uint32_t> _refused{0};
+};
+
+} // namespace ED_ADC
@@ -0,0 +1,146 @@
+#pragma once
+#include "ED_adc.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace ED_ADC {
+
+/// @brief upper bounds (us) of the read latency histogram buckets; a last
+/// bucket catches everything above
+static constexpr int64_t METRICS_LATENCY_BOUNDS_US[] = {
+    100, 500, 1000, 5000, 10000, 50000, 100000, 500000, 1000000};
+static constexpr size_t METRICS_LATENCY_BUCKETS =
+    sizeof(METRICS_LATENCY_BOUNDS_US) / sizeof(METRICS_LATENCY_BOUNDS_US[0]) +
+    1;
+static constexpr size_t METRICS_NAME_SIZE = 24; // terminator included
+
+/// @brief counters and gauges of one channel, as held by a MetricsRegistry
+typedef struct {
+  // gauges: the latest value / read result
+  int32_t last_mv;
+  int32_t average_mv;
+  int32_t min_mv;
+  int32_t max_mv;
+  int32_t p30_width_mv;
+  int32_t p60_width_mv;
+  // counters since the channel was added
+  uint64_t reads;         // read() results recorded
+  uint64_t partial_reads; // of which stopped early
+  uint64_t samples;       // samples behind reads and captures
+  uint64_t errors;        // failed conversions and read errors
+  uint64_t skipped;       // samples given up after retries
+  uint64_t overflows;     // continuous-mode pool overflows
+  uint64_t recoveries;    // continuous-mode restarts
+  // read latency histogram, buckets not cumulative
+  uint32_t latency_buckets[METRICS_LATENCY_BUCKETS];
+  uint64_t latency_count;
+  int64_t latency_sum_us;
+} ChannelMetrics;
+
+/**
+ * @brief registry of per-channel metrics, rendered for scraping either as
+ * Prometheus text or as a compact binary snapshot.
+ * Each channel is guarded by a sequence lock: a record*() call bumps the
+ * channel's sequence around its update, and a reader copies the channel
+ * and retries if the sequence moved meanwhile. Rendering therefore never
+ * blocks sampling, and every channel in the output is consistent.
+ * All memory is allocated by the constructor; addChannel(), record*() and
+ * render*() do not allocate.
+ * Each channel must be updated from one task at a time; render*() must be
+ * called from one task at a time.
+ * @example
+ *
+  MetricsRegistry metrics(4);
+  int ch0 = metrics.addChannel("battery");
+
+  int64_t t = esp_timer_get_time();
+  ADC0->read(100, 1, result);
+  metrics.recordRead(ch0, result, esp_timer_get_time() - t);
+
+  // HTTP handler
+  static char page[2048];
+  size_t n = metrics.renderPrometheus(page, sizeof(page));
+  if (n < sizeof(page))
+    httpd_resp_send(req, page, n);
+ *
+ */
+class MetricsRegistry {
+public:
+  explicit MetricsRegistry(size_t capacity);
+  MetricsRegistry(const MetricsRegistry &) = delete;
+  MetricsRegistry &operator=(const MetricsRegistry &) = delete;
+
+  /**
+   * @brief adds a channel, labelled name in the output
+   * @param name [in] truncated to METRICS_NAME_SIZE - 1 characters; should
+   * be a valid Prometheus label value (no quotes or backslashes)
+   * @return int channel id for record*(), -1 if the registry is full
+   */
+  int addChannel(const char *name);
+  size_t channelCount() const { return _count.load(); }
+
+  /// @brief a single voltage reading
+  void recordValue(int id, int voltage_mv);
+  /// @brief a read() result and how long the call took
+  void recordRead(int id, const ADCReadResult &result, int64_t latency_us);
+  /// @brief the outcome of a sampleForDuration() / captureFrames() call
+  void recordCapture(int id, const CaptureInfo &info);
+  /// @brief errors seen outside read() and captures
+  void recordErrors(int id, uint32_t errors = 1);
+  void reset(int id);
+
+  /// @brief consistent copy of a channel's metrics
+  /// @return bool false if id is unknown
+  bool snapshot(int id, ChannelMetrics &metrics) const;
+
+  /**
+   * @brief writes every channel in the Prometheus text exposition format
+   * @return size_t length of the full text, like snprintf(); the output is
+   * complete only if this is less than size
+   */
+  size_t renderPrometheus(char *buffer, size_t size) const;
+
+  /**
+   * @brief writes a binary snapshot, little endian:
+   * "EDM" version(1) channel count(1), then per channel: name
+   * (METRICS_NAME_SIZE bytes, zero padded), the ChannelMetrics fields in
+   * declaration order (int32 gauges, uint64 counters, uint32 buckets,
+   * uint64 count, int64 sum)
+   * @return size_t bytes written, 0 if size is too small
+   */
+  size_t renderBinary(uint8_t *buffer, size_t size) const;
+  /// @brief size renderBinary() needs for the current channels
+  size_t binarySize() const;
+
+  /**
+   * @brief host side of renderBinary()
+   * @return int channels decoded, -1 if the data is malformed
+   */
+  static int parseBinary(
+      const uint8_t *data, size_t size,
+      const std::function<void(const char *name, const ChannelMetrics &)>
+          &callback);
+
+private:
+  struct Slot {
+    char name[METRICS_NAME_SIZE] = {};
+    std::atomic<uint32_t> sequence{0}; // odd while being written
+    ChannelMetrics metrics = {};
+  };
+
+  Slot *slot(int id);
+  const Slot *slot(int id) const;
+  static void beginWrite(Slot &slot);
+  static void endWrite(Slot &slot);
+  /// @brief copies all channels into _render, each one consistent
+  size_t snapshotAll() const;
+
+  std::vector<Slot> _slots;
+  std::atomic<size_t> _count{0};
+  mutable std::vector<ChannelMetrics> _render; // scratch of render*()
+};
+
+} // namespace ED_ADC
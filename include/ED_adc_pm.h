@@ -0,0 +1,106 @@
+#pragma once
+#include "ED_adc_port.h"
+#include <atomic>
+#include <cstdint>
+
+#if defined(ESP_PLATFORM)
+#include "sdkconfig.h"
+#endif
+
+#if defined(ESP_PLATFORM) && CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#define ED_ADC_HAS_PM_LOCK 1
+#else
+#define ED_ADC_HAS_PM_LOCK 0
+#endif
+
+namespace ED_ADC {
+
+/// @brief counters kept by PmLock, see PmLock::stats()
+typedef struct {
+  uint32_t captures;        // captures started since boot
+  uint32_t locked_captures; // captures that ran holding the lock
+  // captures that held the lock while dynamic frequency scaling was
+  // configured: captures the lock guarded, not changes it prevented
+  uint32_t protected_captures;
+  // captures that saw the APB frequency change, once each: between two of
+  // their frames (continuous) or samples (oneshot) while the lock is
+  // enabled, else only between their start and end
+  uint32_t freq_changes_observed;
+} PmLockStats;
+
+/**
+ * @brief optional esp_pm lock held for the duration of continuous and timed
+ * captures (sampleForDuration(), read(), FrameStream), so dynamic frequency
+ * scaling cannot change the APB clock mid-capture.
+ * Disabled by default. On builds without CONFIG_PM_ENABLE (and on host)
+ * acquiring is a no-op and only the counters are kept.
+ * @example
+ *
+  PmLock::instance().enable(true);
+  auto voltages = ADC0->sampleForDuration(500); // runs at max APB frequency
+ *
+ */
+class PmLock {
+public:
+  static PmLock &instance();
+
+  /**
+   * @brief turns lock taking on or off. The esp_pm lock is created on first
+   * enable.
+   * @return esp_err_t error of esp_pm_lock_create()
+   */
+  esp_err_t enable(bool enabled);
+  bool isEnabled() const { return _enabled; }
+  PmLockStats stats() const;
+
+  /// @brief RAII scope of a capture: acquires on construction if enabled and
+  /// releases on destruction or on release()
+  class Guard {
+  public:
+    Guard();
+    Guard(Guard &&other) noexcept;
+    ~Guard();
+    Guard &operator=(Guard &&) = delete;
+    Guard(const Guard &) = delete;
+    Guard &operator=(const Guard &) = delete;
+
+    /// @brief ends the capture scope early
+    void release();
+    /// @brief samples the APB frequency; called once per frame or sample so
+    /// a change within the capture is seen even if it is undone by the end.
+    /// Free while the lock is disabled: the frequency is then only compared
+    /// at the end of the capture
+    void sample() {
+      if (_tracking)
+        check();
+    }
+
+  private:
+    void check();
+
+    bool _active = true;
+    bool _locked = false;
+    bool _tracking = false; // the lock was enabled at the start
+    bool _changed = false;  // already counted in freq_changes_observed
+    uint32_t _apb_hz = 0;   // at the previous sample()
+  };
+
+private:
+  PmLock() = default;
+  bool acquire();
+  void release();
+  static uint32_t apbFreqHz();
+  static bool dfsActive();
+
+  std::atomic<bool> _enabled{false};
+  std::atomic<uint32_t> _captures{0};
+  std::atomic<uint32_t> _locked_captures{0};
+  std::atomic<uint32_t> _protected_captures{0};
+  std::atomic<uint32_t> _freq_changes_observed{0};
+#if ED_ADC_HAS_PM_LOCK
+  esp_pm_lock_handle_t _handle = nullptr;
+#endif
+};
+
+} // namespace ED_ADC
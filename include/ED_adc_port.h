@@ -0,0 +1,99 @@
+#pragma once
+// Platform layer: on ESP-IDF the driver headers are used as they are; on a
+// host build (no ESP_PLATFORM) the few types and macros the library needs
+// are declared here so it can run against SimDriver and VirtualClock.
+
+#if defined(ESP_PLATFORM)
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+#include "esp_adc/adc_continuous.h" // Include for continuous mode
+#include "esp_adc/adc_oneshot.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h" // Include for high-resolution timer
+#else
+#include <cstdint>
+#include <cstdio>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_TIMEOUT 0x107
+
+inline const char *esp_err_to_name(esp_err_t err) {
+  switch (err) {
+  case ESP_OK:
+    return "ESP_OK";
+  case ESP_FAIL:
+    return "ESP_FAIL";
+  case ESP_ERR_NO_MEM:
+    return "ESP_ERR_NO_MEM";
+  case ESP_ERR_INVALID_ARG:
+    return "ESP_ERR_INVALID_ARG";
+  case ESP_ERR_INVALID_STATE:
+    return "ESP_ERR_INVALID_STATE";
+  case ESP_ERR_INVALID_SIZE:
+    return "ESP_ERR_INVALID_SIZE";
+  case ESP_ERR_NOT_FOUND:
+    return "ESP_ERR_NOT_FOUND";
+  case ESP_ERR_NOT_SUPPORTED:
+    return "ESP_ERR_NOT_SUPPORTED";
+  case ESP_ERR_TIMEOUT:
+    return "ESP_ERR_TIMEOUT";
+  default:
+    return "UNKNOWN ERROR";
+  }
+}
+
+#define ESP_LOGE(tag, format, ...)                                             \
+  fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...)                                             \
+  fprintf(stderr, "W %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...)                                             \
+  fprintf(stderr, "I %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)
+
+// values as in ESP-IDF hal/adc_types.h
+typedef enum { ADC_UNIT_1, ADC_UNIT_2 } adc_unit_t;
+typedef enum {
+  ADC_CHANNEL_0,
+  ADC_CHANNEL_1,
+  ADC_CHANNEL_2,
+  ADC_CHANNEL_3,
+  ADC_CHANNEL_4,
+  ADC_CHANNEL_5,
+  ADC_CHANNEL_6,
+  ADC_CHANNEL_7,
+  ADC_CHANNEL_8,
+  ADC_CHANNEL_9,
+} adc_channel_t;
+typedef enum {
+  ADC_ATTEN_DB_0 = 0,
+  ADC_ATTEN_DB_2_5 = 1,
+  ADC_ATTEN_DB_6 = 2,
+  ADC_ATTEN_DB_12 = 3,
+} adc_atten_t;
+typedef enum {
+  ADC_BITWIDTH_DEFAULT = 0,
+  ADC_BITWIDTH_9 = 9,
+  ADC_BITWIDTH_10 = 10,
+  ADC_BITWIDTH_11 = 11,
+  ADC_BITWIDTH_12 = 12,
+  ADC_BITWIDTH_13 = 13,
+} adc_bitwidth_t;
+typedef enum {
+  ADC_ULP_MODE_DISABLE = 0,
+  ADC_ULP_MODE_FSM = 1,
+  ADC_ULP_MODE_RISCV = 2,
+} adc_ulp_mode_t;
+
+typedef struct adc_oneshot_unit_ctx_t *adc_oneshot_unit_handle_t;
+typedef struct adc_continuous_ctx_t *adc_continuous_handle_t;
+typedef struct adc_cali_scheme_t *adc_cali_handle_t;
+#endif
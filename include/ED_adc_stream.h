@@ -0,0 +1,236 @@
+#pragma once
+#include "ED_adc_port.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+#if defined(ESP_PLATFORM)
+#include "ED_adc_task.h"
+#endif
+
+namespace ED_ADC {
+
+/*
+ * Wire format of a stream packet, little endian, before COBS encoding:
+ *
+ *   offset  size  field
+ *   0       1     version (STREAM_VERSION)
+ *   1       1     channel id
+ *   2       2     sequence, +1 per packet; skips one after dropped data
+ *   4       8     timestamp of the first sample, us (int64)
+ *   12      4     sample period, us
+ *   16      2     sample count n
+ *   18      m     samples, 12-bit packed: two codes a, b in three bytes
+ *                 [a & 0xFF] [(a >> 8) | (b & 0xF) << 4] [b >> 4];
+ *                 an odd last code takes two bytes [a & 0xFF] [a >> 8]
+ *   18 + m  2     CRC-16/CCITT-FALSE of all bytes above
+ *
+ * Each packet is COBS encoded and terminated by a 0x00 byte, so a reader
+ * can resynchronise at any delimiter.
+ */
+static constexpr uint8_t STREAM_VERSION = 1;
+static constexpr size_t STREAM_HEADER_SIZE = 18;
+static constexpr size_t STREAM_CRC_SIZE = 2;
+
+/// @brief CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF)
+uint16_t streamCrc16(const uint8_t *data, size_t length);
+/// @brief COBS-encodes length bytes into out, without the delimiter
+/// @return size_t encoded size, at most length + length / 254 + 1
+size_t cobsEncode(const uint8_t *data, size_t length, uint8_t *out);
+/// @brief decodes one COBS block (without delimiter) into out
+/// @return size_t decoded size, 0 if the block is malformed
+size_t cobsDecode(const uint8_t *data, size_t length, uint8_t *out);
+
+/// @brief destination of an encoded stream: UART, socket, file, ...
+class ByteTransport {
+public:
+  virtual ~ByteTransport() = default;
+  /// @brief writes all length bytes, blocking as long as needed
+  virtual esp_err_t write(const uint8_t *data, size_t length) = 0;
+};
+
+/// @brief transport over a stdio stream: a file, or a UART / socket opened
+/// through the VFS
+class FileTransport : public ByteTransport {
+public:
+  explicit FileTransport(FILE *file) : _file(file) {}
+  esp_err_t write(const uint8_t *data, size_t length) override;
+
+private:
+  FILE *_file;
+};
+
+/// @brief transport into memory, e.g. to loop a stream back to a decoder
+class MemoryTransport : public ByteTransport {
+public:
+  esp_err_t write(const uint8_t *data, size_t length) override;
+  std::vector<uint8_t> &data() { return _data; }
+
+private:
+  std::vector<uint8_t> _data;
+};
+
+/// @brief layout of the packets of a SampleStreamer
+struct StreamConfig {
+  uint8_t channel_id = 0;
+  uint16_t samples_per_packet = 240; // 383 bytes per packet on the wire
+  uint32_t sample_period_us = 50;    // 1 / sample rate, copied to packets
+};
+
+/// @brief what a SampleStreamer has done so far
+typedef struct {
+  uint32_t packets;         // packets handed to the transport
+  uint64_t samples;         // samples in those packets
+  uint64_t bytes;           // bytes written, framing included
+  uint64_t dropped_samples; // lost because both buffers were full
+  uint32_t write_errors;
+} StreamStats;
+
+/**
+ * @brief frames 12-bit samples into CRC-protected, COBS-delimited packets
+ * (see the wire format above) and writes them to a ByteTransport.
+ * Two packet buffers are used: the producer fills one while the sender
+ * writes the other, so the capture never waits for the transport. If the
+ * sender falls behind, new samples are dropped and counted, and the
+ * sequence number skips so the decoder sees the gap.
+ * push() must be called from one task and pump() from one (possibly
+ * different) task.
+ * @example
+ *
+  FileTransport uart(fopen("/dev/uart/1", "w"));
+  StreamConfig cfg;
+  cfg.sample_period_us = 50; // 20 kHz
+  SampleStreamer streamer(uart, cfg);
+  streamer.startSender(); // on target; on host call pump() instead
+  ADC0->captureFrames(10000, [&](const uint16_t *codes, size_t n, int64_t t) {
+    streamer.push(codes, n, t);
+  });
+  streamer.flush();
+ *
+ */
+class SampleStreamer {
+public:
+  SampleStreamer(ByteTransport &transport, const StreamConfig &config = {});
+  ~SampleStreamer();
+  SampleStreamer(const SampleStreamer &) = delete;
+  SampleStreamer &operator=(const SampleStreamer &) = delete;
+
+  /**
+   * @brief appends samples; never blocks
+   * @param codes [in] 12-bit codes (higher bits are dropped)
+   * @param t_us [in] timestamp of codes[0]; the following samples are
+   * sample_period_us apart
+   * @return size_t samples accepted; the rest were dropped
+   */
+  size_t push(const uint16_t *codes, size_t count, int64_t t_us);
+
+  /// @brief closes the packet being filled, even if not full, so it can be
+  /// sent
+  void seal();
+
+  /**
+   * @brief writes every sealed packet to the transport; called by the
+   * sender task, or directly when there is none
+   * @return size_t packets written
+   */
+  size_t pump();
+
+  /// @brief seals the current packet and waits until everything is written
+  /// (by the sender task if it runs, else by calling pump())
+  void flush();
+
+  StreamStats stats() const;
+
+#if defined(ESP_PLATFORM)
+  /// @brief starts a task that writes packets as soon as they are sealed.
+  /// Give it a lower priority than the capture.
+  esp_err_t startSender(const TaskConfig &config = TaskConfig());
+  void stopSender();
+  /// @brief see WorkerTask::stackHighWater()
+  uint32_t stackHighWater() const { return _sender.stackHighWater(); }
+#endif
+
+private:
+  struct Slot {
+    std::vector<uint8_t> packet; // raw packet being built
+    std::vector<uint8_t> frame;  // COBS frame ready to send
+    std::atomic<bool> ready{false};
+  };
+
+  /// @brief starts a packet in the current slot at time t_us
+  void begin(int64_t t_us);
+  /// @brief CRC + COBS of the current slot, handed over to pump()
+  void finish();
+  void notifySender();
+
+  ByteTransport &_transport;
+  StreamConfig _config;
+  Slot _slots[2];
+  int _fill = 0;      // slot the producer writes
+  int _send = 0;      // slot the sender reads next
+  bool _open = false; // a packet is being filled in _slots[_fill]
+  uint16_t _in_packet = 0;
+  int _pending_code = -1; // first code of an incomplete pair
+  uint16_t _sequence = 0;
+  bool _gap = false; // samples were dropped since the last packet
+
+  std::atomic<uint32_t> _packets{0};
+  std::atomic<uint64_t> _samples{0};
+  std::atomic<uint64_t> _bytes{0};
+  std::atomic<uint64_t> _dropped{0};
+  std::atomic<uint32_t> _write_errors{0};
+
+#if defined(ESP_PLATFORM)
+  WorkerTask _sender; // last: stopped before the members pump() uses
+#endif
+};
+
+/// @brief one packet recovered by a StreamDecoder
+typedef struct {
+  uint8_t channel_id;
+  uint16_t sequence;
+  int64_t timestamp_us;
+  uint32_t sample_period_us;
+  std::vector<uint16_t> samples;
+} StreamPacket;
+
+/// @brief what a StreamDecoder has seen so far
+typedef struct {
+  uint32_t packets;
+  uint64_t samples;
+  uint32_t crc_errors;
+  uint32_t framing_errors; // malformed COBS or packet layout
+  uint32_t lost_sequences; // sequence numbers skipped
+} StreamDecoderStats;
+
+/**
+ * @brief host side of SampleStreamer: splits a byte stream at the 0x00
+ * delimiters, checks each packet and hands the samples over. Bytes can be
+ * fed in chunks of any size; a stream joined mid-packet resynchronises at
+ * the next delimiter.
+ */
+class StreamDecoder {
+public:
+  using Callback = std::function<void(const StreamPacket &packet)>;
+
+  explicit StreamDecoder(Callback callback);
+
+  void feed(const uint8_t *data, size_t length);
+  StreamDecoderStats stats() const { return _stats; }
+
+private:
+  void decodeFrame();
+
+  Callback _callback;
+  std::vector<uint8_t> _frame;
+  std::vector<uint8_t> _packet;
+  StreamPacket _decoded;
+  bool _has_sequence = false;
+  uint16_t _next_sequence = 0;
+  StreamDecoderStats _stats = {};
+};
+
+} // namespace ED_ADC
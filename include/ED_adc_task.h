@@ -0,0 +1,156 @@
+#pragma once
+#include "ED_adc.h"
+
+// WorkerTask and SamplerTask are built on FreeRTOS tasks and only exist on
+// target
+#if defined(ESP_PLATFORM)
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <atomic>
+#include <functional>
+
+namespace ED_ADC {
+
+/// @brief placement of a task created by the library
+struct TaskConfig {
+  const char *name = "ed_adc";
+  BaseType_t core_id = tskNO_AFFINITY; // 0, 1 or tskNO_AFFINITY
+  UBaseType_t priority = 5;
+  uint32_t stack_size = 4096; // bytes
+};
+
+/**
+ * @brief a FreeRTOS task that runs one function until asked to stop: the
+ * create / stop handshake and stack bookkeeping of the library's tasks.
+ * The function polls stopRequested() and returns once it is set; it may
+ * wait in ulTaskNotifyTake(), which notify() and stop() cut short.
+ */
+class WorkerTask {
+public:
+  using Body = std::function<void()>;
+
+  WorkerTask() = default;
+  WorkerTask(const WorkerTask &) = delete;
+  WorkerTask &operator=(const WorkerTask &) = delete;
+  /// @brief stops the task. Owners whose members the body uses must call
+  /// stop() in their own destructor already
+  ~WorkerTask();
+
+  /**
+   * @brief creates the task, which runs body once and exits
+   * @return esp_err_t ESP_ERR_INVALID_STATE if already running,
+   * ESP_ERR_NO_MEM if the task could not be created
+   */
+  esp_err_t start(const TaskConfig &config, Body body);
+  /// @brief sets stopRequested() without waiting, e.g. before cancelling
+  /// what the body is blocked in
+  void requestStop() { _stop_requested = true; }
+  /// @brief requests the stop, wakes the task and waits for it to exit.
+  /// Must not be called from the task itself.
+  void stop();
+  /// @brief wakes the task from ulTaskNotifyTake(); no-op if not running
+  void notify();
+
+  bool isRunning() const { return _task != nullptr; }
+  bool stopRequested() const { return _stop_requested; }
+  /// @brief least free stack in bytes the task has had so far (FreeRTOS
+  /// high-water mark); the last value is kept after the task exits
+  uint32_t stackHighWater() const;
+
+private:
+  static void entry(void *arg);
+
+  Body _body;
+  TaskHandle_t _task = nullptr;
+  SemaphoreHandle_t _exited = nullptr;
+  std::atomic<bool> _stop_requested{false};
+  std::atomic<uint32_t> _stack_free{0}; // at exit
+};
+
+/// @brief how late the sampling task woke up compared to its schedule, from
+/// the tick its wake-up was due at
+typedef struct {
+  uint32_t wakeups;
+  int64_t last_latency_us;
+  int64_t min_latency_us;
+  int64_t max_latency_us;
+  int64_t avg_latency_us;
+  // reads (with the callback) that ran past their period, and periods
+  // skipped because of them; they count in neither wakeups nor latency
+  uint32_t overruns;
+  uint32_t missed_periods;
+} SchedulingStats;
+
+/**
+ * @brief runs ADCChannel::read() periodically on a dedicated task, so the
+ * sampling core and priority can be chosen independently of the caller
+ * (e.g. core 1 to keep away from Wi-Fi on core 0).
+ * @example
+ *
+  TaskConfig cfg;
+  cfg.core_id = 1;
+  cfg.priority = 10;
+  SamplerTask sampler(*ADC0, cfg);
+  sampler.start(100, 20, 0, [](const ADCReadResult &r, esp_err_t err) {
+    // runs on the sampler task
+  });
+ *
+ */
+class SamplerTask {
+public:
+  using Callback = std::function<void(const ADCReadResult &, esp_err_t)>;
+
+  SamplerTask(ADCChannel &channel, const TaskConfig &config = {});
+  SamplerTask(const SamplerTask &) = delete;
+  SamplerTask &operator=(const SamplerTask &) = delete;
+  ~SamplerTask();
+
+  /**
+   * @brief creates the task and starts reading every period_ms. A read
+   * that overruns its period is followed by the next on schedule: the
+   * periods it missed are skipped, not caught up back to back.
+   * @param period_ms [in] interval between the start of two reads
+   * @param sample_count [in] passed to ADCChannel::read()
+   * @param sample_delay_ms [in] passed to ADCChannel::read()
+   * @param callback [in] receives each result, on the sampler task
+   * @return esp_err_t ESP_ERR_INVALID_STATE if already running,
+   * ESP_ERR_NO_MEM if the task could not be created
+   */
+  esp_err_t start(uint32_t period_ms, int sample_count, int sample_delay_ms,
+                  Callback callback);
+
+  /// @brief cancels the read in progress and waits for the task to exit.
+  /// Must not be called from the callback.
+  void stop();
+
+  bool isRunning() const { return _worker.isRunning(); }
+
+  /// @brief wake-up latency and overruns measured since start()
+  SchedulingStats schedulingStats() const;
+  /// @brief see WorkerTask::stackHighWater()
+  uint32_t stackHighWater() const { return _worker.stackHighWater(); }
+
+private:
+  void run();
+  void recordLatency(int64_t latency_us);
+  void recordOverrun(uint32_t missed_periods);
+
+  ADCChannel &_channel;
+  TaskConfig _config;
+  CancelToken _cancel;
+
+  uint32_t _period_ms = 0;
+  int _sample_count = 0;
+  int _sample_delay_ms = 0;
+  Callback _callback;
+
+  mutable portMUX_TYPE _stats_lock = portMUX_INITIALIZER_UNLOCKED;
+  SchedulingStats _stats = {};
+  int64_t _latency_sum_us = 0;
+  WorkerTask _worker; // last: stopped before the members run() uses
+};
+
+} // namespace ED_ADC
+
+#endif // ESP_PLATFORM
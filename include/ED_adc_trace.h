@@ -0,0 +1,120 @@
+#pragma once
+#include "ED_adc_port.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Hot-path tracing. Build with -DED_ADC_TRACE=1 to record trace events;
+// otherwise every trace point compiles to nothing and no ring is reserved.
+#if !defined(ED_ADC_TRACE)
+#define ED_ADC_TRACE 0
+#endif
+// events kept in the ring (12 bytes each), a power of two
+#if !defined(ED_ADC_TRACE_EVENTS)
+#define ED_ADC_TRACE_EVENTS 1024
+#endif
+
+namespace ED_ADC {
+
+/// @brief part of the sampling path a trace event measures
+enum class TraceStage : uint8_t {
+  DriverCall, // oneshot conversion or continuous read
+  Decode,     // continuous frame bytes to codes
+  Calibrate,  // codes to mV
+  Statistics, // average, min / max, percentile widths
+  Delivery,   // handing a frame to the capture callback
+};
+static constexpr size_t TRACE_STAGE_COUNT = 5;
+
+/**
+ * @brief one traced span; ticks are CPU cycles on target, us on host.
+ * Starts wrap with the 32-bit counter and are unwrapped against the
+ * previous event, so consecutive events must start less than 2^31 ticks
+ * apart: about 13 s at 160 MHz on target, 35 min on host. Events after a
+ * longer pause land at the wrong time in traceBreakdown() and
+ * writeChromeTrace(); clear() the ring after one.
+ */
+typedef struct {
+  uint32_t start;  // tick counter at the start, wraps
+  uint32_t ticks;  // duration
+  uint8_t stage;   // TraceStage
+  uint8_t channel; // adc_channel_t
+  uint16_t items;  // samples / bytes handled, saturated
+} TraceEvent;
+
+/**
+ * @brief global lock-free ring of trace events. record() claims a slot
+ * with one atomic increment, so it is safe from any task; once the ring is
+ * full the oldest events are overwritten. snapshot() may return a torn
+ * event if it runs while events are being recorded.
+ * Use the ED_ADC_TRACE_BEGIN / ED_ADC_TRACE_END macros rather than calling
+ * record() directly, so the trace points vanish when tracing is disabled.
+ */
+class Tracer {
+public:
+  /// @brief current tick counter: esp_cpu_get_cycle_count() on target, a
+  /// steady clock in us on host, coarse enough that a host run under a
+  /// debugger or a slow simulation does not wrap between two events
+  static uint32_t now();
+  static uint32_t ticksPerUs();
+
+  static void record(TraceStage stage, uint8_t channel, uint32_t start,
+                     uint32_t items);
+
+  /// @brief copies up to max events, oldest first
+  /// @return size_t events copied; 0 if tracing is compiled out
+  static size_t snapshot(TraceEvent *out, size_t max);
+  /// @brief events recorded since the last clear(), overwritten included
+  static uint32_t recorded();
+  static void clear();
+
+  /**
+   * @brief writes the ring in the dump format read by readDump(): "EDT1",
+   * ticks per us (uint32), event count (uint32), then the events, each
+   * start, ticks (uint32), stage, channel (uint8), items (uint16), little
+   * endian
+   */
+  static esp_err_t writeDump(FILE *file);
+  /// @return bool false if the file is not a trace dump
+  static bool readDump(FILE *file, std::vector<TraceEvent> &events,
+                       uint32_t &ticks_per_us);
+};
+
+/// @brief time spent in one stage, from traceBreakdown()
+typedef struct {
+  uint32_t events;
+  uint64_t items;
+  double total_us; // inclusive
+  double self_us;  // minus the events nested inside
+  double max_us;
+} TraceStageStats;
+
+const char *traceStageName(TraceStage stage);
+
+/**
+ * @brief per-stage totals of a dump. Events nested in another one (e.g. a
+ * Calibrate inside the Delivery of sampleForDuration) are subtracted from
+ * its self time. Assumes one sampling task was traced at a time.
+ */
+void traceBreakdown(const TraceEvent *events, size_t count,
+                    uint32_t ticks_per_us,
+                    TraceStageStats stats[TRACE_STAGE_COUNT]);
+
+/// @brief writes events as Chrome trace JSON (chrome://tracing, Perfetto),
+/// one track per channel
+void writeChromeTrace(FILE *file, const TraceEvent *events, size_t count,
+                      uint32_t ticks_per_us);
+
+} // namespace ED_ADC
+
+#if ED_ADC_TRACE
+/// @brief starts a span; name is a local variable holding the start tick
+#define ED_ADC_TRACE_BEGIN(name) const uint32_t name = ::ED_ADC::Tracer::now()
+/// @brief ends the span started by ED_ADC_TRACE_BEGIN(name)
+#define ED_ADC_TRACE_END(name, stage, channel, items)                          \
+  ::ED_ADC::Tracer::record(stage, channel, name, items)
+#else
+#define ED_ADC_TRACE_BEGIN(name)
+#define ED_ADC_TRACE_END(name, stage, channel, items) ((void)0)
+#endif
@@ -0,0 +1,169 @@
+#pragma once
+#include "ED_adc.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ED_ADC {
+
+/// number of raw samples the handoff ring can hold
+static constexpr size_t ULP_HANDOFF_CAPACITY = 32;
+/// marks an initialized UlpHandoff ("EDAU")
+static constexpr uint32_t ULP_HANDOFF_MAGIC = 0x45444155;
+static constexpr uint32_t ULP_HANDOFF_VERSION = 2;
+/// calibration points cached in UlpHandoff: codes 0, 256, ..., 3840, 4095
+static constexpr size_t ULP_CALI_POINTS = 17;
+
+/// @brief why the sampler asked to wake the main CPU
+enum class UlpWakeReason : uint32_t {
+  None = 0,
+  BelowLow = 1,  // sample < low_raw
+  AboveHigh = 2, // sample > high_raw
+  Change = 3,    // |sample - reference_raw| >= change_raw
+  BatchFull = 4, // count reached batch_wake
+};
+
+/**
+ * @brief buffer shared between the background sampler and the main CPU,
+ * placed in RTC slow memory so it survives deep sleep.
+ * Every field is a 32-bit word carrying a value in its low 16 bits, so a
+ * ULP FSM program (which only loads/stores the low half-word) can use the
+ * same layout as the RISC-V ULP and the main CPU. Raw codes are 12 bit.
+ */
+struct UlpHandoff {
+  // header, written by the main CPU in UlpSampler::arm()
+  uint32_t magic;
+  uint32_t version;
+  uint32_t capacity; // ULP_HANDOFF_CAPACITY
+  uint32_t period_ms;
+  // channel sampled by onWake() without a ULP, and its calibration in mV at
+  // the ULP_CALI_POINTS codes, taken from the channel in arm()
+  uint32_t channel_valid; // 0 if armed without a channel
+  uint32_t adc_unit;      // adc_unit_t
+  uint32_t adc_channel;   // adc_channel_t
+  uint32_t adc_atten;     // adc_atten_t
+  uint32_t cali_mv[ULP_CALI_POINTS];
+  // wake condition
+  uint32_t low_raw;     // wake below this code (0 = off)
+  uint32_t high_raw;    // wake above this code (>= 4095 = off)
+  uint32_t change_raw;  // wake on this change vs reference_raw (0 = off)
+  uint32_t batch_wake;  // wake when count reaches this (0 = off)
+  // state, written by the sampler
+  uint32_t reference_raw; // sample at arm time / last wake
+  uint32_t head;          // index the next sample is written to
+  uint32_t count;         // valid samples, <= capacity
+  uint32_t sequence;      // samples taken since arm(), wraps at 16 bit
+  uint32_t wake_reason;   // UlpWakeReason
+  uint32_t samples[ULP_HANDOFF_CAPACITY];
+};
+
+/// @brief wake condition of a UlpSampler, in raw codes
+struct UlpWakeCondition {
+  uint16_t low_raw = 0;
+  uint16_t high_raw = 4095;
+  uint16_t change_raw = 0;
+  uint16_t batch_wake = ULP_HANDOFF_CAPACITY;
+};
+
+/**
+ * @brief the per-sample step of the background sampler: stores raw in the
+ * ring and evaluates the wake condition. This is the reference the ULP
+ * program has to implement, and what the simulated ULP runs on host.
+ * @return the wake reason, UlpWakeReason::None to keep sleeping
+ */
+UlpWakeReason ulpProcessSample(UlpHandoff &handoff, uint16_t raw);
+
+/**
+ * @brief simulated ULP: feeds raw samples through ulpProcessSample() until
+ * one of them requests a wake-up
+ * @param consumed [out, optional] number of samples used
+ */
+UlpWakeReason ulpSimulate(UlpHandoff &handoff, const uint16_t *samples,
+                          size_t count, size_t *consumed = nullptr);
+
+/**
+ * @brief background sampling during deep sleep with wake-on-threshold.
+ *
+ * On chips with a ULP coprocessor the ULP program (built by the
+ * application with the ULP toolchain) samples the unit created with
+ * ADCUnit::create(unit, ADC_ULP_MODE_FSM / _RISCV), implements
+ * ulpProcessSample() on handoff() and wakes the CPU; sleep() then only
+ * enables the ULP wake-up.
+ * Without a ULP (e.g. ESP32-C3) the main CPU does the sampling itself: it
+ * wakes from deep sleep on the RTC timer every period_ms, and onWake() takes
+ * one sample and puts the chip straight back to sleep unless the condition
+ * hits. That wake path only opens a oneshot unit on the driver for the one
+ * conversion: no ADCUnit, continuous handle or calibration scheme is
+ * created, and the samples are converted with the calibration arm() cached
+ * in RTC memory.
+ * @example
+ *
+  UlpSampler ulp;
+  if (!ulp.onWake()) {
+    // power-on
+    ADCChannel adc(unit.get(), ADC_CHANNEL_0, ADC_ATTEN_DB_12);
+    ulp.arm(adc, cond, 500);
+  } else {
+    std::vector<int> mv;
+    ulp.takeSamples(mv);
+    ...
+  }
+  ulp.sleep();
+ *
+ */
+class UlpSampler {
+public:
+  /// @brief the handoff buffer in RTC slow memory
+  static UlpHandoff &rtcHandoff();
+
+  explicit UlpSampler(UlpHandoff &handoff = rtcHandoff());
+
+  /// @brief resets the ring and stores the wake condition and period.
+  /// reference_raw is the baseline for the change condition.
+  void arm(const UlpWakeCondition &condition, uint32_t period_ms,
+           uint16_t reference_raw = 0);
+  /// @brief arm() for the timer wake path: also records channel's unit,
+  /// channel and attenuation for onWake() and caches its calibration
+  void arm(ADCChannel &channel, const UlpWakeCondition &condition,
+           uint32_t period_ms, uint16_t reference_raw = 0);
+  bool isArmed() const;
+
+  /**
+   * @brief to be called early after boot. After a timer wake-up without a
+   * ULP, takes one sample of the channel given to arm() and returns to deep
+   * sleep (does not return) if no wake condition is met.
+   * @param driver [in] opens a oneshot unit for the one conversion
+   * @return true if the CPU was woken by the sampler and a batch is ready,
+   * false on any other boot (e.g. power-on: call arm())
+   */
+  bool onWake(Driver &driver = defaultDriver());
+
+  UlpWakeReason wakeReason() const;
+
+  /**
+   * @brief hands the buffered samples over, oldest first, converted to mV
+   * with the channel calibration, and empties the ring. The reference for
+   * the change condition moves to the newest sample.
+   * @return number of samples appended to voltages
+   */
+  size_t takeSamples(ADCChannel &channel, std::vector<int> &voltages);
+  /// @brief takeSamples() converting with the calibration cached by arm(),
+  /// interpolated between its points; without one the raw codes are
+  /// appended
+  size_t takeSamples(std::vector<int> &voltages);
+  /// @brief mV of a raw code with the cached calibration, raw if none
+  int cachedVoltage(uint16_t raw) const;
+
+  /// @brief enters deep sleep with the sampler's wake-up source. Does not
+  /// return.
+  void sleep();
+
+private:
+  /// @brief hands the ring over, oldest first, and empties it
+  template <typename Convert>
+  size_t drain(std::vector<int> &voltages, Convert convert);
+
+  UlpHandoff &_handoff;
+};
+
+} // namespace ED_ADC
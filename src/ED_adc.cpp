@@ -1,13 +1,12 @@
 #include "ED_adc.h"
-#include "esp_adc/adc_cali.h"
-#include "esp_adc/adc_cali_scheme.h"
-#include "esp_adc/adc_continuous.h"
-#include "esp_adc/adc_oneshot.h"
-#include "esp_log.h"
-#include "esp_timer.h"
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
+#include "ED_adc_pm.h"
+#include "ED_adc_trace.h"
 #include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
 #include <vector>
 
 
@@ -16,150 +15,848 @@ namespace ED_ADC {
 static inline const char *TAG = "ED_ADC";
 
 // ADCChannel implementations
-ADCChannel *ADCChannel::create(ADCUnit *unit, adc_channel_t channel,
-                               adc_atten_t atten) {
-  ADCChannel *new_channel = new ADCChannel(unit, channel, atten);
+std::unique_ptr<ADCChannel> ADCChannel::create(ADCUnit *unit,
+                                               adc_channel_t channel,
+                                               adc_atten_t atten) {
+  auto new_channel = std::make_unique<ADCChannel>(unit, channel, atten);
   if (new_channel->isInitialized()) {
     return new_channel;
   }
-  delete new_channel;
   return nullptr;
 }
 
-std::vector<int> ADCChannel::sampleForDuration(uint32_t duration_ms) {
+std::unique_ptr<ADCChannel>
+ADCChannel::create(const std::shared_ptr<ADCUnit> &unit, adc_channel_t channel,
+                   adc_atten_t atten) {
+  if (!unit)
+    return nullptr;
+  auto new_channel = std::make_unique<ADCChannel>(unit, channel, atten);
+  if (new_channel->isInitialized()) {
+    return new_channel;
+  }
+  return nullptr;
+}
+
+// CancelToken implementations
+void CancelToken::cancel() {
+  if (!_cancelled.exchange(true)) {
+    _requested_at_us = _clock.nowUs();
+  }
+}
+
+void CancelToken::reset() { _cancelled = false; }
+
+bool CancelToken::isCancelled() const { return _cancelled; }
+
+int64_t CancelToken::lastLatencyUs() const { return _latency_us; }
+
+void CancelToken::acknowledge() {
+  _latency_us = _clock.nowUs() - _requested_at_us;
+}
+
+StopReason ADCChannel::checkStop(const CaptureOptions &options) const {
+  if (options.cancel && options.cancel->isCancelled())
+    return StopReason::Cancelled;
+  if (options.deadline_us > 0 && clock().nowUs() >= options.deadline_us)
+    return StopReason::Deadline;
+  return StopReason::Complete;
+}
+
+void ADCChannel::acknowledgeStop(const CaptureOptions &options,
+                                 StopReason reason) {
+  if (reason == StopReason::Cancelled && options.cancel) {
+    options.cancel->acknowledge();
+  }
+}
+
+StopReason ADCChannel::interruptibleDelay(int delay_ms,
+                                          const CaptureOptions &options) const {
+  while (delay_ms > 0) {
+    int slice = std::min(delay_ms, CANCEL_POLL_MS);
+    clock().delayMs(slice);
+    delay_ms -= slice;
+    StopReason reason = checkStop(options);
+    if (reason != StopReason::Complete)
+      return reason;
+  }
+  return StopReason::Complete;
+}
+
+std::vector<int> ADCChannel::sampleForDuration(uint32_t duration_ms,
+                                               const CaptureOptions &options,
+                                               CaptureInfo *info) {
+  const uint64_t expected =
+      (uint64_t)duration_ms * _unit->continuousConfig().sample_freq_hz / 1000;
+  // the last read may run up to one buffer past the duration
+  uint64_t wanted = expected + FRAME_BUFFER_BYTES / 2;
+  const size_t budget = options.memory_budget / sizeof(int); // samples
+  uint32_t decimation = 1;
+  bool summarized = false;
+  if (options.memory_budget > 0 && wanted > budget) {
+    switch (options.over_budget) {
+    case OverBudget::StopEarly:
+      wanted = budget;
+      break;
+    case OverBudget::Decimate:
+      decimation = (uint32_t)((wanted + budget - 1) /
+                              std::max<size_t>(budget, 1));
+      wanted = (wanted + decimation - 1) / decimation;
+      break;
+    case OverBudget::Summary:
+      summarized = true;
+      wanted = 0;
+      break;
+    }
+  }
+
   std::vector<int> voltages;
-  uint32_t buffer_size = 1024;
-  uint8_t *buffer = (uint8_t *)malloc(buffer_size);
-  if (buffer == NULL) {
+  // reserved once; if the memory limit refuses it, makeRoom() takes over
+  // when the vector fills up
+  reserveSamples(voltages, (size_t)wanted);
+
+  uint64_t taken = 0; // samples converted, before decimation
+  int64_t sum = 0;
+  int min = INT32_MAX;
+  int max = INT32_MIN;
+  esp_err_t err = captureFrames(
+      duration_ms,
+      [&](const uint16_t *codes, size_t count, int64_t) {
+        ED_ADC_TRACE_BEGIN(trace_cali);
+        for (size_t i = 0; i < count; i++) {
+          int voltage;
+          _driver->caliRawToVoltage(_cali_handle, codes[i], &voltage);
+          const uint64_t index = taken++;
+          sum += voltage;
+          min = std::min(min, voltage);
+          max = std::max(max, voltage);
+          if (summarized || index % decimation != 0)
+            continue;
+          if (voltages.size() == voltages.capacity() &&
+              !makeRoom(voltages, count - i, options, decimation,
+                        summarized)) {
+            _out_of_memory = true; // keep what fits and stop the capture
+            break;
+          }
+          if (!summarized && index % decimation == 0) {
+            voltages.push_back(voltage);
+          }
+        }
+        ED_ADC_TRACE_END(trace_cali, TraceStage::Calibrate, _channel, count);
+      },
+      options, info);
+  // the caller owns the vector from here
+  releaseSamples(voltages);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "ADCChannel - capture did not start: %s",
+             esp_err_to_name(err));
+  }
+
+  if (info) {
+    info->expected_samples = expected;
+    info->decimation = decimation;
+    info->summarized = summarized;
+    ADCReadResult &summary = info->summary;
+    summary = {};
+    summary.stop_reason = info->stop_reason;
+    summary.partial = info->partial;
+    if (taken > 0) {
+      summary.average_mv = (int)(sum / (int64_t)taken);
+      summary.min_mv = min;
+      summary.max_mv = max;
+      summary.sample_count = (int)std::min<uint64_t>(taken, INT32_MAX);
+    }
+  }
+  return voltages;
+}
+
+esp_err_t ADCChannel::captureFrames(uint32_t duration_ms,
+                                    const FrameCallback &on_frame,
+                                    const CaptureOptions &options,
+                                    CaptureInfo *info) {
+  StopReason reason = StopReason::Complete;
+  esp_err_t fault = ESP_OK;
+  if (info) {
+    *info = {};
+    info->first_gap_index = -1;
+  }
+  // a capture that never started must not look complete
+  auto refuse = [&](StopReason why, esp_err_t err) {
+    if (info) {
+      info->partial = true;
+      info->stop_reason = why;
+      info->error = err;
+    }
+    return err;
+  };
+
+  // frames are decoded in place: sample i occupies bytes 2i and 2i + 1
+  const uint32_t buffer_size = FRAME_BUFFER_BYTES;
+  if (!_memory.acquire(buffer_size)) {
+    ESP_LOGE(TAG, "ADC buffer for continuous sampling exceeds memory limit");
+    return refuse(StopReason::MemoryLimit, ESP_ERR_NO_MEM);
+  }
+  uint16_t *codes = (uint16_t *)malloc(buffer_size);
+  if (codes == NULL) {
     ESP_LOGE(TAG, "Failed to allocate ADC buffer for continuous sampling");
-    return voltages;
+    _memory.release(buffer_size);
+    return refuse(StopReason::MemoryLimit, ESP_ERR_NO_MEM);
   }
+  _out_of_memory = false;
+  uint8_t *buffer = reinterpret_cast<uint8_t *>(codes);
   memset(buffer, 0, buffer_size);
 
-  esp_err_t start_err = adc_continuous_start(_cont_handle);
+  PmLock::Guard pm_guard;
+  adc_continuous_handle_t handle = _unit->getContinuousHandle();
+  esp_err_t start_err =
+      handle ? _driver->continuousStart(handle) : ESP_ERR_INVALID_STATE;
   if (start_err != ESP_OK) {
     ESP_LOGE(TAG, "Failed to start continuous ADC: %s",
              esp_err_to_name(start_err));
-    free(buffer);
-    return voltages;
+    free(codes);
+    _memory.release(buffer_size);
+    return refuse(StopReason::Fault, start_err);
   }
 
-  uint64_t start_time = esp_timer_get_time();
-  while ((esp_timer_get_time() - start_time) / 1000 < duration_ms) {
+  Clock &time = clock();
+  uint64_t samples = 0;
+  uint32_t read_errors = 0;
+  uint32_t consecutive_errors = 0;
+  uint32_t overflows = 0;
+  uint32_t overflows_base = _driver->continuousOverflows(handle);
+  uint32_t recoveries = 0;
+  int64_t downtime_us = 0;
+  int32_t first_gap_index = -1;
+  int64_t start_time = time.nowUs();
+  int64_t end_time = start_time + (int64_t)duration_ms * 1000;
+  int64_t last_frame_us = start_time;
+  while (time.nowUs() < end_time) {
+    reason = checkStop(options);
+    if (reason != StopReason::Complete)
+      break;
+
     uint32_t bytes_read = 0;
+    ED_ADC_TRACE_BEGIN(trace_read);
     esp_err_t ret =
-        adc_continuous_read(_cont_handle, buffer, buffer_size, &bytes_read, 0);
+        _driver->continuousRead(handle, buffer, buffer_size, &bytes_read, 0);
+    ED_ADC_TRACE_END(trace_read, TraceStage::DriverCall, _channel,
+                     bytes_read / 2);
 
     if (ret == ESP_OK) {
+      last_frame_us = time.nowUs();
+      consecutive_errors = 0;
       // Process data for ADC_DIGI_OUTPUT_FORMAT_TYPE2
-      for (size_t i = 0; i < bytes_read; i += 2) {
-        int raw_reading = (buffer[i + 1] << 8) | buffer[i];
-        raw_reading &= 0xFFF; // Mask to get only the 12-bit ADC value
-
-        int voltage;
-        adc_cali_raw_to_voltage(_cali_handle, raw_reading, &voltage);
-        voltages.push_back(voltage);
+      const size_t count = bytes_read / 2;
+      ED_ADC_TRACE_BEGIN(trace_decode);
+      for (size_t i = 0; i < count; i++) {
+        int raw_reading = (buffer[2 * i + 1] << 8) | buffer[2 * i];
+        codes[i] = raw_reading & 0xFFF; // Mask to get only the 12-bit value
+      }
+      ED_ADC_TRACE_END(trace_decode, TraceStage::Decode, _channel, count);
+      pm_guard.sample();
+      ED_ADC_TRACE_BEGIN(trace_delivery);
+      on_frame(codes, count, last_frame_us);
+      ED_ADC_TRACE_END(trace_delivery, TraceStage::Delivery, _channel, count);
+      samples += count;
+      if (_out_of_memory) {
+        reason = StopReason::MemoryLimit;
+        break;
       }
     } else if (ret != ESP_ERR_TIMEOUT) {
+      read_errors++;
+      consecutive_errors++;
       ESP_LOGW(TAG, "ADC continuous read error: %s", esp_err_to_name(ret));
     }
+
+    // watchdog: restart a driver that stalled or keeps failing
+    bool stalled = options.frame_timeout_ms > 0 &&
+                   time.nowUs() - last_frame_us >
+                       (int64_t)options.frame_timeout_ms * 1000;
+    bool failing = options.max_read_errors > 0 &&
+                   consecutive_errors >= options.max_read_errors;
+    if (!stalled && !failing)
+      continue;
+
+    if (recoveries >= options.max_recoveries) {
+      ESP_LOGE(TAG, "Continuous ADC could not be recovered");
+      reason = StopReason::Fault;
+      fault = ESP_FAIL;
+      break;
+    }
+    ESP_LOGW(TAG, "Continuous ADC %s, restarting",
+             stalled ? "stalled" : "keeps failing");
+    overflows += _driver->continuousOverflows(handle) - overflows_base;
+    int64_t gap_us = 0;
+    fault = _unit->recoverContinuous(last_frame_us, &gap_us);
+    if (fault != ESP_OK) {
+      // the unit released the handle, there is nothing left to stop
+      handle = nullptr;
+      reason = StopReason::Fault;
+      break;
+    }
+    handle = _unit->getContinuousHandle();
+    overflows_base = _driver->continuousOverflows(handle);
+    recoveries++;
+    downtime_us += gap_us;
+    if (first_gap_index < 0) {
+      first_gap_index = (int32_t)samples;
+    }
+    last_frame_us = time.nowUs();
+    consecutive_errors = 0;
   }
 
-  esp_err_t stop_err = adc_continuous_stop(_cont_handle);
-  if (stop_err != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to stop continuous ADC: %s",
-             esp_err_to_name(stop_err));
+  if (handle) {
+    overflows += _driver->continuousOverflows(handle) - overflows_base;
+    esp_err_t stop_err = _driver->continuousStop(handle);
+    if (stop_err != ESP_OK) {
+      ESP_LOGE(TAG, "Failed to stop continuous ADC: %s",
+               esp_err_to_name(stop_err));
+    }
   }
+  acknowledgeStop(options, reason);
+  // the continuous pattern drove the sampling capacitor
+  _unit->_has_last_conversion = false;
 
-  free(buffer);
-  return voltages;
+  if (info) {
+    info->partial = (reason != StopReason::Complete);
+    info->stop_reason = reason;
+    info->elapsed_us = time.nowUs() - start_time;
+    info->samples = samples;
+    info->read_errors = read_errors;
+    info->overflows = overflows;
+    info->recoveries = recoveries;
+    info->downtime_us = downtime_us;
+    info->first_gap_index = first_gap_index;
+    info->error = fault;
+  }
+
+  free(codes);
+  _memory.release(buffer_size);
+  return ESP_OK;
+}
+
+esp_err_t ADCChannel::readHistogram(int sample_count, int sample_delay_ms,
+                                    CodeHistogram &hist,
+                                    const CaptureOptions &options) {
+  ADCReadResult result = {};
+  return accumulate(sample_count, sample_delay_ms, hist, options, result);
+}
+
+esp_err_t ADCChannel::readStreamed(int sample_count, int sample_delay_ms,
+                                   ADCReadResult &result,
+                                   const CaptureOptions &options) {
+  const size_t hist_bytes = CodeHistogram::BINS * sizeof(uint32_t);
+  if (!_memory.acquire(hist_bytes)) {
+    ESP_LOGE(TAG, "ADCChannel - histogram exceeds the memory limit");
+    return ESP_ERR_NO_MEM;
+  }
+  esp_err_t err;
+  {
+    CodeHistogram hist(HistogramUnit::Millivolts);
+    err = accumulate(sample_count, sample_delay_ms, hist, options, result);
+    ED_ADC_TRACE_BEGIN(trace_stats);
+    result.p30_width_mv = hist.percentileWidth(30);
+    result.p60_width_mv = hist.percentileWidth(60);
+    ED_ADC_TRACE_END(trace_stats, TraceStage::Statistics, _channel,
+                     CodeHistogram::BINS);
+  }
+  _memory.release(hist_bytes);
+  return err;
+}
+
+esp_err_t ADCChannel::accumulate(int sample_count, int sample_delay_ms,
+                                 CodeHistogram &hist,
+                                 const CaptureOptions &options,
+                                 ADCReadResult &result) {
+  const bool raw = hist.unit() == HistogramUnit::RawCode;
+  ReadLoop loop;
+  PmLock::Guard pm_guard;
+
+  for (int i = 0; i < sample_count; i++) {
+    loop.reason = checkStop(options);
+    if (loop.reason != StopReason::Complete)
+      break;
+
+    int value;
+    SampleStep step;
+    while ((step = sampleStep(loop, value, options, raw)) ==
+           SampleStep::Retry) {
+      loop.reason = interruptibleDelay(loop.backoff_ms, options);
+      if (loop.reason != StopReason::Complete)
+        break;
+    }
+    if (loop.reason != StopReason::Complete)
+      break;
+    pm_guard.sample();
+    if (step == SampleStep::Taken)
+      hist.add(value);
+
+    if (sample_delay_ms > 0 && i + 1 < sample_count) {
+      loop.reason = interruptibleDelay(sample_delay_ms, options);
+      if (loop.reason != StopReason::Complete)
+        break;
+    }
+  }
+  acknowledgeStop(options, loop.reason);
+
+  result = {};
+  result.sample_count = loop.count;
+  result.partial = (loop.reason != StopReason::Complete);
+  result.stop_reason = loop.reason;
+  result.error_count = loop.errors;
+  result.skipped_count = loop.skipped;
+  if (loop.count > 0) {
+    result.average_mv = (int)(loop.sum / loop.count);
+    result.min_mv = loop.min;
+    result.max_mv = loop.max;
+  }
+
+  if (loop.fault != ESP_OK)
+    return loop.fault;
+  if (loop.count > 0)
+    return ESP_OK;
+  if (loop.reason == StopReason::Deadline)
+    return ESP_ERR_TIMEOUT;
+  if (loop.reason == StopReason::Cancelled)
+    return ESP_ERR_INVALID_STATE;
+  return loop.skipped > 0 ? ESP_FAIL : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t ADCChannel::histogramForDuration(uint32_t duration_ms,
+                                           CodeHistogram &hist,
+                                           const CaptureOptions &options,
+                                           CaptureInfo *info) {
+  const bool raw = hist.unit() == HistogramUnit::RawCode;
+  return captureFrames(
+      duration_ms,
+      [&](const uint16_t *codes, size_t count, int64_t) {
+        ED_ADC_TRACE_BEGIN(trace_hist);
+        if (raw) {
+          hist.addCodes(codes, count);
+        } else {
+          for (size_t i = 0; i < count; i++) {
+            int voltage;
+            _driver->caliRawToVoltage(_cali_handle, codes[i], &voltage);
+            hist.add(voltage);
+          }
+        }
+        ED_ADC_TRACE_END(trace_hist, TraceStage::Statistics, _channel, count);
+      },
+      options, info);
 }
 
 esp_err_t ADCChannel::read(int sample_count, int sample_delay_ms,
-                           ADCReadResult &result) {
+                           ADCReadResult &result,
+                           const CaptureOptions &options) {
   std::vector<int> voltages;
-  voltages.reserve(sample_count);
+  if (!reserveSamples(voltages, std::max(sample_count, 0))) {
+    ESP_LOGE(TAG, "ADCChannel - %d samples exceed the memory limit",
+             sample_count);
+    return ESP_ERR_NO_MEM;
+  }
 
-  uint32_t sum = 0;
-  int min = INT32_MAX;
-  int max = INT32_MIN;
+  ReadLoop loop;
+  PmLock::Guard pm_guard;
 
   for (int i = 0; i < sample_count; i++) {
-    int raw_reading;
-    esp_err_t err = adc_oneshot_read(_oneshot_handle, _channel, &raw_reading);
-    if (err != ESP_OK) {
-      ESP_LOGE(TAG, "Oneshot read failed: %s", esp_err_to_name(err));
-      return err;
-    }
+    loop.reason = checkStop(options);
+    if (loop.reason != StopReason::Complete)
+      break;
 
     int voltage;
-    adc_cali_raw_to_voltage(_cali_handle, raw_reading, &voltage);
+    SampleStep step;
+    while ((step = sampleStep(loop, voltage, options)) == SampleStep::Retry) {
+      loop.reason = interruptibleDelay(loop.backoff_ms, options);
+      if (loop.reason != StopReason::Complete)
+        break;
+    }
+    if (loop.reason != StopReason::Complete)
+      break; // keep what was measured so far
+    pm_guard.sample();
+    if (step == SampleStep::Taken)
+      voltages.push_back(voltage);
+
+    if (sample_delay_ms > 0 && i + 1 < sample_count) {
+      loop.reason = interruptibleDelay(sample_delay_ms, options);
+      if (loop.reason != StopReason::Complete)
+        break;
+    }
+  }
+  acknowledgeStop(options, loop.reason);
+
+  ED_ADC_TRACE_BEGIN(trace_stats);
+  esp_err_t err = finishRead(voltages, loop, result);
+  ED_ADC_TRACE_END(trace_stats, TraceStage::Statistics, _channel,
+                   voltages.size());
+  releaseSamples(voltages);
+  return err;
+}
 
-    voltages.push_back(voltage);
-    sum += voltage;
-    if (voltage < min)
-      min = voltage;
-    if (voltage > max)
-      max = voltage;
+ADCChannel::SampleStep ADCChannel::sampleStep(ReadLoop &loop, int &value,
+                                              const CaptureOptions &options,
+                                              bool raw) {
+  esp_err_t err = raw ? readRaw(value) : readVoltage(value);
+  if (err == ESP_OK) {
+    loop.attempt = 0;
+    loop.sum += value;
+    loop.count++;
+    if (value < loop.min)
+      loop.min = value;
+    if (value > loop.max)
+      loop.max = value;
+    return SampleStep::Taken;
+  }
+  loop.errors++;
+  if (loop.attempt < options.retry.max_retries) {
+    loop.backoff_ms = options.retry.delayMs(loop.attempt++);
+    return SampleStep::Retry;
+  }
+  loop.attempt = 0;
+  if (options.retry.skip_failed) {
+    loop.skipped++;
+    return SampleStep::Skipped;
+  }
+  loop.fault = err;
+  loop.reason = StopReason::Fault;
+  return SampleStep::Stop;
+}
+
+esp_err_t ADCChannel::readVoltage(int &voltage) {
+  int raw_reading;
+  esp_err_t err = readRaw(raw_reading);
+  if (err != ESP_OK) {
+    return err;
+  }
+  ED_ADC_TRACE_BEGIN(trace_cali);
+  _driver->caliRawToVoltage(_cali_handle, raw_reading, &voltage);
+  ED_ADC_TRACE_END(trace_cali, TraceStage::Calibrate, _channel, 1);
+  return ESP_OK;
+}
+
+esp_err_t ADCChannel::readRaw(int &raw) {
+  if (_settle_discard > 0 && _unit->noteConversion(_channel, _atten)) {
+    // the first conversions after a switch still carry the previous input
+    for (int i = 0; i < _settle_discard; i++) {
+      esp_err_t err = convert(raw);
+      if (err != ESP_OK)
+        return err;
+      _discarded++;
+    }
+  }
+  return convert(raw);
+}
+
+esp_err_t ADCChannel::convert(int &raw) {
+  ED_ADC_TRACE_BEGIN(trace_read);
+  esp_err_t err = _driver->oneshotRead(_oneshot_handle, _channel, &raw);
+  ED_ADC_TRACE_END(trace_read, TraceStage::DriverCall, _channel, 1);
+  _unit->noteConversion(_channel, _atten);
+  if (err == ESP_ERR_TIMEOUT) {
+    // expected on ADC2 while Wi-Fi holds it, see ED_adc_adc2.h
+    ESP_LOGD(TAG, "Oneshot read timed out");
+  } else if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Oneshot read failed: %s", esp_err_to_name(err));
+  }
+  return err;
+}
+
+esp_err_t ADCChannel::measureSettling(ADCChannel &other,
+                                      SettlingResult &result,
+                                      const SettlingConfig &config) {
+  result = {};
+  if (config.samples < 2 || config.repeats < 1)
+    return ESP_ERR_INVALID_ARG;
+  if (other._unit != _unit) {
+    // switching between two units does not disturb either of them
+    ESP_LOGE(TAG, "ADCChannel - measureSettling() needs a channel of the "
+                  "same unit");
+    return ESP_ERR_INVALID_ARG;
+  }
 
-    if (sample_delay_ms > 0) {
-      vTaskDelay(pdMS_TO_TICKS(sample_delay_ms));
+  std::vector<int64_t> sums(config.samples, 0);
+  for (int r = 0; r < config.repeats; r++) {
+    int raw;
+    esp_err_t err = other.convert(raw);
+    if (err != ESP_OK)
+      return err;
+    for (int i = 0; i < config.samples; i++) {
+      err = convert(raw);
+      if (err != ESP_OK)
+        return err;
+      sums[i] += rawToVoltage(raw);
     }
   }
 
-  result.average_mv = sum / sample_count;
-  result.min_mv = min;
-  result.max_mv = max;
-  result.p30_width_mv = calculatePercWidth(voltages, 30);
-  result.p60_width_mv = calculatePercWidth(voltages, 60);
+  // the last quarter of each probe is taken as settled
+  const int n = config.samples;
+  const int tail = std::max(n / 4, 1);
+  int64_t tail_sum = 0;
+  for (int i = n - tail; i < n; i++) {
+    tail_sum += sums[i];
+  }
+  const int settled = (int)(tail_sum / ((int64_t)tail * config.repeats));
+  int discard = 0;
+  for (int i = 0; i < n; i++) {
+    int mean = (int)(sums[i] / config.repeats);
+    if (std::abs(mean - settled) > config.tolerance_mv) {
+      discard = i + 1;
+    }
+  }
 
+  result.discard = discard;
+  result.first_error_mv = (int)(sums[0] / config.repeats) - settled;
+  result.settled_mv = settled;
+  if (config.apply) {
+    setSettlingDiscard(discard);
+  }
   return ESP_OK;
 }
 
+int ADCChannel::rawToVoltage(int raw) const {
+  int voltage = 0;
+  _driver->caliRawToVoltage(_cali_handle, raw, &voltage);
+  return voltage;
+}
+
+esp_err_t ADCChannel::finishRead(std::vector<int> &voltages,
+                                 const ReadLoop &loop,
+                                 ADCReadResult &result) {
+  // a reused result must not keep the figures of the previous read
+  result = {};
+  const int n = voltages.size();
+  result.sample_count = n;
+  result.partial = (loop.reason != StopReason::Complete);
+  result.stop_reason = loop.reason;
+  result.error_count = loop.errors;
+  result.skipped_count = loop.skipped;
+  if (n > 0) {
+    result.average_mv = (int)(loop.sum / n);
+    result.min_mv = loop.min;
+    result.max_mv = loop.max;
+    result.p30_width_mv = calculatePercWidth(voltages, 30);
+    result.p60_width_mv = calculatePercWidth(voltages, 60);
+  }
+
+  if (loop.fault != ESP_OK)
+    return loop.fault;
+  if (n > 0)
+    return ESP_OK;
+  if (loop.reason == StopReason::Deadline)
+    return ESP_ERR_TIMEOUT;
+  if (loop.reason == StopReason::Cancelled)
+    return ESP_ERR_INVALID_STATE;
+  if (loop.skipped > 0)
+    return ESP_FAIL; // every conversion failed
+  return ESP_ERR_INVALID_ARG;
+}
+
 ADCChannel::ADCChannel(ADCUnit *unit, adc_channel_t channel, adc_atten_t atten)
-    : _oneshot_handle(unit->getOneshotHandle()),
-      _cont_handle(unit->getContinuousHandle()), _channel(channel) {
+    : _unit(unit), _driver(&unit->driver()),
+      _oneshot_handle(unit->getOneshotHandle()), _channel(channel),
+      _memory(&unit->_memory) {
 
   _is_initialized = false;
+  // create the continuous handle up front, captures only start it
+  unit->getContinuousHandle();
 
   // Oneshot channel configuration
-  adc_oneshot_chan_cfg_t oneshot_chan_cfg = {
-      .atten = atten,
-      .bitwidth = ADC_BITWIDTH_12,
-  };
-
-  esp_err_t err =
-      adc_oneshot_config_channel(_oneshot_handle, _channel, &oneshot_chan_cfg);
+  esp_err_t err = _driver->oneshotConfigChannel(_oneshot_handle, _channel,
+                                                atten, ADC_BITWIDTH_12);
   if (err != ESP_OK) {
     ESP_LOGE(TAG, "ADCChannel - Failed to configure oneshot channel: %s",
              esp_err_to_name(err));
     return;
   }
 
-  // Calibration setup - fix missing field initializers
-  adc_cali_curve_fitting_config_t cali_cfg = {
-      .unit_id = unit->getUnitId(),
-      .chan = _channel, // Added missing field
-      .atten = atten,
-      .bitwidth = ADC_BITWIDTH_12,
-  };
+  // Calibration setup
+  bool created = false;
+  err = calibrationFor(atten, ADC_BITWIDTH_12, _cali_handle, created);
+  if (err != ESP_OK)
+    return;
+  _atten = atten;
+  _bitwidth = ADC_BITWIDTH_12;
+  _is_initialized = true;
+}
+
+ADCChannel::ADCChannel(const std::shared_ptr<ADCUnit> &unit,
+                       adc_channel_t channel, adc_atten_t atten)
+    : ADCChannel(unit.get(), channel, atten) {
+  _unit_ref = unit;
+}
+
+ADCChannel::ADCChannel(ADCChannel &&other) noexcept {
+  *this = std::move(other);
+}
+
+ADCChannel &ADCChannel::operator=(ADCChannel &&other) noexcept {
+  if (this != &other) {
+    release();
+    _unit = other._unit;
+    _unit_ref = std::move(other._unit_ref);
+    _driver = other._driver;
+    _oneshot_handle = other._oneshot_handle;
+    _channel = other._channel;
+    _atten = other._atten;
+    _bitwidth = other._bitwidth;
+    _cali_handle = other._cali_handle;
+    _cali_cache = std::move(other._cali_cache);
+    _reconfig_stats = other._reconfig_stats;
+    _settle_discard = other._settle_discard;
+    _discarded = other._discarded;
+    _memory.setParent(other._memory.parent());
+    _memory.setLimit(other._memory.limit());
+    _is_initialized = other._is_initialized;
+    other._cali_handle = nullptr;
+    other._cali_cache.clear();
+    other.release();
+  }
+  return *this;
+}
 
-  err = adc_cali_create_scheme_curve_fitting(&cali_cfg, &_cali_handle);
+ADCChannel::~ADCChannel() { release(); }
+
+void ADCChannel::release() {
+  for (const CaliEntry &entry : _cali_cache) {
+    _driver->caliDelete(entry.handle);
+  }
+  _cali_cache.clear();
+  _cali_handle = nullptr;
+  _reconfig_stats = {};
+  _settle_discard = 0;
+  _discarded = 0;
+  _is_initialized = false;
+  _unit = nullptr;
+  _unit_ref.reset();
+  _driver = nullptr;
+  _oneshot_handle = nullptr;
+}
+
+esp_err_t ADCChannel::setAttenuation(adc_atten_t atten) {
+  return reconfigure(atten, _bitwidth);
+}
+
+esp_err_t ADCChannel::setBitwidth(adc_bitwidth_t bitwidth) {
+  return reconfigure(_atten, bitwidth);
+}
+
+esp_err_t ADCChannel::reconfigure(adc_atten_t atten, adc_bitwidth_t bitwidth) {
+  if (!_is_initialized)
+    return ESP_ERR_INVALID_STATE;
+  if (atten == _atten && bitwidth == _bitwidth)
+    return ESP_OK;
+
+  int64_t start = clock().nowUs();
+  esp_err_t err =
+      _driver->oneshotConfigChannel(_oneshot_handle, _channel, atten, bitwidth);
   if (err != ESP_OK) {
-    ESP_LOGE(TAG, "ADCChannel - Failed to create calibration scheme: %s",
+    ESP_LOGE(TAG, "ADCChannel - Failed to reconfigure oneshot channel: %s",
              esp_err_to_name(err));
-    return;
+    return err;
   }
-  _is_initialized = true;
+
+  adc_cali_handle_t handle = nullptr;
+  bool created = false;
+  err = calibrationFor(atten, bitwidth, handle, created);
+  if (err != ESP_OK) {
+    // go back to the configuration that still has a calibration
+    _driver->oneshotConfigChannel(_oneshot_handle, _channel, _atten,
+                                  _bitwidth);
+    return err;
+  }
+  _cali_handle = handle;
+  _atten = atten;
+  _bitwidth = bitwidth;
+
+  int64_t elapsed = clock().nowUs() - start;
+  _reconfig_stats.switches++;
+  if (created) {
+    _reconfig_stats.cali_created++;
+  } else {
+    _reconfig_stats.cali_cache_hits++;
+  }
+  _reconfig_stats.last_switch_us = elapsed;
+  _reconfig_stats.max_switch_us =
+      std::max(_reconfig_stats.max_switch_us, elapsed);
+  _reconfig_stats.total_switch_us += elapsed;
+  return ESP_OK;
 }
 
-ADCChannel::~ADCChannel() {
-  if (_cali_handle) {
-    adc_cali_delete_scheme_curve_fitting(_cali_handle);
-    _cali_handle = nullptr;
+esp_err_t ADCChannel::calibrationFor(adc_atten_t atten,
+                                     adc_bitwidth_t bitwidth,
+                                     adc_cali_handle_t &handle,
+                                     bool &created) {
+  for (const CaliEntry &entry : _cali_cache) {
+    if (entry.atten == atten && entry.bitwidth == bitwidth) {
+      handle = entry.handle;
+      created = false;
+      return ESP_OK;
+    }
+  }
+  esp_err_t err = _driver->caliCreate(_unit->getUnitId(), _channel, atten,
+                                      bitwidth, &handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "ADCChannel - Failed to create calibration scheme: %s",
+             esp_err_to_name(err));
+    handle = nullptr;
+    return err;
   }
+  _cali_cache.push_back({atten, bitwidth, handle});
+  created = true;
+  return ESP_OK;
+}
+
+bool ADCChannel::reserveSamples(std::vector<int> &voltages, size_t capacity) {
+  const size_t old_capacity = voltages.capacity();
+  if (capacity <= old_capacity)
+    return true;
+  // both buffers exist while the elements are copied
+  if (!_memory.acquire(capacity * sizeof(int)))
+    return false;
+  voltages.reserve(capacity);
+  _memory.release(old_capacity * sizeof(int));
+  return true;
+}
+
+void ADCChannel::releaseSamples(const std::vector<int> &voltages) {
+  _memory.release(voltages.capacity() * sizeof(int));
 }
 
+bool ADCChannel::makeRoom(std::vector<int> &voltages, size_t pending,
+                          const CaptureOptions &options, uint32_t &decimation,
+                          bool &summarized) {
+  const size_t grown = std::max<size_t>(voltages.capacity() * 2, 256);
+  if (options.memory_budget == 0)
+    return reserveSamples(voltages, grown) ||
+           reserveSamples(voltages, voltages.size() + pending);
+  // the up-front reservation may have been refused by the memory limit
+  const size_t budget = options.memory_budget / sizeof(int);
+  if (voltages.capacity() < budget &&
+      reserveSamples(voltages, std::min(grown, budget)))
+    return true;
+
+  switch (options.over_budget) {
+  case OverBudget::StopEarly:
+    return false;
+  case OverBudget::Summary:
+    releaseSamples(voltages);
+    std::vector<int>().swap(voltages);
+    summarized = true;
+    return true;
+  case OverBudget::Decimate:
+    break;
+  }
+  if (voltages.empty())
+    return false;
+  // more samples than expected: keep every other one and halve the rate
+  // from here on. Kept samples stay at multiples of the decimation, so
+  // their spacing remains even
+  size_t kept = 0;
+  for (size_t i = 0; i < voltages.size(); i += 2) {
+    voltages[kept++] = voltages[i];
+  }
+  voltages.resize(kept);
+  decimation *= 2;
+  return true;
+}
 
 int ADCChannel::calculatePercWidth(std::vector<int> &data, int8_t percentile) {
   if (percentile < 10 || percentile > 90)
@@ -169,20 +866,10 @@ int ADCChannel::calculatePercWidth(std::vector<int> &data, int8_t percentile) {
 
   std::sort(data.begin(), data.end());
 
-  const size_t n = data.size();
-  const float perc_decimal = static_cast<float>(percentile) / 100.0f;
-
-  // Calculate the indices for the percentile range
-  // For example, if percentile = 30:
-  // - Lower bound: 30th percentile (30% from bottom)
-  // - Upper bound: 70th percentile (100% - 30% from bottom)
-
-  size_t lower_index = static_cast<size_t>((n - 1) * perc_decimal);
-  size_t upper_index = static_cast<size_t>((n - 1) * (1.0f - perc_decimal));
-
-  // Ensure indices are within bounds
-  lower_index = std::min(lower_index, n - 1);
-  upper_index = std::min(upper_index, n - 1);
+  // integer ranks: (n - 1) * (1 - 0.6f) truncated in float lands one rank
+  // low, e.g. 3 instead of 4 for n = 11
+  uint64_t lower_index, upper_index;
+  percentileRanks(data.size(), percentile, lower_index, upper_index);
 
   // The width is the difference between the upper and lower percentile values
   // Since data is sorted: data[upper_index] >= data[lower_index]
@@ -194,22 +881,138 @@ int ADCChannel::calculatePercWidth(std::vector<int> &data, int8_t percentile) {
 
 bool ADCChannel::isInitialized() const { return _is_initialized; }
 
+adc_unit_t ADCChannel::unitId() const { return _unit->getUnitId(); }
+
 // ADCUnit implementations
-ADCUnit *ADCUnit::create(adc_unit_t unit_id) {
-  ADCUnit *new_unit = new ADCUnit(unit_id);
-  if (new_unit->isInitialized()) {
-    return new_unit;
+namespace {
+/// @brief units in use, handed out by ADCUnit::acquire() or owned by the
+/// caller of ADCUnit::create()
+struct UnitRegistry {
+  struct Entry {
+    Driver *driver;
+    adc_unit_t unit_id;
+    std::weak_ptr<ADCUnit> unit; // acquire()
+    ADCUnit *owned;              // create(), nullptr for acquire()
+  };
+  std::mutex mutex;
+  std::condition_variable released; // a unit was deleted
+  std::vector<Entry> entries;
+
+  static UnitRegistry &instance() {
+    static UnitRegistry registry;
+    return registry;
   }
-  delete new_unit;
-  return nullptr;
+
+  /**
+   * @brief the entry of unit_id on driver, nullptr if it is free. If its
+   * last shared reference is being dropped on another task, blocks until
+   * the deleter released the driver unit, whatever the task priorities.
+   */
+  Entry *find(std::unique_lock<std::mutex> &lock, Driver &driver,
+              adc_unit_t unit_id) {
+    while (true) {
+      auto entry = std::find_if(entries.begin(), entries.end(),
+                                [&](const Entry &entry) {
+                                  return entry.driver == &driver &&
+                                         entry.unit_id == unit_id;
+                                });
+      if (entry == entries.end())
+        return nullptr;
+      if (entry->owned || !entry->unit.expired())
+        return &*entry;
+      released.wait(lock);
+    }
+  }
+};
+} // namespace
+
+std::unique_ptr<ADCUnit> ADCUnit::create(adc_unit_t unit_id,
+                                         adc_ulp_mode_t ulp_mode,
+                                         Driver &driver) {
+  UnitRegistry &registry = UnitRegistry::instance();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  if (registry.find(lock, driver, unit_id)) {
+    ESP_LOGE(TAG, "ADCUnit - unit %d is already in use, share it with "
+                  "ADCUnit::acquire()",
+             (int)unit_id);
+    return nullptr;
+  }
+  // the constructor is private, so no make_unique
+  std::unique_ptr<ADCUnit> new_unit(new ADCUnit(unit_id, ulp_mode, driver));
+  if (!new_unit->isInitialized())
+    return nullptr;
+  new_unit->_owned = true;
+  registry.entries.push_back({&driver, unit_id, {}, new_unit.get()});
+  return new_unit;
+}
+
+std::shared_ptr<ADCUnit> ADCUnit::acquire(adc_unit_t unit_id,
+                                          adc_ulp_mode_t ulp_mode,
+                                          Driver &driver) {
+  UnitRegistry &registry = UnitRegistry::instance();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  if (UnitRegistry::Entry *entry = registry.find(lock, driver, unit_id)) {
+    std::shared_ptr<ADCUnit> unit = entry->unit.lock();
+    if (!unit) {
+      ESP_LOGE(TAG, "ADCUnit - unit %d is owned by ADCUnit::create()",
+               (int)unit_id);
+      return nullptr;
+    }
+    if (unit->_ulp_mode != ulp_mode) {
+      ESP_LOGE(TAG, "ADCUnit - unit %d is already in use with ULP mode %d",
+               (int)unit_id, (int)unit->_ulp_mode);
+      return nullptr;
+    }
+    return unit;
+  }
+
+  ADCUnit *new_unit = new ADCUnit(unit_id, ulp_mode, driver);
+  if (!new_unit->isInitialized()) {
+    delete new_unit;
+    return nullptr;
+  }
+  std::shared_ptr<ADCUnit> unit(new_unit, [](ADCUnit *released) {
+    UnitRegistry &registry = UnitRegistry::instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    delete released;
+    auto &entries = registry.entries;
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                 [](const UnitRegistry::Entry &entry) {
+                                   return !entry.owned &&
+                                          entry.unit.expired();
+                                 }),
+                  entries.end());
+    registry.released.notify_all();
+  });
+  registry.entries.push_back({&driver, unit_id, unit, nullptr});
+  return unit;
 }
 
 ADCUnit::~ADCUnit() {
+  if (_owned) {
+    UnitRegistry &registry = UnitRegistry::instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto &entries = registry.entries;
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                 [this](const UnitRegistry::Entry &entry) {
+                                   return entry.owned == this;
+                                 }),
+                  entries.end());
+    registry.released.notify_all();
+  }
   if (_cont_handle) {
-    adc_continuous_deinit(_cont_handle);
+    _driver.continuousDeinit(_cont_handle);
     _cont_handle = nullptr;
     _continuous_initialized = false;
   }
+  if (_is_initialized) {
+    esp_err_t err = _driver.oneshotDelUnit(_oneshot_handle);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Failed to delete oneshot unit: %s", esp_err_to_name(err));
+    }
+    _oneshot_handle = nullptr;
+    _is_initialized = false;
+  }
 }
 
 adc_oneshot_unit_handle_t ADCUnit::getOneshotHandle() const {
@@ -226,17 +1029,12 @@ adc_continuous_handle_t ADCUnit::getContinuousHandle() {
 adc_unit_t ADCUnit::getUnitId() const { return _unit_id; }
 
 // Fixed constructor with proper member initialization order
-ADCUnit::ADCUnit(adc_unit_t unit_id)
-    : _is_initialized(false), _unit_id(unit_id), _cont_handle(nullptr),
+ADCUnit::ADCUnit(adc_unit_t unit_id, adc_ulp_mode_t ulp_mode, Driver &driver)
+    : _is_initialized(false), _driver(driver), _unit_id(unit_id),
+      _ulp_mode(ulp_mode), _cont_handle(nullptr),
       _continuous_initialized(false) {
 
-  adc_oneshot_unit_init_cfg_t oneshot_init_cfg = {
-      .unit_id = unit_id,
-      .clk_src = ADC_DIGI_CLK_SRC_DEFAULT,
-      .ulp_mode = ADC_ULP_MODE_DISABLE,
-  };
-
-  esp_err_t err = adc_oneshot_new_unit(&oneshot_init_cfg, &_oneshot_handle);
+  esp_err_t err = _driver.oneshotNewUnit(unit_id, ulp_mode, &_oneshot_handle);
   _is_initialized = (err == ESP_OK);
 
   if (!_is_initialized) {
@@ -248,43 +1046,62 @@ esp_err_t ADCUnit::ensureContinuousInitialized() {
   if (_continuous_initialized)
     return ESP_OK;
 
-  // Fixed missing field initializer
-  adc_continuous_handle_cfg_t continuous_handle_cfg = {
-      .max_store_buf_size = 1024,
-      .conv_frame_size = 256,
-      .flags = 0 // Added missing field
-  };
-
   esp_err_t err =
-      adc_continuous_new_handle(&continuous_handle_cfg, &_cont_handle);
+      _driver.continuousNew(_unit_id, ContinuousConfig{}, &_cont_handle);
   if (err != ESP_OK)
     return err;
 
-  adc_digi_pattern_config_t adc_pattern = {
-      .atten = ADC_ATTEN_DB_12,
-      .channel = ADC_CHANNEL_0,
-      .unit = _unit_id,
-      .bit_width = ADC_BITWIDTH_12,
-  };
+  _continuous_initialized = true;
+  return ESP_OK;
+}
 
-  adc_continuous_config_t continuous_config = {
-      .pattern_num = 1,
-      .adc_pattern = &adc_pattern,
-      .sample_freq_hz = 20000,
-      .conv_mode = ADC_CONV_SINGLE_UNIT_1,
-      .format = ADC_DIGI_OUTPUT_FORMAT_TYPE2,
-  };
+esp_err_t ADCUnit::recoverContinuous(int64_t stalled_since_us,
+                                     int64_t *downtime_us) {
+  if (_cont_handle) {
+    // the driver may already be stopped; only re-creating it matters
+    _driver.continuousStop(_cont_handle);
+    _driver.continuousDeinit(_cont_handle);
+    _cont_handle = nullptr;
+  }
+  _continuous_initialized = false;
 
-  err = adc_continuous_config(_cont_handle, &continuous_config);
+  esp_err_t err = ensureContinuousInitialized();
+  if (err == ESP_OK) {
+    err = _driver.continuousStart(_cont_handle);
+  }
   if (err != ESP_OK) {
-    adc_continuous_deinit(_cont_handle);
+    ESP_LOGE(TAG, "Failed to restart continuous ADC: %s",
+             esp_err_to_name(err));
+    if (_cont_handle) {
+      _driver.continuousDeinit(_cont_handle);
+      _cont_handle = nullptr;
+    }
+    _continuous_initialized = false;
+    _recovery_stats.failed++;
     return err;
   }
 
-  _continuous_initialized = true;
+  int64_t downtime = clock().nowUs() - stalled_since_us;
+  _recovery_stats.recoveries++;
+  _recovery_stats.last_downtime_us = downtime;
+  _recovery_stats.max_downtime_us =
+      std::max(_recovery_stats.max_downtime_us, downtime);
+  _recovery_stats.total_downtime_us += downtime;
+  if (downtime_us) {
+    *downtime_us = downtime;
+  }
   return ESP_OK;
 }
 
+bool ADCUnit::noteConversion(adc_channel_t channel, adc_atten_t atten) {
+  bool switched = !_has_last_conversion || channel != _last_channel ||
+                  atten != _last_atten;
+  _has_last_conversion = true;
+  _last_channel = channel;
+  _last_atten = atten;
+  return switched;
+}
+
 bool ADCUnit::isInitialized() const { return _is_initialized; }
 
 } // namespace ED_ADC
\ No newline at end of file
@@ -0,0 +1,123 @@
+#include "ED_adc_adc2.h"
+#include <algorithm>
+
+namespace ED_ADC {
+
+static inline const char *TAG = "ED_ADC";
+
+Adc2Scheduler::Adc2Scheduler(ADCUnit &unit, const Adc2SchedulerConfig &config)
+    : _clock(unit.clock()), _unit_id(unit.getUnitId()), _config(config),
+      _queue(std::max<size_t>(config.queue_depth, 1)) {
+  if (unit.getUnitId() != ADC_UNIT_2) {
+    ESP_LOGW(TAG, "Adc2Scheduler - unit is not ADC2, no contention expected");
+  }
+}
+
+esp_err_t Adc2Scheduler::submit(ADCChannel &channel, Callback callback) {
+  if (channel.unitId() != _unit_id) {
+    ESP_LOGE(TAG, "Adc2Scheduler - channel %d is not on ADC%d",
+             channel.channel(), _unit_id + 1);
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (_count == _queue.size()) {
+    _stats.rejected++;
+    return ESP_ERR_NO_MEM;
+  }
+  Request &request = _queue[(_head + _count) % _queue.size()];
+  request.channel = &channel;
+  request.callback = std::move(callback);
+  request.submitted_us = _clock.nowUs();
+  _count++;
+  _stats.submitted++;
+  return ESP_OK;
+}
+
+size_t Adc2Scheduler::poll() {
+  size_t done = 0;
+  while (_count > 0) {
+    int64_t now = _clock.nowUs();
+    Request &request = _queue[_head];
+    if (now - request.submitted_us >= (int64_t)_config.max_wait_ms * 1000) {
+      _stats.expired++;
+      complete(ESP_ERR_TIMEOUT, 0, now);
+      done++;
+      continue;
+    }
+    if (now < _next_attempt_us)
+      break;
+
+    int voltage = 0;
+    esp_err_t err = request.channel->readVoltage(voltage);
+    now = _clock.nowUs();
+    if (err == ESP_ERR_TIMEOUT) {
+      // the radio holds ADC2: back off and keep the read queued
+      _stats.contentions++;
+      if (_busy_since_us < 0) {
+        _busy_since_us = now;
+      }
+      uint32_t delay_ms = _config.retry_ms;
+      for (uint32_t i = 0; i < _retries && delay_ms < _config.max_retry_ms;
+           i++) {
+        delay_ms *= 2;
+      }
+      delay_ms = std::min(delay_ms, _config.max_retry_ms);
+      _retries++;
+      _next_attempt_us = now + (int64_t)delay_ms * 1000;
+      break;
+    }
+
+    // ADC2 is free: the rest of the queue follows in the same window
+    if (_busy_since_us >= 0) {
+      _stats.max_busy_us = std::max(_stats.max_busy_us, now - _busy_since_us);
+      _busy_since_us = -1;
+    }
+    _retries = 0;
+    _next_attempt_us = 0;
+    if (err == ESP_OK) {
+      _stats.completed++;
+    }
+    complete(err, voltage, now);
+    done++;
+  }
+  return done;
+}
+
+esp_err_t Adc2Scheduler::read(ADCChannel &channel, int &voltage,
+                              int64_t *wait_us) {
+  bool finished = false;
+  esp_err_t result = ESP_FAIL;
+  esp_err_t err = submit(channel, [&](esp_err_t e, int mv, int64_t waited) {
+    finished = true;
+    result = e;
+    voltage = mv;
+    if (wait_us) {
+      *wait_us = waited;
+    }
+  });
+  if (err != ESP_OK)
+    return err;
+
+  while (true) {
+    poll();
+    if (finished)
+      return result;
+    int64_t wait = _next_attempt_us - _clock.nowUs();
+    _clock.delayMs(std::max<int64_t>((wait + 999) / 1000, 1));
+  }
+}
+
+void Adc2Scheduler::complete(esp_err_t err, int voltage, int64_t now_us) {
+  Request request = std::move(_queue[_head]);
+  _queue[_head] = {};
+  _head = (_head + 1) % _queue.size();
+  _count--;
+
+  int64_t waited = now_us - request.submitted_us;
+  _stats.max_wait_us = std::max(_stats.max_wait_us, waited);
+  _stats.total_wait_us += waited;
+  if (request.callback) {
+    request.callback(err, voltage, waited);
+  }
+}
+
+} // namespace ED_ADC
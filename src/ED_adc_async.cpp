@@ -0,0 +1,298 @@
+#include "ED_adc_async.h"
+#include "ED_adc_pm.h"
+
+#if ED_ADC_HAS_COROUTINES
+#include <algorithm>
+
+namespace ED_ADC {
+
+static inline const char *TAG = "ED_ADC";
+
+// Executor implementations
+bool Executor::SleepAwaiter::await_ready() const noexcept {
+  return _wake_at_us <= _executor._clock.nowUs();
+}
+
+void Executor::SleepAwaiter::await_suspend(std::coroutine_handle<> h) const {
+  _executor.schedule(h, _wake_at_us);
+}
+
+Executor::~Executor() {
+  for (std::coroutine_handle<> handle : _owned) {
+    handle.destroy();
+  }
+}
+
+void Executor::schedule(std::coroutine_handle<> handle, int64_t wake_at_us) {
+  _queue.push_back({wake_at_us, handle});
+}
+
+Executor::SleepAwaiter Executor::sleepFor(uint32_t ms) {
+  return SleepAwaiter(*this, _clock.nowUs() + (int64_t)ms * 1000);
+}
+
+size_t Executor::runOnce() {
+  const int64_t now = _clock.nowUs();
+  // resume in wake-up order; coroutines resumed here may schedule again, so
+  // the due entries are moved out before resuming any of them
+  std::vector<Entry> due;
+  auto split = std::stable_partition(
+      _queue.begin(), _queue.end(),
+      [now](const Entry &e) { return e.wake_at_us > now; });
+  due.assign(split, _queue.end());
+  _queue.erase(split, _queue.end());
+  std::stable_sort(due.begin(), due.end(), [](const Entry &a, const Entry &b) {
+    return a.wake_at_us < b.wake_at_us;
+  });
+
+  for (Entry &entry : due) {
+    entry.handle.resume();
+  }
+  reap();
+  return due.size();
+}
+
+void Executor::run() {
+  while (!_queue.empty()) {
+    if (runOnce() > 0)
+      continue;
+    int64_t next = _queue.front().wake_at_us;
+    for (const Entry &entry : _queue) {
+      next = std::min(next, entry.wake_at_us);
+    }
+    int64_t wait_ms = (next - _clock.nowUs() + 999) / 1000;
+    if (wait_ms > 0) {
+      _clock.delayMs(wait_ms);
+    }
+  }
+}
+
+void Executor::reap() {
+  auto finished = std::remove_if(_owned.begin(), _owned.end(),
+                                 [](std::coroutine_handle<> handle) {
+                                   if (!handle.done())
+                                     return false;
+                                   handle.destroy();
+                                   return true;
+                                 });
+  _owned.erase(finished, _owned.end());
+}
+
+// ADCChannel awaitable API
+Task<esp_err_t> ADCChannel::readAsync(Executor &executor, int sample_count,
+                                      int sample_delay_ms,
+                                      ADCReadResult &result,
+                                      CaptureOptions options) {
+  std::vector<int> voltages;
+  if (!reserveSamples(voltages, std::max(sample_count, 0))) {
+    ESP_LOGE(TAG, "ADCChannel - %d samples exceed the memory limit",
+             sample_count);
+    co_return ESP_ERR_NO_MEM;
+  }
+
+  ReadLoop loop;
+  PmLock::Guard pm_guard;
+
+  for (int i = 0; i < sample_count; i++) {
+    loop.reason = checkStop(options);
+    if (loop.reason != StopReason::Complete)
+      break;
+
+    int voltage;
+    SampleStep step;
+    while ((step = sampleStep(loop, voltage, options)) == SampleStep::Retry) {
+      loop.reason =
+          co_await interruptibleSleep(executor, loop.backoff_ms, options);
+      if (loop.reason != StopReason::Complete)
+        break;
+    }
+    if (loop.reason != StopReason::Complete)
+      break; // keep what was measured so far
+    pm_guard.sample();
+    if (step == SampleStep::Taken)
+      voltages.push_back(voltage);
+
+    if (sample_delay_ms > 0 && i + 1 < sample_count) {
+      loop.reason =
+          co_await interruptibleSleep(executor, sample_delay_ms, options);
+      if (loop.reason != StopReason::Complete)
+        break;
+    }
+  }
+  acknowledgeStop(options, loop.reason);
+
+  esp_err_t err = finishRead(voltages, loop, result);
+  releaseSamples(voltages);
+  co_return err;
+}
+
+Task<StopReason>
+ADCChannel::interruptibleSleep(Executor &executor, int delay_ms,
+                               const CaptureOptions &options) const {
+  // sleep in slices so cancellation is seen as promptly as in read()
+  while (delay_ms > 0) {
+    int slice = std::min(delay_ms, CANCEL_POLL_MS);
+    co_await executor.sleepFor(slice);
+    delay_ms -= slice;
+    StopReason reason = checkStop(options);
+    if (reason != StopReason::Complete)
+      co_return reason;
+  }
+  co_return StopReason::Complete;
+}
+
+FrameStream ADCChannel::openStream(Executor &executor,
+                                   const CaptureOptions &options) {
+  return FrameStream(*this, executor, options);
+}
+
+// FrameStream implementations
+FrameStream::FrameStream(ADCChannel &channel, Executor &executor,
+                         const CaptureOptions &options)
+    : _channel(&channel), _executor(&executor), _options(options) {
+  // the DMA read buffer, and room for the largest frame it decodes to, so
+  // _frame never grows while the stream runs
+  if (!_channel->_memory.acquire(ADCChannel::FRAME_BUFFER_BYTES)) {
+    ESP_LOGE(TAG, "FrameStream - read buffer exceeds memory limit");
+    _pm_guard.release();
+    return;
+  }
+  _buffer.resize(ADCChannel::FRAME_BUFFER_BYTES);
+  if (!_channel->reserveSamples(_frame,
+                                ADCChannel::FRAME_BUFFER_BYTES / 2)) {
+    ESP_LOGE(TAG, "FrameStream - frame buffer exceeds memory limit");
+    _pm_guard.release();
+    return;
+  }
+
+  adc_continuous_handle_t handle = _channel->_unit->getContinuousHandle();
+  esp_err_t err = ESP_ERR_INVALID_STATE;
+  if (handle) {
+    err = _channel->_driver->continuousStart(handle);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to start continuous ADC: %s",
+             esp_err_to_name(err));
+    _pm_guard.release();
+    return;
+  }
+  _running = true;
+  _last_frame_us = _channel->clock().nowUs();
+}
+
+FrameStream::FrameStream(FrameStream &&other) noexcept
+    : _channel(other._channel), _executor(other._executor),
+      _options(other._options), _buffer(std::move(other._buffer)),
+      _frame(std::move(other._frame)), _pm_guard(std::move(other._pm_guard)),
+      _running(other._running), _last_frame_us(other._last_frame_us),
+      _consecutive_errors(other._consecutive_errors),
+      _recoveries(other._recoveries), _gap_before(other._gap_before) {
+  other._running = false;
+}
+
+FrameStream::~FrameStream() {
+  stop();
+  // a moved-from stream holds no buffers
+  _channel->_memory.release(_buffer.capacity());
+  _channel->releaseSamples(_frame);
+}
+
+void FrameStream::stop() {
+  if (!_running)
+    return;
+  _running = false;
+  esp_err_t err =
+      _channel->_driver->continuousStop(_channel->_unit->getContinuousHandle());
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to stop continuous ADC: %s", esp_err_to_name(err));
+  }
+  // the continuous pattern drove the sampling capacitor
+  _channel->_unit->_has_last_conversion = false;
+  _pm_guard.release();
+}
+
+bool FrameStream::tryRead() {
+  uint32_t bytes_read = 0;
+  esp_err_t ret = _channel->_driver->continuousRead(
+      _channel->_unit->getContinuousHandle(), _buffer.data(), _buffer.size(),
+      &bytes_read, 0);
+  if (ret != ESP_OK) {
+    if (ret != ESP_ERR_TIMEOUT) {
+      _consecutive_errors++;
+      ESP_LOGW(TAG, "ADC continuous read error: %s", esp_err_to_name(ret));
+    }
+    return false;
+  }
+  _last_frame_us = _channel->clock().nowUs();
+  _consecutive_errors = 0;
+  _pm_guard.sample();
+
+  _frame.clear();
+  // Process data for ADC_DIGI_OUTPUT_FORMAT_TYPE2
+  for (size_t i = 0; i + 1 < bytes_read; i += 2) {
+    int raw_reading = (_buffer[i + 1] << 8) | _buffer[i];
+    raw_reading &= 0xFFF; // Mask to get only the 12-bit ADC value
+
+    int voltage;
+    _channel->_driver->caliRawToVoltage(_channel->_cali_handle, raw_reading,
+                                        &voltage);
+    _frame.push_back(voltage);
+  }
+  return true;
+}
+
+Task<esp_err_t> FrameStream::nextFrame() {
+  _gap_before = false;
+  while (_running) {
+    StopReason reason = _channel->checkStop(_options);
+    if (reason != StopReason::Complete) {
+      ADCChannel::acknowledgeStop(_options, reason);
+      stop();
+      co_return reason == StopReason::Deadline ? ESP_ERR_TIMEOUT
+                                               : ESP_ERR_INVALID_STATE;
+    }
+    if (tryRead())
+      co_return ESP_OK;
+    esp_err_t err = checkWatchdog();
+    if (err != ESP_OK) {
+      stop();
+      co_return err;
+    }
+    co_await _executor->sleepFor(POLL_INTERVAL_MS);
+  }
+  co_return ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t FrameStream::checkWatchdog() {
+  bool stalled = _options.frame_timeout_ms > 0 &&
+                 _channel->clock().nowUs() - _last_frame_us >
+                     (int64_t)_options.frame_timeout_ms * 1000;
+  bool failing = _options.max_read_errors > 0 &&
+                 _consecutive_errors >= _options.max_read_errors;
+  if (!stalled && !failing)
+    return ESP_OK;
+  if (_recoveries >= _options.max_recoveries) {
+    ESP_LOGE(TAG, "Continuous ADC could not be recovered");
+    return ESP_FAIL;
+  }
+
+  ESP_LOGW(TAG, "Continuous ADC %s, restarting",
+           stalled ? "stalled" : "keeps failing");
+  esp_err_t err = _channel->_unit->recoverContinuous(_last_frame_us);
+  if (err != ESP_OK) {
+    // the unit released the handle, there is nothing left to stop
+    _running = false;
+    _channel->_unit->_has_last_conversion = false;
+    _pm_guard.release();
+    return err;
+  }
+  _recoveries++;
+  _gap_before = true;
+  _last_frame_us = _channel->clock().nowUs();
+  _consecutive_errors = 0;
+  return ESP_OK;
+}
+
+} // namespace ED_ADC
+
+#endif // ED_ADC_HAS_COROUTINES
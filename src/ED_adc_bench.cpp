@@ -0,0 +1,253 @@
+#include "ED_adc_bench.h"
+#include "ED_adc.h"
+#include "ED_adc_stream.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+namespace ED_ADC {
+
+namespace {
+const char *CSV_HEADER = "name,ns_per_sample,min_ns_per_sample,samples,runs";
+
+/// @brief transport that drops everything, so only the packing is timed
+class NullTransport : public ByteTransport {
+public:
+  esp_err_t write(const uint8_t *, size_t) override { return ESP_OK; }
+};
+
+void copyName(char (&out)[BENCH_NAME_SIZE], const char *name) {
+  strncpy(out, name, BENCH_NAME_SIZE - 1);
+  out[BENCH_NAME_SIZE - 1] = '\0';
+}
+
+/// @brief deterministic noise of a few codes around mid-scale, so the
+/// statistics see realistic data
+int benchSignal(adc_channel_t, int64_t t_us) {
+  uint32_t x = (uint32_t)t_us * 2654435761u;
+  return 2040 + (int)(x >> 28);
+}
+
+BenchResult measure(const char *name, const BenchConfig &config,
+                    const std::function<void()> &run) {
+  Clock &clock = SystemClock::instance();
+  // warm-up (caches, lazily created driver handles), which also sizes a
+  // run: repeat the work until a run is long against the clock resolution
+  int64_t start = clock.nowUs();
+  run();
+  const int64_t once = std::max<int64_t>(clock.nowUs() - start, 1);
+  const uint32_t repeats = (uint32_t)std::max<int64_t>(
+      (config.min_run_us + once - 1) / once, 1);
+
+  std::vector<int64_t> times;
+  for (uint32_t i = 0; i < std::max<uint32_t>(config.runs, 1); i++) {
+    start = clock.nowUs();
+    for (uint32_t j = 0; j < repeats; j++) {
+      run();
+    }
+    times.push_back(clock.nowUs() - start);
+  }
+  std::sort(times.begin(), times.end());
+
+  BenchResult result = {};
+  copyName(result.name, name);
+  result.samples = (uint64_t)config.samples * repeats;
+  result.runs = times.size();
+  const double per_sample = 1000.0 / std::max<uint64_t>(result.samples, 1);
+  result.ns_per_sample = times[times.size() / 2] * per_sample;
+  result.min_ns_per_sample = times.front() * per_sample;
+  return result;
+}
+} // namespace
+
+std::vector<BenchResult> runBenchmarks(const BenchConfig &config,
+                                       const char *only) {
+  std::vector<BenchResult> results;
+  VirtualClock time;
+  SimDriver sim(time);
+  sim.setSignal(benchSignal);
+  std::unique_ptr<ADCUnit> unit =
+      ADCUnit::create(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim);
+  if (!unit)
+    return results;
+  ADCChannel channel(unit.get(), ADC_CHANNEL_0, ADC_ATTEN_DB_12);
+  if (!channel.isInitialized())
+    return results;
+
+  const int samples = (int)config.samples;
+  const uint32_t rate = unit->continuousConfig().sample_freq_hz;
+  const uint32_t duration_ms =
+      std::max<uint32_t>((uint64_t)config.samples * 1000 / rate, 1);
+  auto bench = [&](const char *name, const std::function<void()> &run) {
+    if (!only || strcmp(only, name) == 0) {
+      results.push_back(measure(name, config, run));
+    }
+  };
+
+  bench("read", [&] {
+    ADCReadResult result = {};
+    channel.read(samples, 0, result);
+  });
+  bench("read_streamed", [&] {
+    ADCReadResult result = {};
+    channel.readStreamed(samples, 0, result);
+  });
+  bench("capture_decode", [&] {
+    channel.captureFrames(duration_ms,
+                          [](const uint16_t *, size_t, int64_t) {});
+  });
+  bench("capture_calibrate", [&] { channel.sampleForDuration(duration_ms); });
+  CodeHistogram hist;
+  bench("histogram_raw",
+        [&] { channel.histogramForDuration(duration_ms, hist); });
+
+  // a frame of the capture, packed over and over
+  std::vector<uint16_t> codes(ADCChannel::FRAME_BUFFER_BYTES / 2);
+  for (size_t i = 0; i < codes.size(); i++) {
+    codes[i] = benchSignal(ADC_CHANNEL_0, i);
+  }
+  NullTransport transport;
+  SampleStreamer streamer(transport);
+  bench("stream_pack", [&] {
+    for (uint32_t done = 0; done < config.samples; done += codes.size()) {
+      const size_t count =
+          std::min<size_t>(codes.size(), config.samples - done);
+      streamer.push(codes.data(), count, done);
+      streamer.pump();
+    }
+    streamer.flush();
+  });
+  return results;
+}
+
+esp_err_t writeBenchResults(FILE *file,
+                            const std::vector<BenchResult> &results) {
+  if (fprintf(file, "%s\n", CSV_HEADER) < 0)
+    return ESP_FAIL;
+  for (const BenchResult &result : results) {
+    if (fprintf(file, "%s,%.3f,%.3f,%llu,%u\n", result.name,
+                result.ns_per_sample, result.min_ns_per_sample,
+                (unsigned long long)result.samples, result.runs) < 0)
+      return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+bool readBenchResults(FILE *file, std::vector<BenchResult> &results) {
+  results.clear();
+  char line[128];
+  if (!fgets(line, sizeof(line), file) ||
+      strncmp(line, CSV_HEADER, strlen(CSV_HEADER)) != 0)
+    return false;
+  while (fgets(line, sizeof(line), file)) {
+    if (line[0] == '\n' || line[0] == '\0')
+      continue;
+    BenchResult result = {};
+    char name[BENCH_NAME_SIZE];
+    unsigned long long samples;
+    if (sscanf(line, "%23[^,],%lf,%lf,%llu,%u", name, &result.ns_per_sample,
+               &result.min_ns_per_sample, &samples, &result.runs) != 5)
+      return false;
+    copyName(result.name, name);
+    result.samples = samples;
+    results.push_back(result);
+  }
+  return true;
+}
+
+size_t compareBench(const std::vector<BenchResult> &baseline,
+                    const std::vector<BenchResult> &current,
+                    double tolerance, std::vector<BenchComparison> &report) {
+  report.clear();
+  auto find = [](const std::vector<BenchResult> &set, const char *name) {
+    return std::find_if(set.begin(), set.end(), [&](const BenchResult &r) {
+      return strcmp(r.name, name) == 0;
+    });
+  };
+
+  size_t failures = 0;
+  for (const BenchResult &base : baseline) {
+    BenchComparison entry = {};
+    copyName(entry.name, base.name);
+    entry.baseline_ns = base.min_ns_per_sample;
+    auto now = find(current, base.name);
+    if (now == current.end()) {
+      // a deleted or crashed benchmark must not pass the gate silently
+      entry.missing = true;
+    } else {
+      entry.current_ns = now->min_ns_per_sample;
+      if (base.min_ns_per_sample > 0) {
+        // a benchmark whose runs spread when it was recorded needs that
+        // much room before a slowdown can be told from noise
+        const double spread = std::max(
+            base.ns_per_sample / base.min_ns_per_sample - 1, 0.0);
+        entry.limit = tolerance + spread;
+        entry.change = now->min_ns_per_sample / base.min_ns_per_sample - 1;
+        // a burst of other load can slow every run of one benchmark, but
+        // rarely the fastest and the typical run alike
+        entry.regressed =
+            entry.change > entry.limit &&
+            now->ns_per_sample > base.ns_per_sample * (1 + entry.limit);
+      }
+    }
+    failures += entry.regressed || entry.missing;
+    report.push_back(entry);
+  }
+  for (const BenchResult &now : current) {
+    if (find(baseline, now.name) != baseline.end())
+      continue;
+    BenchComparison entry = {};
+    copyName(entry.name, now.name);
+    entry.current_ns = now.min_ns_per_sample;
+    report.push_back(entry);
+  }
+  return failures;
+}
+
+size_t gateBench(const std::vector<BenchResult> &baseline,
+                 const BenchConfig &config, std::vector<BenchResult> &current,
+                 std::vector<BenchComparison> &report) {
+  current = runBenchmarks(config);
+  size_t failures = compareBench(baseline, current, config.tolerance, report);
+  for (uint32_t retry = 0; retry < config.retries && failures > 0; retry++) {
+    bool rerun = false;
+    for (const BenchComparison &entry : report) {
+      if (!entry.regressed)
+        continue;
+      auto now = std::find_if(current.begin(), current.end(),
+                              [&](const BenchResult &r) {
+                                return strcmp(r.name, entry.name) == 0;
+                              });
+      for (const BenchResult &again : runBenchmarks(config, entry.name)) {
+        // keep the least disturbed runs of either attempt
+        now->min_ns_per_sample =
+            std::min(now->min_ns_per_sample, again.min_ns_per_sample);
+        now->ns_per_sample = std::min(now->ns_per_sample, again.ns_per_sample);
+        rerun = true;
+      }
+    }
+    if (!rerun)
+      break;
+    failures = compareBench(baseline, current, config.tolerance, report);
+  }
+  return failures;
+}
+
+void writeBenchComparison(FILE *file,
+                          const std::vector<BenchComparison> &report) {
+  fprintf(file, "%-23s %12s %12s %8s %8s\n", "benchmark", "baseline ns",
+          "current ns", "change", "limit");
+  for (const BenchComparison &entry : report) {
+    if (entry.baseline_ns <= 0 || entry.current_ns <= 0) {
+      fprintf(file, "%-23s %12.2f %12.2f %8s\n", entry.name,
+              entry.baseline_ns, entry.current_ns,
+              entry.missing ? "MISSING" : "new");
+      continue;
+    }
+    fprintf(file, "%-23s %12.2f %12.2f %+7.1f%% %7.1f%%%s\n", entry.name,
+            entry.baseline_ns, entry.current_ns, entry.change * 100,
+            entry.limit * 100, entry.regressed ? " REGRESSED" : "");
+  }
+}
+
+} // namespace ED_ADC
@@ -0,0 +1,59 @@
+#include "ED_adc_clock.h"
+#include "ED_adc_port.h"
+
+#if defined(ESP_PLATFORM)
+#include "esp_sleep.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#else
+#include <chrono>
+#include <thread>
+#endif
+
+namespace ED_ADC {
+
+#if defined(ESP_PLATFORM)
+static inline const char *TAG = "ED_ADC";
+#endif
+
+SystemClock &SystemClock::instance() {
+  static SystemClock clock;
+  return clock;
+}
+
+#if defined(ESP_PLATFORM)
+int64_t SystemClock::nowUs() { return esp_timer_get_time(); }
+
+void SystemClock::delayMs(uint32_t ms) { vTaskDelay(pdMS_TO_TICKS(ms)); }
+
+void SystemClock::lightSleepUs(int64_t us) {
+  if (us <= 0)
+    return;
+  esp_err_t err = esp_sleep_enable_timer_wakeup(us);
+  if (err == ESP_OK) {
+    err = esp_light_sleep_start();
+  }
+  if (err != ESP_OK) {
+    // e.g. a wake source is pending: fall back to a plain delay
+    ESP_LOGW(TAG, "Light sleep failed: %s", esp_err_to_name(err));
+    Clock::lightSleepUs(us);
+  }
+}
+#else
+// host build: steady clock and thread sleeps
+int64_t SystemClock::nowUs() {
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void SystemClock::delayMs(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void SystemClock::lightSleepUs(int64_t us) {
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+#endif
+
+} // namespace ED_ADC
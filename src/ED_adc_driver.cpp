@@ -0,0 +1,479 @@
+#include "ED_adc_driver.h"
+#include <algorithm>
+#include <cstdint>
+
+#if defined(ESP_PLATFORM)
+#include "esp_attr.h"
+#endif
+
+namespace ED_ADC {
+
+#if defined(ESP_PLATFORM)
+// IdfDriver implementations
+IdfDriver &IdfDriver::instance() {
+  static IdfDriver driver;
+  return driver;
+}
+
+esp_err_t IdfDriver::oneshotNewUnit(adc_unit_t unit, adc_ulp_mode_t ulp_mode,
+                                    adc_oneshot_unit_handle_t *handle) {
+  adc_oneshot_unit_init_cfg_t oneshot_init_cfg = {
+      .unit_id = unit,
+      .clk_src = ADC_DIGI_CLK_SRC_DEFAULT,
+      .ulp_mode = ulp_mode,
+  };
+  return adc_oneshot_new_unit(&oneshot_init_cfg, handle);
+}
+
+esp_err_t IdfDriver::oneshotDelUnit(adc_oneshot_unit_handle_t handle) {
+  return adc_oneshot_del_unit(handle);
+}
+
+esp_err_t IdfDriver::oneshotConfigChannel(adc_oneshot_unit_handle_t handle,
+                                          adc_channel_t channel,
+                                          adc_atten_t atten,
+                                          adc_bitwidth_t bitwidth) {
+  adc_oneshot_chan_cfg_t oneshot_chan_cfg = {
+      .atten = atten,
+      .bitwidth = bitwidth,
+  };
+  return adc_oneshot_config_channel(handle, channel, &oneshot_chan_cfg);
+}
+
+esp_err_t IdfDriver::oneshotRead(adc_oneshot_unit_handle_t handle,
+                                 adc_channel_t channel, int *raw) {
+  return adc_oneshot_read(handle, channel, raw);
+}
+
+esp_err_t IdfDriver::caliCreate(adc_unit_t unit, adc_channel_t channel,
+                                adc_atten_t atten, adc_bitwidth_t bitwidth,
+                                adc_cali_handle_t *handle) {
+  adc_cali_curve_fitting_config_t cali_cfg = {
+      .unit_id = unit,
+      .chan = channel,
+      .atten = atten,
+      .bitwidth = bitwidth,
+  };
+  return adc_cali_create_scheme_curve_fitting(&cali_cfg, handle);
+}
+
+esp_err_t IdfDriver::caliDelete(adc_cali_handle_t handle) {
+  return adc_cali_delete_scheme_curve_fitting(handle);
+}
+
+esp_err_t IdfDriver::caliRawToVoltage(adc_cali_handle_t handle, int raw,
+                                      int *voltage) {
+  return adc_cali_raw_to_voltage(handle, raw, voltage);
+}
+
+esp_err_t IdfDriver::continuousNew(adc_unit_t unit,
+                                   const ContinuousConfig &config,
+                                   adc_continuous_handle_t *handle) {
+  adc_continuous_handle_cfg_t continuous_handle_cfg = {
+      .max_store_buf_size = config.max_store_buf_size,
+      .conv_frame_size = config.conv_frame_size,
+      .flags = 0,
+  };
+
+  esp_err_t err = adc_continuous_new_handle(&continuous_handle_cfg, handle);
+  if (err != ESP_OK)
+    return err;
+
+  adc_digi_pattern_config_t adc_pattern = {
+      .atten = (uint8_t)config.atten,
+      .channel = (uint8_t)config.channel,
+      .unit = (uint8_t)unit,
+      .bit_width = ADC_BITWIDTH_12,
+  };
+
+  adc_continuous_config_t continuous_config = {
+      .pattern_num = 1,
+      .adc_pattern = &adc_pattern,
+      .sample_freq_hz = config.sample_freq_hz,
+      .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+      .format = ADC_DIGI_OUTPUT_FORMAT_TYPE2,
+  };
+
+  err = adc_continuous_config(*handle, &continuous_config);
+  if (err == ESP_OK) {
+    adc_continuous_evt_cbs_t callbacks = {};
+    callbacks.on_pool_ovf = onPoolOverflow;
+    err = adc_continuous_register_event_callbacks(*handle, &callbacks, this);
+  }
+  if (err != ESP_OK) {
+    adc_continuous_deinit(*handle);
+    *handle = nullptr;
+    return err;
+  }
+  _overflows = 0;
+  return ESP_OK;
+}
+
+bool IRAM_ATTR IdfDriver::onPoolOverflow(adc_continuous_handle_t,
+                                         const adc_continuous_evt_data_t *,
+                                         void *user_data) {
+  static_cast<IdfDriver *>(user_data)->_overflows++;
+  return false;
+}
+
+esp_err_t IdfDriver::continuousDeinit(adc_continuous_handle_t handle) {
+  return adc_continuous_deinit(handle);
+}
+
+esp_err_t IdfDriver::continuousStart(adc_continuous_handle_t handle) {
+  return adc_continuous_start(handle);
+}
+
+esp_err_t IdfDriver::continuousRead(adc_continuous_handle_t handle,
+                                    uint8_t *buffer, uint32_t length,
+                                    uint32_t *bytes_read,
+                                    uint32_t timeout_ms) {
+  return adc_continuous_read(handle, buffer, length, bytes_read, timeout_ms);
+}
+
+esp_err_t IdfDriver::continuousStop(adc_continuous_handle_t handle) {
+  return adc_continuous_stop(handle);
+}
+
+uint32_t IdfDriver::continuousOverflows(adc_continuous_handle_t) {
+  return _overflows;
+}
+#endif
+
+// SimDriver implementations
+namespace {
+// handles only need to be distinct and non-null
+template <typename H> H toHandle(uintptr_t value) {
+  return reinterpret_cast<H>(value);
+}
+template <typename H> uintptr_t fromHandle(H handle) {
+  return reinterpret_cast<uintptr_t>(handle);
+}
+} // namespace
+
+SimDriver::SimDriver(VirtualClock &clock) : _clock(clock) {}
+
+int SimDriver::sample(adc_channel_t channel, int64_t t_us) {
+  int raw = _signal ? _signal(channel, t_us) : 2048;
+  return std::clamp(raw, 0, 4095);
+}
+
+esp_err_t SimDriver::oneshotNewUnit(adc_unit_t unit, adc_ulp_mode_t,
+                                    adc_oneshot_unit_handle_t *handle) {
+  *handle = toHandle<adc_oneshot_unit_handle_t>(unit + 1);
+  return ESP_OK;
+}
+
+esp_err_t SimDriver::oneshotDelUnit(adc_oneshot_unit_handle_t) {
+  return ESP_OK;
+}
+
+esp_err_t SimDriver::oneshotConfigChannel(adc_oneshot_unit_handle_t,
+                                          adc_channel_t, adc_atten_t,
+                                          adc_bitwidth_t) {
+  return ESP_OK;
+}
+
+SimDriver::Contention SimDriver::periodicContention(int64_t period_us,
+                                                   int64_t busy_us) {
+  return [period_us, busy_us](int64_t t_us) {
+    return period_us > 0 && t_us % period_us < busy_us;
+  };
+}
+
+esp_err_t SimDriver::oneshotRead(adc_oneshot_unit_handle_t handle,
+                                 adc_channel_t channel, int *raw) {
+  if (fromHandle(handle) == ADC_UNIT_2 + 1 && _contention &&
+      _contention(_clock.nowUs())) {
+    // the real driver gives up after a short wait for the arbiter
+    _clock.advanceUs(_conversion_us);
+    _stats.adc2_contentions++;
+    return ESP_ERR_TIMEOUT;
+  }
+  _clock.advanceUs(_conversion_us);
+  _stats.oneshot_reads++;
+  int target = sample(channel, _clock.nowUs());
+  _held = target + (_held - target) * _retention;
+  *raw = (int)(_held + 0.5f);
+  return ESP_OK;
+}
+
+esp_err_t SimDriver::caliCreate(adc_unit_t, adc_channel_t, adc_atten_t atten,
+                                adc_bitwidth_t, adc_cali_handle_t *handle) {
+  // full scale in mV per attenuation, as in the ADCChannel::create() table
+  static const int full_scale_mv[] = {750, 1050, 1300, 2500};
+  int index = std::clamp((int)atten, 0, 3);
+  *handle = toHandle<adc_cali_handle_t>(full_scale_mv[index]);
+  return ESP_OK;
+}
+
+esp_err_t SimDriver::caliDelete(adc_cali_handle_t) { return ESP_OK; }
+
+esp_err_t SimDriver::caliRawToVoltage(adc_cali_handle_t handle, int raw,
+                                      int *voltage) {
+  *voltage = (int)(raw * (int64_t)fromHandle(handle) / 4095);
+  return ESP_OK;
+}
+
+esp_err_t SimDriver::continuousNew(adc_unit_t, const ContinuousConfig &config,
+                                   adc_continuous_handle_t *handle) {
+  if (config.sample_freq_hz == 0 || config.conv_frame_size == 0)
+    return ESP_ERR_INVALID_ARG;
+  _cont_config = config;
+  _cont_created = true;
+  _pool.clear();
+  _pool.reserve(config.max_store_buf_size);
+  *handle = toHandle<adc_continuous_handle_t>(1);
+  return ESP_OK;
+}
+
+esp_err_t SimDriver::continuousDeinit(adc_continuous_handle_t) {
+  if (_cont_running)
+    return ESP_ERR_INVALID_STATE;
+  _cont_created = false;
+  return ESP_OK;
+}
+
+esp_err_t SimDriver::continuousStart(adc_continuous_handle_t) {
+  if (!_cont_created || _cont_running)
+    return ESP_ERR_INVALID_STATE;
+  _cont_running = true;
+  _pool.clear();
+  const int64_t period_us = 1000000 / _cont_config.sample_freq_hz;
+  _next_sample_us = _clock.nowUs() + std::max<int64_t>(period_us, 1);
+  return ESP_OK;
+}
+
+void SimDriver::produce() {
+  const int64_t now = _clock.nowUs();
+  const int64_t period_us =
+      std::max<int64_t>(1000000 / _cont_config.sample_freq_hz, 1);
+  bool overflowing = false;
+  while (_next_sample_us <= now) {
+    _stats.samples_produced++;
+    if (_pool.size() + 2 > _cont_config.max_store_buf_size) {
+      _stats.samples_dropped++;
+      overflowing = true;
+    } else {
+      int raw = sample(_cont_config.channel, _next_sample_us);
+      _pool.push_back(raw & 0xFF);
+      _pool.push_back((raw >> 8) & 0x0F);
+    }
+    _next_sample_us += period_us;
+  }
+  if (overflowing) {
+    _stats.pool_overflows++;
+  }
+}
+
+esp_err_t SimDriver::continuousRead(adc_continuous_handle_t, uint8_t *buffer,
+                                    uint32_t length, uint32_t *bytes_read,
+                                    uint32_t timeout_ms) {
+  *bytes_read = 0;
+  if (!_cont_running)
+    return ESP_ERR_INVALID_STATE;
+  produce();
+
+  const uint32_t frame = _cont_config.conv_frame_size;
+  if (_pool.size() < frame) {
+    // wait until the next frame is complete, or the timeout elapses
+    const int64_t period_us =
+        std::max<int64_t>(1000000 / _cont_config.sample_freq_hz, 1);
+    const int64_t missing = (frame - _pool.size() + 1) / 2;
+    int64_t wait_us =
+        _next_sample_us - _clock.nowUs() + (missing - 1) * period_us;
+    if (timeout_ms > 0) {
+      wait_us = std::min<int64_t>(wait_us, (int64_t)timeout_ms * 1000);
+    }
+    _clock.advanceUs(wait_us);
+    if (timeout_ms == 0)
+      return ESP_ERR_TIMEOUT;
+    produce();
+    if (_pool.size() < frame)
+      return ESP_ERR_TIMEOUT;
+  }
+
+  uint32_t count = std::min<uint32_t>(length, _pool.size());
+  count -= count % 2;
+  std::copy(_pool.begin(), _pool.begin() + count, buffer);
+  _pool.erase(_pool.begin(), _pool.begin() + count);
+  *bytes_read = count;
+  return ESP_OK;
+}
+
+esp_err_t SimDriver::continuousStop(adc_continuous_handle_t) {
+  if (!_cont_running)
+    return ESP_ERR_INVALID_STATE;
+  _cont_running = false;
+  return ESP_OK;
+}
+
+uint32_t SimDriver::continuousOverflows(adc_continuous_handle_t) {
+  return _stats.pool_overflows;
+}
+
+// FaultInjectingDriver implementations
+FaultInjectingDriver::FaultInjectingDriver(Driver &inner,
+                                           const FaultConfig &config)
+    : _inner(inner) {
+  setConfig(config);
+}
+
+void FaultInjectingDriver::setConfig(const FaultConfig &config) {
+  _config = config;
+  _rng_state = config.seed ? config.seed : 1;
+}
+
+bool FaultInjectingDriver::roll(float rate) {
+  if (rate <= 0.0f)
+    return false;
+  // xorshift32: cheap and identical on every platform
+  _rng_state ^= _rng_state << 13;
+  _rng_state ^= _rng_state >> 17;
+  _rng_state ^= _rng_state << 5;
+  return (_rng_state >> 8) < (uint32_t)(rate * (1u << 24));
+}
+
+esp_err_t
+FaultInjectingDriver::oneshotNewUnit(adc_unit_t unit, adc_ulp_mode_t ulp_mode,
+                                     adc_oneshot_unit_handle_t *handle) {
+  return _inner.oneshotNewUnit(unit, ulp_mode, handle);
+}
+
+esp_err_t
+FaultInjectingDriver::oneshotDelUnit(adc_oneshot_unit_handle_t handle) {
+  return _inner.oneshotDelUnit(handle);
+}
+
+esp_err_t FaultInjectingDriver::oneshotConfigChannel(
+    adc_oneshot_unit_handle_t handle, adc_channel_t channel, adc_atten_t atten,
+    adc_bitwidth_t bitwidth) {
+  return _inner.oneshotConfigChannel(handle, channel, atten, bitwidth);
+}
+
+esp_err_t FaultInjectingDriver::oneshotRead(adc_oneshot_unit_handle_t handle,
+                                            adc_channel_t channel, int *raw) {
+  if (roll(_config.oneshot_timeout_rate)) {
+    _stats.oneshot_timeouts++;
+    return ESP_ERR_TIMEOUT;
+  }
+  if (roll(_config.oneshot_error_rate)) {
+    _stats.oneshot_errors++;
+    return _config.oneshot_error;
+  }
+  esp_err_t err = _inner.oneshotRead(handle, channel, raw);
+  if (err != ESP_OK)
+    return err;
+  if (roll(_config.stuck_rate)) {
+    _stats.stuck_samples++;
+    *raw = _last_raw;
+  }
+  _last_raw = *raw;
+  return ESP_OK;
+}
+
+esp_err_t FaultInjectingDriver::caliCreate(adc_unit_t unit,
+                                           adc_channel_t channel,
+                                           adc_atten_t atten,
+                                           adc_bitwidth_t bitwidth,
+                                           adc_cali_handle_t *handle) {
+  return _inner.caliCreate(unit, channel, atten, bitwidth, handle);
+}
+
+esp_err_t FaultInjectingDriver::caliDelete(adc_cali_handle_t handle) {
+  return _inner.caliDelete(handle);
+}
+
+esp_err_t FaultInjectingDriver::caliRawToVoltage(adc_cali_handle_t handle,
+                                                 int raw, int *voltage) {
+  return _inner.caliRawToVoltage(handle, raw, voltage);
+}
+
+esp_err_t FaultInjectingDriver::continuousNew(adc_unit_t unit,
+                                              const ContinuousConfig &config,
+                                              adc_continuous_handle_t *handle) {
+  _stalled = false;
+  return _inner.continuousNew(unit, config, handle);
+}
+
+esp_err_t
+FaultInjectingDriver::continuousDeinit(adc_continuous_handle_t handle) {
+  return _inner.continuousDeinit(handle);
+}
+
+esp_err_t
+FaultInjectingDriver::continuousStart(adc_continuous_handle_t handle) {
+  return _inner.continuousStart(handle);
+}
+
+esp_err_t FaultInjectingDriver::continuousRead(adc_continuous_handle_t handle,
+                                               uint8_t *buffer, uint32_t length,
+                                               uint32_t *bytes_read,
+                                               uint32_t timeout_ms) {
+  *bytes_read = 0;
+  if (!_stalled && roll(_config.stall_rate)) {
+    _stats.stalls++;
+    _stalled = true;
+  }
+  if (_stalled) {
+    // the hardware keeps its pace (and the simulated time runs on), but no
+    // frame reaches the caller
+    _inner.continuousRead(handle, buffer, length, bytes_read, timeout_ms);
+    *bytes_read = 0;
+    return ESP_ERR_TIMEOUT;
+  }
+  if (roll(_config.read_error_rate)) {
+    _stats.read_errors++;
+    return ESP_FAIL;
+  }
+  if (roll(_config.read_timeout_rate)) {
+    // the data stays in the driver, only this poll comes back empty
+    _stats.read_timeouts++;
+    if (timeout_ms > 0) {
+      _inner.clock().delayMs(timeout_ms);
+    }
+    return ESP_ERR_TIMEOUT;
+  }
+  esp_err_t err =
+      _inner.continuousRead(handle, buffer, length, bytes_read, timeout_ms);
+  if (err != ESP_OK)
+    return err;
+  if (roll(_config.overflow_rate)) {
+    // the frames of this read are lost, as when the pool overflows
+    _stats.overflows++;
+    *bytes_read = 0;
+    return ESP_ERR_TIMEOUT;
+  }
+  if (_config.stuck_rate > 0.0f) {
+    for (uint32_t i = 0; i + 1 < *bytes_read; i += 2) {
+      if (roll(_config.stuck_rate)) {
+        _stats.stuck_samples++;
+        buffer[i] = _last_raw & 0xFF;
+        buffer[i + 1] = (buffer[i + 1] & 0xF0) | ((_last_raw >> 8) & 0x0F);
+      }
+      _last_raw = ((buffer[i + 1] << 8) | buffer[i]) & 0xFFF;
+    }
+  }
+  return ESP_OK;
+}
+
+esp_err_t FaultInjectingDriver::continuousStop(adc_continuous_handle_t handle) {
+  return _inner.continuousStop(handle);
+}
+
+uint32_t
+FaultInjectingDriver::continuousOverflows(adc_continuous_handle_t handle) {
+  return _inner.continuousOverflows(handle) + _stats.overflows;
+}
+
+Driver &defaultDriver() {
+#if defined(ESP_PLATFORM)
+  return IdfDriver::instance();
+#else
+  static VirtualClock clock;
+  static SimDriver driver(clock);
+  return driver;
+#endif
+}
+
+} // namespace ED_ADC
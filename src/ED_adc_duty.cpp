@@ -0,0 +1,101 @@
+#include "ED_adc_duty.h"
+#include "ED_adc_pm.h"
+
+namespace ED_ADC {
+
+DutyCycleSampler::DutyCycleSampler(ADCChannel &channel,
+                                   const DutyCycleConfig &config)
+    : DutyCycleSampler(channel, config, channel.clock()) {}
+
+DutyCycleSampler::DutyCycleSampler(ADCChannel &channel,
+                                   const DutyCycleConfig &config,
+                                   Clock &clock)
+    : _channel(channel), _config(config), _clock(clock) {
+  _batch.reserve(_config.batch_size);
+}
+
+esp_err_t DutyCycleSampler::run(uint32_t wakeup_count,
+                                const BatchCallback &callback,
+                                const CaptureOptions &options) {
+  const int64_t period_us = (int64_t)_config.period_ms * 1000;
+  int64_t next_wake_us = _clock.nowUs();
+  esp_err_t result = ESP_OK;
+
+  for (uint32_t wake = 0; wake < wakeup_count; wake++) {
+    const int64_t before_us = _clock.nowUs();
+    const int64_t sleep_us = next_wake_us - before_us;
+    if (sleep_us > 0) {
+      if (_config.light_sleep) {
+        _clock.lightSleepUs(sleep_us);
+      } else {
+        _clock.delayMs((sleep_us + 999) / 1000);
+      }
+    }
+    const int64_t woke_us = _clock.nowUs();
+    _counters.sleep_us += woke_us - before_us;
+    next_wake_us += period_us;
+
+    if (options.cancel && options.cancel->isCancelled()) {
+      result = ESP_ERR_INVALID_STATE;
+      break;
+    }
+    if (options.deadline_us > 0 && woke_us >= options.deadline_us) {
+      result = ESP_ERR_TIMEOUT;
+      break;
+    }
+
+    _counters.wakeups++;
+    {
+      PmLock::Guard pm_guard;
+      for (int i = 0; i < _config.burst_samples; i++) {
+        int voltage;
+        esp_err_t err = _channel.readVoltage(voltage);
+        pm_guard.sample();
+        if (err != ESP_OK) {
+          _counters.errors++;
+          continue;
+        }
+        _counters.samples++;
+        _batch.push_back(voltage);
+        if (_batch.size() >= _config.batch_size) {
+          _counters.batches++;
+          callback(_batch);
+          _batch.clear();
+        }
+      }
+    }
+    _counters.active_us += _clock.nowUs() - woke_us;
+  }
+
+  if (!_batch.empty()) {
+    _counters.batches++;
+    callback(_batch);
+    _batch.clear();
+  }
+  return result;
+}
+
+float DutyCycleSampler::totalEnergyUj(const EnergyModel &model) const {
+  // mA * us * V = nJ
+  float nj = model.supply_v *
+             (model.active_ma * _counters.active_us +
+              model.sleep_ma * _counters.sleep_us +
+              model.adc_ma * (float)_counters.samples * model.conversion_us);
+  return nj / 1000.0f;
+}
+
+float DutyCycleSampler::energyPerMeasurementUj(const EnergyModel &model) const {
+  if (_counters.samples == 0)
+    return 0.0f;
+  return totalEnergyUj(model) / _counters.samples;
+}
+
+float DutyCycleSampler::averageCurrentMa(const EnergyModel &model) const {
+  int64_t total_us = _counters.active_us + _counters.sleep_us;
+  if (total_us <= 0 || model.supply_v <= 0.0f)
+    return 0.0f;
+  // uJ / (V * us) = 1e-6 J / (V * 1e-6 s) = A -> * 1000 for mA
+  return totalEnergyUj(model) / (model.supply_v * total_us) * 1000.0f;
+}
+
+} // namespace ED_ADC
@@ -0,0 +1,205 @@
+#include "ED_adc_histogram.h"
+#include <algorithm>
+#include <cstring>
+
+namespace ED_ADC {
+
+namespace {
+const uint8_t MAGIC[4] = {'E', 'D', 'H', '1'};
+const size_t HEADER_SIZE = 8;
+
+/// @brief writes value as LEB128 at out + pos if it fits; advances pos
+/// either way, so the final pos is the size needed
+void putVarint(uint8_t *out, size_t size, size_t &pos, uint64_t value) {
+  do {
+    uint8_t byte = value & 0x7F;
+    value >>= 7;
+    if (value) {
+      byte |= 0x80;
+    }
+    if (pos < size) {
+      out[pos] = byte;
+    }
+    pos++;
+  } while (value);
+}
+
+bool getVarint(const uint8_t *data, size_t size, size_t &pos,
+               uint64_t &value) {
+  value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (pos >= size)
+      return false;
+    const uint8_t byte = data[pos++];
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+} // namespace
+
+CodeHistogram::CodeHistogram(HistogramUnit unit, uint16_t bin_width)
+    : _unit(unit),
+      _bin_width(unit == HistogramUnit::RawCode
+                     ? 1
+                     : std::max<uint16_t>(bin_width, 1)),
+      _bins(BINS, 0) {}
+
+void CodeHistogram::addCodes(const uint16_t *codes, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    increment(_bins[codes[i] & (BINS - 1)]);
+  }
+  _total += count;
+}
+
+esp_err_t CodeHistogram::merge(const CodeHistogram &other) {
+  if (other._unit != _unit || other._bin_width != _bin_width)
+    return ESP_ERR_INVALID_ARG;
+  for (size_t i = 0; i < BINS; i++) {
+    const uint64_t sum = (uint64_t)_bins[i] + other._bins[i];
+    _bins[i] = (uint32_t)std::min<uint64_t>(sum, UINT32_MAX);
+    _saturated += sum - _bins[i];
+  }
+  _total += other._total;
+  _clipped += other._clipped;
+  _saturated += other._saturated;
+  return ESP_OK;
+}
+
+void CodeHistogram::clear() {
+  std::fill(_bins.begin(), _bins.end(), 0);
+  _total = 0;
+  _clipped = 0;
+  _saturated = 0;
+}
+
+int CodeHistogram::minValue() const {
+  for (size_t i = 0; i < BINS; i++) {
+    if (_bins[i])
+      return binValue(i);
+  }
+  return 0;
+}
+
+int CodeHistogram::maxValue() const {
+  for (size_t i = BINS; i > 0; i--) {
+    if (_bins[i - 1])
+      return binValue(i - 1);
+  }
+  return 0;
+}
+
+double CodeHistogram::mean() const {
+  uint64_t n = 0;
+  double sum = 0;
+  for (size_t i = 0; i < BINS; i++) {
+    n += _bins[i];
+    sum += (double)_bins[i] * binValue(i);
+  }
+  if (n == 0)
+    return 0;
+  return sum / n + (_bin_width - 1) / 2.0;
+}
+
+int CodeHistogram::valueAtRank(uint64_t rank) const {
+  uint64_t seen = 0;
+  for (size_t i = 0; i < BINS; i++) {
+    seen += _bins[i];
+    if (seen > rank)
+      return binValue(i);
+  }
+  return maxValue();
+}
+
+int CodeHistogram::percentileWidth(int8_t percentile) const {
+  if (percentile < 10 || percentile > 90)
+    return 0;
+  // saturated bins make the counts disagree with _total
+  uint64_t n = 0;
+  for (size_t i = 0; i < BINS; i++) {
+    n += _bins[i];
+  }
+  if (n == 0)
+    return 0;
+  uint64_t lower, upper;
+  percentileRanks(n, percentile, lower, upper);
+  return valueAtRank(upper) - valueAtRank(lower);
+}
+
+size_t CodeHistogram::encode(uint8_t *out, size_t size) const {
+  const size_t needed = write(nullptr, 0);
+  if (needed <= size) {
+    write(out, size);
+  }
+  return needed;
+}
+
+size_t CodeHistogram::write(uint8_t *out, size_t size) const {
+  const uint8_t header[HEADER_SIZE] = {
+      MAGIC[0], MAGIC[1], MAGIC[2], MAGIC[3], (uint8_t)_unit, 0,
+      (uint8_t)(_bin_width & 0xFF), (uint8_t)(_bin_width >> 8)};
+  if (size >= HEADER_SIZE) {
+    memcpy(out, header, HEADER_SIZE);
+  }
+  size_t pos = HEADER_SIZE;
+  putVarint(out, size, pos, _clipped);
+  size_t bin = 0;
+  while (true) {
+    const size_t start = bin;
+    while (bin < BINS && _bins[bin] == 0) {
+      bin++;
+    }
+    if (bin == BINS)
+      break;
+    size_t run = 0;
+    while (bin + run < BINS && _bins[bin + run] != 0) {
+      run++;
+    }
+    putVarint(out, size, pos, bin - start);
+    putVarint(out, size, pos, run);
+    for (size_t i = 0; i < run; i++) {
+      putVarint(out, size, pos, _bins[bin + i]);
+    }
+    bin += run;
+  }
+  return pos;
+}
+
+bool CodeHistogram::decode(const uint8_t *data, size_t size,
+                           CodeHistogram &hist) {
+  hist.clear();
+  if (size < HEADER_SIZE || memcmp(data, MAGIC, sizeof(MAGIC)) != 0 ||
+      data[4] > (uint8_t)HistogramUnit::Millivolts)
+    return false;
+  hist._unit = (HistogramUnit)data[4];
+  hist._bin_width = std::max<uint16_t>(data[6] | (data[7] << 8), 1);
+
+  size_t pos = HEADER_SIZE;
+  uint64_t value;
+  if (!getVarint(data, size, pos, value))
+    return false;
+  hist._clipped = value;
+  size_t bin = 0;
+  while (pos < size) {
+    uint64_t skip, run;
+    if (!getVarint(data, size, pos, skip) ||
+        !getVarint(data, size, pos, run) || run == 0 || skip > BINS - bin ||
+        run > BINS - bin - skip) {
+      hist.clear();
+      return false;
+    }
+    bin += skip;
+    for (uint64_t i = 0; i < run; i++, bin++) {
+      if (!getVarint(data, size, pos, value) || value > UINT32_MAX) {
+        hist.clear();
+        return false;
+      }
+      hist._bins[bin] = (uint32_t)value;
+      hist._total += value;
+    }
+  }
+  return true;
+}
+
+} // namespace ED_ADC
@@ -0,0 +1,580 @@
+#include "ED_adc_log.h"
+#include "ED_adc_stream.h"
+#include <algorithm>
+#include <cstring>
+
+namespace ED_ADC {
+
+static inline const char *TAG = "ED_ADC";
+
+namespace {
+// smallest samples record worth starting in a partly filled page; smaller
+// remainders go to the next page instead of splitting a burst finely
+constexpr size_t MIN_SAMPLES_PER_RECORD = 16;
+constexpr size_t RESULT_PAYLOAD_SIZE = 8 * 4 + 2;
+
+void putLe(uint8_t *out, uint64_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    out[i] = (value >> (8 * i)) & 0xFF;
+  }
+}
+
+uint64_t getLe(const uint8_t *in, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value |= (uint64_t)in[i] << (8 * i);
+  }
+  return value;
+}
+
+size_t packedSize(size_t count) { return count / 2 * 3 + count % 2 * 2; }
+
+/// @brief codes that fit in a Samples payload of length bytes
+size_t samplesFitting(size_t length) {
+  if (length < 4)
+    return 0;
+  length -= 4;
+  return length / 3 * 2 + (length % 3 >= 2 ? 1 : 0);
+}
+
+void packCodes(const uint16_t *codes, size_t count, uint8_t *out) {
+  size_t i = 0;
+  for (; i + 1 < count; i += 2, out += 3) {
+    uint16_t a = codes[i] & 0xFFF;
+    uint16_t b = codes[i + 1] & 0xFFF;
+    out[0] = a & 0xFF;
+    out[1] = (a >> 8) | ((b & 0x0F) << 4);
+    out[2] = b >> 4;
+  }
+  if (i < count) {
+    out[0] = codes[i] & 0xFF;
+    out[1] = (codes[i] >> 8) & 0x0F;
+  }
+}
+
+enum class PageState { Valid, Empty, Corrupt };
+
+/// @brief checks the header and CRC of a page read back from storage
+PageState checkPage(const uint8_t *page, size_t page_size, uint32_t &sequence,
+                    size_t &used) {
+  if (getLe(page, 2) != LOG_PAGE_MAGIC) {
+    bool erased = std::all_of(page, page + LOG_PAGE_HEADER_SIZE,
+                              [](uint8_t b) { return b == 0xFF; });
+    return erased ? PageState::Empty : PageState::Corrupt;
+  }
+  used = getLe(&page[10], 2);
+  if (page[4] != LOG_VERSION || used < LOG_PAGE_HEADER_SIZE ||
+      used > page_size ||
+      streamCrc16(&page[4], used - 4) != getLe(&page[2], 2))
+    return PageState::Corrupt;
+  sequence = getLe(&page[6], 4);
+  return PageState::Valid;
+}
+
+/// @brief (sequence of page 0, segment) of the segments that start with a
+/// valid page, oldest first. Page sequences wrap around at 2^32, so they
+/// are ordered by their distance behind the newest one, which holds as long
+/// as the ring spans fewer than 2^31 pages.
+std::vector<std::pair<uint32_t, size_t>>
+segmentsInWriteOrder(LogStorage &storage, std::vector<uint8_t> &page) {
+  std::vector<std::pair<uint32_t, size_t>> order;
+  uint32_t newest = 0;
+  for (size_t s = 0; s < storage.segmentCount(); s++) {
+    uint32_t sequence = 0;
+    size_t used = 0;
+    if (storage.readPage(s, 0, page.data()) != ESP_OK ||
+        checkPage(page.data(), page.size(), sequence, used) !=
+            PageState::Valid)
+      continue;
+    if (order.empty() || (int32_t)(sequence - newest) > 0) {
+      newest = sequence;
+    }
+    order.emplace_back(sequence, s);
+  }
+  std::sort(order.begin(), order.end(),
+            [newest](const std::pair<uint32_t, size_t> &a,
+                     const std::pair<uint32_t, size_t> &b) {
+              return (uint32_t)(newest - a.first) >
+                     (uint32_t)(newest - b.first);
+            });
+  return order;
+}
+} // namespace
+
+// RamLogStorage implementations
+RamLogStorage::RamLogStorage(size_t segment_count, size_t pages_per_segment,
+                             size_t page_size)
+    : LogStorage(page_size, segment_count, pages_per_segment),
+      _data(segment_count * pages_per_segment * page_size, 0xFF) {}
+
+esp_err_t RamLogStorage::erase(size_t segment) {
+  if (segment >= _segment_count)
+    return ESP_ERR_INVALID_ARG;
+  const size_t size = _pages_per_segment * _page_size;
+  std::fill_n(_data.begin() + segment * size, size, 0xFF);
+  return ESP_OK;
+}
+
+esp_err_t RamLogStorage::writePage(size_t segment, size_t page,
+                                   const uint8_t *data) {
+  if (segment >= _segment_count || page >= _pages_per_segment)
+    return ESP_ERR_INVALID_ARG;
+  uint8_t *out = &_data[(segment * _pages_per_segment + page) * _page_size];
+  // like NOR flash, a write can only clear bits
+  for (size_t i = 0; i < _page_size; i++) {
+    out[i] &= data[i];
+  }
+  return ESP_OK;
+}
+
+esp_err_t RamLogStorage::readPage(size_t segment, size_t page,
+                                  uint8_t *data) {
+  if (segment >= _segment_count || page >= _pages_per_segment)
+    return ESP_ERR_INVALID_ARG;
+  memcpy(data, &_data[(segment * _pages_per_segment + page) * _page_size],
+         _page_size);
+  return ESP_OK;
+}
+
+// FileLogStorage implementations
+FileLogStorage::FileLogStorage(const char *path_prefix, size_t segment_count,
+                               size_t pages_per_segment, size_t page_size)
+    : LogStorage(page_size, segment_count, pages_per_segment),
+      _prefix(path_prefix) {}
+
+FileLogStorage::~FileLogStorage() {
+  if (_file) {
+    fclose(_file);
+  }
+}
+
+std::string FileLogStorage::path(size_t segment) const {
+  return _prefix + std::to_string(segment) + ".log";
+}
+
+esp_err_t FileLogStorage::erase(size_t segment) {
+  if (segment >= _segment_count)
+    return ESP_ERR_INVALID_ARG;
+  if (_file) {
+    fclose(_file);
+  }
+  // truncate, and keep the file open for the writes that follow
+  _file = fopen(path(segment).c_str(), "w+b");
+  _file_segment = segment;
+  if (!_file) {
+    ESP_LOGE(TAG, "FileLogStorage - Failed to open %s",
+             path(segment).c_str());
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+esp_err_t FileLogStorage::writePage(size_t segment, size_t page,
+                                    const uint8_t *data) {
+  if (segment >= _segment_count || page >= _pages_per_segment)
+    return ESP_ERR_INVALID_ARG;
+  if (!_file || _file_segment != segment) {
+    if (_file) {
+      fclose(_file);
+    }
+    _file = fopen(path(segment).c_str(), "r+b");
+    _file_segment = segment;
+    if (!_file)
+      return ESP_FAIL;
+  }
+  if (fseek(_file, (long)(page * _page_size), SEEK_SET) != 0 ||
+      fwrite(data, 1, _page_size, _file) != _page_size ||
+      fflush(_file) != 0)
+    return ESP_FAIL;
+  return ESP_OK;
+}
+
+esp_err_t FileLogStorage::readPage(size_t segment, size_t page,
+                                   uint8_t *data) {
+  if (segment >= _segment_count || page >= _pages_per_segment)
+    return ESP_ERR_INVALID_ARG;
+  memset(data, 0xFF, _page_size);
+  FILE *file = fopen(path(segment).c_str(), "rb");
+  if (!file)
+    return ESP_OK; // never written
+  if (fseek(file, (long)(page * _page_size), SEEK_SET) == 0) {
+    size_t got = fread(data, 1, _page_size, file);
+    if (got < _page_size) {
+      memset(data + got, 0xFF, _page_size - got);
+    }
+  }
+  fclose(file);
+  return ESP_OK;
+}
+
+#if defined(ESP_PLATFORM)
+// PartitionLogStorage implementations
+PartitionLogStorage::PartitionLogStorage(const esp_partition_t *partition,
+                                         size_t pages_per_segment)
+    : LogStorage(partition ? partition->erase_size : 4096,
+                 partition ? partition->size / (partition->erase_size *
+                                                pages_per_segment)
+                           : 0,
+                 pages_per_segment),
+      _partition(partition) {
+  if (!partition) {
+    ESP_LOGE(TAG, "PartitionLogStorage - no partition");
+  }
+}
+
+size_t PartitionLogStorage::offset(size_t segment, size_t page) const {
+  return (segment * _pages_per_segment + page) * _page_size;
+}
+
+esp_err_t PartitionLogStorage::erase(size_t segment) {
+  if (segment >= _segment_count)
+    return ESP_ERR_INVALID_ARG;
+  return esp_partition_erase_range(_partition, offset(segment, 0),
+                                   _pages_per_segment * _page_size);
+}
+
+esp_err_t PartitionLogStorage::writePage(size_t segment, size_t page,
+                                         const uint8_t *data) {
+  if (segment >= _segment_count || page >= _pages_per_segment)
+    return ESP_ERR_INVALID_ARG;
+  return esp_partition_write(_partition, offset(segment, page), data,
+                             _page_size);
+}
+
+esp_err_t PartitionLogStorage::readPage(size_t segment, size_t page,
+                                        uint8_t *data) {
+  if (segment >= _segment_count || page >= _pages_per_segment)
+    return ESP_ERR_INVALID_ARG;
+  return esp_partition_read(_partition, offset(segment, page), data,
+                            _page_size);
+}
+#endif
+
+// DataLogger implementations
+DataLogger::DataLogger(LogStorage &storage, const LoggerConfig &config)
+    : _storage(storage), _pages(std::max<size_t>(config.buffer_pages, 1)) {
+  for (Page &page : _pages) {
+    // allocated once: the log*() calls never allocate
+    page.data.resize(storage.pageSize());
+  }
+  resume();
+}
+
+DataLogger::~DataLogger() {
+#if defined(ESP_PLATFORM)
+  stopWriter();
+#endif
+}
+
+void DataLogger::resume() {
+  // the newest page is in the segment whose first page is the newest
+  std::vector<uint8_t> page(_storage.pageSize());
+  const std::vector<std::pair<uint32_t, size_t>> order =
+      segmentsInWriteOrder(_storage, page);
+  if (order.empty())
+    return;
+  const size_t newest_segment = order.back().second;
+  _page_sequence = order.back().first;
+  for (size_t p = 1; p < _storage.pagesPerSegment(); p++) {
+    uint32_t sequence = 0;
+    size_t used = 0;
+    if (_storage.readPage(newest_segment, p, page.data()) != ESP_OK ||
+        checkPage(page.data(), page.size(), sequence, used) !=
+            PageState::Valid)
+      break;
+    _page_sequence = sequence;
+  }
+  // pages after the newest one may be half written: start a fresh segment
+  _page_sequence++;
+  _segment = (newest_segment + 1) % _storage.segmentCount();
+  _next_page = 0;
+}
+
+size_t DataLogger::room() const {
+  if (!_open)
+    return 0;
+  size_t used = _pages[_fill].used + LOG_RECORD_HEADER_SIZE;
+  return used < _storage.pageSize() ? _storage.pageSize() - used : 0;
+}
+
+uint8_t *DataLogger::reserve(LogRecordType type, uint8_t channel_id,
+                             size_t length, int64_t t_us) {
+  const size_t size = LOG_RECORD_HEADER_SIZE + length;
+  if (size > _storage.pageSize() - LOG_PAGE_HEADER_SIZE) {
+    _dropped.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  if (_open && length > room()) {
+    seal();
+  }
+  if (!_open) {
+    if (_pages[_fill].ready.load(std::memory_order_acquire)) {
+      // the writer still owns this page: drop rather than wait
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    _pages[_fill].used = LOG_PAGE_HEADER_SIZE;
+    _open = true;
+  }
+
+  Page &page = _pages[_fill];
+  uint8_t *record = &page.data[page.used];
+  record[0] = (uint8_t)type;
+  record[1] = channel_id;
+  putLe(&record[2], length, 2);
+  putLe(&record[4], (uint64_t)t_us, 8);
+  page.used += size;
+  _records.fetch_add(1, std::memory_order_relaxed);
+  _logged_bytes.fetch_add(size, std::memory_order_relaxed);
+  return record + LOG_RECORD_HEADER_SIZE;
+}
+
+bool DataLogger::logResult(uint8_t channel_id, const ADCReadResult &result,
+                           int64_t t_us) {
+  uint8_t *out = reserve(LogRecordType::Result, channel_id,
+                         RESULT_PAYLOAD_SIZE, t_us);
+  if (!out)
+    return false;
+  const int32_t fields[8] = {result.average_mv,   result.min_mv,
+                             result.max_mv,       result.p30_width_mv,
+                             result.p60_width_mv, result.sample_count,
+                             result.error_count,  result.skipped_count};
+  for (int32_t field : fields) {
+    putLe(out, (uint32_t)field, 4);
+    out += 4;
+  }
+  out[0] = result.partial ? 1 : 0;
+  out[1] = (uint8_t)result.stop_reason;
+  return true;
+}
+
+size_t DataLogger::logSamples(uint8_t channel_id, const uint16_t *codes,
+                              size_t count, int64_t t_us,
+                              uint32_t sample_period_us) {
+  const size_t page_room =
+      _storage.pageSize() - LOG_PAGE_HEADER_SIZE - LOG_RECORD_HEADER_SIZE;
+  size_t logged = 0;
+  while (logged < count) {
+    size_t left = count - logged;
+    // fill the open page if a useful part of the burst fits, else a new one
+    size_t fits = samplesFitting(room());
+    if (fits < std::min(left, MIN_SAMPLES_PER_RECORD)) {
+      fits = samplesFitting(page_room);
+    }
+    size_t n = std::min(left, fits);
+    uint8_t *out = reserve(LogRecordType::Samples, channel_id,
+                           4 + packedSize(n),
+                           t_us + (int64_t)logged * sample_period_us);
+    if (!out)
+      break;
+    putLe(out, sample_period_us, 4);
+    packCodes(codes + logged, n, out + 4);
+    logged += n;
+  }
+  return logged;
+}
+
+bool DataLogger::append(LogRecordType type, uint8_t channel_id,
+                        const void *payload, size_t length, int64_t t_us) {
+  uint8_t *out = reserve(type, channel_id, length, t_us);
+  if (!out)
+    return false;
+  memcpy(out, payload, length);
+  return true;
+}
+
+void DataLogger::seal() {
+  if (!_open)
+    return;
+  _pages[_fill].ready.store(true, std::memory_order_release);
+  _fill = (_fill + 1) % _pages.size();
+  _open = false;
+  notifyWriter();
+}
+
+size_t DataLogger::pump() {
+  const size_t page_size = _storage.pageSize();
+  size_t written = 0;
+  while (_pages[_send].ready.load(std::memory_order_acquire)) {
+    Page &page = _pages[_send];
+    if (_next_page == 0) {
+      esp_err_t err = _storage.erase(_segment);
+      _erases.fetch_add(1, std::memory_order_relaxed);
+      if (err != ESP_OK) {
+        _write_errors.fetch_add(1, std::memory_order_relaxed);
+        ESP_LOGE(TAG, "DataLogger - Failed to erase segment %u: %s",
+                 (unsigned)_segment, esp_err_to_name(err));
+      }
+    }
+
+    // header and CRC are done here, off the capture path
+    uint8_t *data = page.data.data();
+    std::fill(data + page.used, data + page_size, 0xFF);
+    putLe(&data[0], LOG_PAGE_MAGIC, 2);
+    data[4] = LOG_VERSION;
+    data[5] = 0xFF;
+    putLe(&data[6], _page_sequence, 4);
+    putLe(&data[10], page.used, 2);
+    putLe(&data[2], streamCrc16(&data[4], page.used - 4), 2);
+
+    esp_err_t err = _storage.writePage(_segment, _next_page, data);
+    if (err != ESP_OK) {
+      _write_errors.fetch_add(1, std::memory_order_relaxed);
+      ESP_LOGE(TAG, "DataLogger - Failed to write page: %s",
+               esp_err_to_name(err));
+    }
+    _pages_written.fetch_add(1, std::memory_order_relaxed);
+    _page_sequence++;
+    if (++_next_page == _storage.pagesPerSegment()) {
+      _segment = (_segment + 1) % _storage.segmentCount();
+      _next_page = 0;
+    }
+
+    page.ready.store(false, std::memory_order_release);
+    _send = (_send + 1) % _pages.size();
+    written++;
+  }
+  return written;
+}
+
+void DataLogger::flush() {
+  seal();
+#if defined(ESP_PLATFORM)
+  if (_writer.isRunning()) {
+    notifyWriter();
+    while (std::any_of(_pages.begin(), _pages.end(), [](const Page &page) {
+      return page.ready.load(std::memory_order_acquire);
+    })) {
+      vTaskDelay(1);
+    }
+    return;
+  }
+#endif
+  pump();
+}
+
+LoggerStats DataLogger::stats() const {
+  LoggerStats stats = {};
+  stats.records = _records.load();
+  stats.dropped_records = _dropped.load();
+  stats.logged_bytes = _logged_bytes.load();
+  stats.pages_written = _pages_written.load();
+  stats.bytes_written = (uint64_t)stats.pages_written * _storage.pageSize();
+  stats.erases = _erases.load();
+  stats.write_errors = _write_errors.load();
+  if (stats.logged_bytes > 0) {
+    stats.write_amplification =
+        (float)stats.bytes_written / (float)stats.logged_bytes;
+  }
+  return stats;
+}
+
+#if defined(ESP_PLATFORM)
+esp_err_t DataLogger::startWriter(const TaskConfig &config) {
+  return _writer.start(config, [this] {
+    while (!_writer.stopRequested()) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      pump();
+    }
+  });
+}
+
+void DataLogger::stopWriter() { _writer.stop(); }
+
+void DataLogger::notifyWriter() { _writer.notify(); }
+#else
+void DataLogger::notifyWriter() {}
+#endif
+
+// LogReader implementations
+size_t LogReader::forEach(const Callback &callback) {
+  _stats = {};
+  const size_t page_size = _storage.pageSize();
+  std::vector<uint8_t> page(page_size);
+
+  size_t visited = 0;
+  for (const auto &entry : segmentsInWriteOrder(_storage, page)) {
+    for (size_t p = 0; p < _storage.pagesPerSegment(); p++) {
+      uint32_t sequence = 0;
+      size_t used = 0;
+      if (_storage.readPage(entry.second, p, page.data()) != ESP_OK)
+        break;
+      PageState state = checkPage(page.data(), page_size, sequence, used);
+      if (state == PageState::Empty)
+        break;
+      if (state == PageState::Corrupt) {
+        _stats.corrupt_pages++;
+        continue;
+      }
+      _stats.pages++;
+
+      size_t offset = LOG_PAGE_HEADER_SIZE;
+      while (offset + LOG_RECORD_HEADER_SIZE <= used) {
+        const uint8_t *in = &page[offset];
+        LogRecord record;
+        record.type = (LogRecordType)in[0];
+        record.channel_id = in[1];
+        record.length = getLe(&in[2], 2);
+        record.t_us = (int64_t)getLe(&in[4], 8);
+        record.payload = in + LOG_RECORD_HEADER_SIZE;
+        offset += LOG_RECORD_HEADER_SIZE + record.length;
+        if (offset > used)
+          break;
+        _stats.records++;
+        visited++;
+        if (callback) {
+          callback(record);
+        }
+      }
+    }
+  }
+  return visited;
+}
+
+bool LogReader::decodeResult(const LogRecord &record, ADCReadResult &result) {
+  if (record.type != LogRecordType::Result ||
+      record.length < RESULT_PAYLOAD_SIZE)
+    return false;
+  const uint8_t *in = record.payload;
+  int32_t fields[8];
+  for (int32_t &field : fields) {
+    field = (int32_t)getLe(in, 4);
+    in += 4;
+  }
+  result = {};
+  result.average_mv = fields[0];
+  result.min_mv = fields[1];
+  result.max_mv = fields[2];
+  result.p30_width_mv = fields[3];
+  result.p60_width_mv = fields[4];
+  result.sample_count = fields[5];
+  result.error_count = fields[6];
+  result.skipped_count = fields[7];
+  result.partial = in[0] != 0;
+  result.stop_reason = (StopReason)in[1];
+  return true;
+}
+
+size_t LogReader::decodeSamples(const LogRecord &record,
+                                std::vector<uint16_t> &codes,
+                                uint32_t *sample_period_us) {
+  if (record.type != LogRecordType::Samples || record.length < 4)
+    return 0;
+  if (sample_period_us) {
+    *sample_period_us = getLe(record.payload, 4);
+  }
+  const uint8_t *in = record.payload + 4;
+  const size_t bytes = record.length - 4;
+  const size_t count = bytes / 3 * 2 + (bytes % 3 == 2 ? 1 : 0);
+  size_t i = 0;
+  for (; i + 1 < count; i += 2, in += 3) {
+    codes.push_back(in[0] | ((in[1] & 0x0F) << 8));
+    codes.push_back((in[1] >> 4) | (in[2] << 4));
+  }
+  if (i < count) {
+    codes.push_back(in[0] | ((in[1] & 0x0F) << 8));
+  }
+  return count;
+}
+
+} // namespace ED_ADC
@@ -0,0 +1,62 @@
+#include "ED_adc_memory.h"
+
+namespace ED_ADC {
+
+namespace {
+void raiseTo(std::atomic<size_t> &value, size_t candidate) {
+  size_t seen = value.load(std::memory_order_relaxed);
+  while (seen < candidate &&
+         !value.compare_exchange_weak(seen, candidate,
+                                      std::memory_order_relaxed)) {
+  }
+}
+} // namespace
+
+bool MemoryTracker::acquire(size_t bytes) {
+  const size_t limit = _limit.load(std::memory_order_relaxed);
+  size_t current = _current.load(std::memory_order_relaxed);
+  do {
+    if (limit > 0 && current + bytes > limit) {
+      _refused.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+  } while (!_current.compare_exchange_weak(current, current + bytes,
+                                           std::memory_order_relaxed));
+
+  if (_parent && !_parent->acquire(bytes)) {
+    _current.fetch_sub(bytes, std::memory_order_relaxed);
+    _refused.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  raiseTo(_peak, current + bytes);
+  raiseTo(_largest, bytes);
+  _allocations.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void MemoryTracker::release(size_t bytes) {
+  _current.fetch_sub(bytes, std::memory_order_relaxed);
+  if (_parent) {
+    _parent->release(bytes);
+  }
+}
+
+MemoryStats MemoryTracker::stats() const {
+  MemoryStats stats = {};
+  stats.current_bytes = _current.load();
+  stats.peak_bytes = _peak.load();
+  stats.largest_allocation = _largest.load();
+  stats.allocations = _allocations.load();
+  stats.refused = _refused.load();
+  stats.limit_bytes = _limit.load();
+  return stats;
+}
+
+void MemoryTracker::resetStats() {
+  _peak.store(_current.load());
+  _largest.store(0);
+  _allocations.store(0);
+  _refused.store(0);
+}
+
+} // namespace ED_ADC
@@ -0,0 +1,366 @@
+#include "ED_adc_metrics.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#if defined(ESP_PLATFORM)
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#else
+#include <thread>
+#endif
+
+namespace ED_ADC {
+
+namespace {
+constexpr uint8_t METRICS_VERSION = 1;
+constexpr size_t BINARY_HEADER_SIZE = 5;
+constexpr size_t BINARY_CHANNEL_SIZE = METRICS_NAME_SIZE + 6 * 4 + 7 * 8 +
+                                       METRICS_LATENCY_BUCKETS * 4 + 8 + 8;
+
+/// @brief snprintf() that appends to a fixed buffer and keeps counting once
+/// it is full, so the caller learns the size it needs
+class TextWriter {
+public:
+  TextWriter(char *buffer, size_t size) : _buffer(buffer), _size(size) {
+    if (_size > 0) {
+      _buffer[0] = '\0';
+    }
+  }
+
+  void print(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+    va_list args;
+    va_start(args, format);
+    char *out = _length < _size ? _buffer + _length : nullptr;
+    size_t room = _length < _size ? _size - _length : 0;
+    int n = vsnprintf(out, room, format, args);
+    va_end(args);
+    if (n > 0) {
+      _length += n;
+    }
+  }
+
+  size_t length() const { return _length; }
+
+private:
+  char *_buffer;
+  size_t _size;
+  size_t _length = 0;
+};
+
+/// @brief one Prometheus metric family taken from ChannelMetrics
+struct Family {
+  const char *name;
+  const char *type;
+  const char *help;
+  int64_t (*value)(const ChannelMetrics &metrics);
+};
+
+const Family FAMILIES[] = {
+    {"ed_adc_last_mv", "gauge", "Latest voltage reading",
+     [](const ChannelMetrics &m) -> int64_t { return m.last_mv; }},
+    {"ed_adc_average_mv", "gauge", "Average of the latest read",
+     [](const ChannelMetrics &m) -> int64_t { return m.average_mv; }},
+    {"ed_adc_min_mv", "gauge", "Minimum of the latest read",
+     [](const ChannelMetrics &m) -> int64_t { return m.min_mv; }},
+    {"ed_adc_max_mv", "gauge", "Maximum of the latest read",
+     [](const ChannelMetrics &m) -> int64_t { return m.max_mv; }},
+    {"ed_adc_p30_width_mv", "gauge", "P30 width of the latest read",
+     [](const ChannelMetrics &m) -> int64_t { return m.p30_width_mv; }},
+    {"ed_adc_p60_width_mv", "gauge", "P60 width of the latest read",
+     [](const ChannelMetrics &m) -> int64_t { return m.p60_width_mv; }},
+    {"ed_adc_reads_total", "counter", "Read results recorded",
+     [](const ChannelMetrics &m) -> int64_t { return m.reads; }},
+    {"ed_adc_partial_reads_total", "counter", "Reads stopped early",
+     [](const ChannelMetrics &m) -> int64_t { return m.partial_reads; }},
+    {"ed_adc_samples_total", "counter", "Samples converted",
+     [](const ChannelMetrics &m) -> int64_t { return m.samples; }},
+    {"ed_adc_errors_total", "counter", "Failed conversions and reads",
+     [](const ChannelMetrics &m) -> int64_t { return m.errors; }},
+    {"ed_adc_skipped_total", "counter", "Samples given up after retries",
+     [](const ChannelMetrics &m) -> int64_t { return m.skipped; }},
+    {"ed_adc_overflows_total", "counter", "Continuous-mode pool overflows",
+     [](const ChannelMetrics &m) -> int64_t { return m.overflows; }},
+    {"ed_adc_recoveries_total", "counter", "Continuous-mode restarts",
+     [](const ChannelMetrics &m) -> int64_t { return m.recoveries; }},
+};
+
+uint8_t *putLe(uint8_t *out, uint64_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    out[i] = (value >> (8 * i)) & 0xFF;
+  }
+  return out + bytes;
+}
+
+uint64_t getLe(const uint8_t *&in, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value |= (uint64_t)in[i] << (8 * i);
+  }
+  in += bytes;
+  return value;
+}
+
+/// @brief lets a preempted writer finish; on a single core a reader with a
+/// higher priority would otherwise spin forever
+void backOff(int attempt) {
+  if (attempt < 8)
+    return;
+#if defined(ESP_PLATFORM)
+  vTaskDelay(1);
+#else
+  std::this_thread::yield();
+#endif
+}
+} // namespace
+
+MetricsRegistry::MetricsRegistry(size_t capacity)
+    : _slots(std::min<size_t>(capacity, 255)), _render(_slots.size()) {}
+
+int MetricsRegistry::addChannel(const char *name) {
+  size_t id = _count.load(std::memory_order_relaxed);
+  if (id >= _slots.size())
+    return -1;
+  strncpy(_slots[id].name, name ? name : "", METRICS_NAME_SIZE - 1);
+  // publish the slot only once its name is set
+  _count.store(id + 1, std::memory_order_release);
+  return (int)id;
+}
+
+MetricsRegistry::Slot *MetricsRegistry::slot(int id) {
+  if (id < 0 || (size_t)id >= _count.load(std::memory_order_acquire))
+    return nullptr;
+  return &_slots[id];
+}
+
+const MetricsRegistry::Slot *MetricsRegistry::slot(int id) const {
+  return const_cast<MetricsRegistry *>(this)->slot(id);
+}
+
+void MetricsRegistry::beginWrite(Slot &slot) {
+  slot.sequence.fetch_add(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void MetricsRegistry::endWrite(Slot &slot) {
+  slot.sequence.fetch_add(1, std::memory_order_release);
+}
+
+void MetricsRegistry::recordValue(int id, int voltage_mv) {
+  Slot *s = slot(id);
+  if (!s)
+    return;
+  beginWrite(*s);
+  s->metrics.last_mv = voltage_mv;
+  s->metrics.samples++;
+  endWrite(*s);
+}
+
+void MetricsRegistry::recordRead(int id, const ADCReadResult &result,
+                                 int64_t latency_us) {
+  Slot *s = slot(id);
+  if (!s)
+    return;
+  size_t bucket = 0;
+  while (bucket < METRICS_LATENCY_BUCKETS - 1 &&
+         latency_us > METRICS_LATENCY_BOUNDS_US[bucket]) {
+    bucket++;
+  }
+
+  beginWrite(*s);
+  ChannelMetrics &m = s->metrics;
+  if (result.sample_count > 0) {
+    m.last_mv = result.average_mv;
+    m.average_mv = result.average_mv;
+    m.min_mv = result.min_mv;
+    m.max_mv = result.max_mv;
+    m.p30_width_mv = result.p30_width_mv;
+    m.p60_width_mv = result.p60_width_mv;
+  }
+  m.reads++;
+  m.partial_reads += result.partial ? 1 : 0;
+  m.samples += result.sample_count;
+  m.errors += result.error_count;
+  m.skipped += result.skipped_count;
+  m.latency_buckets[bucket]++;
+  m.latency_count++;
+  m.latency_sum_us += latency_us;
+  endWrite(*s);
+}
+
+void MetricsRegistry::recordCapture(int id, const CaptureInfo &info) {
+  Slot *s = slot(id);
+  if (!s)
+    return;
+  beginWrite(*s);
+  s->metrics.samples += info.samples;
+  s->metrics.errors += info.read_errors;
+  s->metrics.overflows += info.overflows;
+  s->metrics.recoveries += info.recoveries;
+  endWrite(*s);
+}
+
+void MetricsRegistry::recordErrors(int id, uint32_t errors) {
+  Slot *s = slot(id);
+  if (!s)
+    return;
+  beginWrite(*s);
+  s->metrics.errors += errors;
+  endWrite(*s);
+}
+
+void MetricsRegistry::reset(int id) {
+  Slot *s = slot(id);
+  if (!s)
+    return;
+  beginWrite(*s);
+  s->metrics = {};
+  endWrite(*s);
+}
+
+bool MetricsRegistry::snapshot(int id, ChannelMetrics &metrics) const {
+  const Slot *s = slot(id);
+  if (!s)
+    return false;
+  for (int attempt = 0;; attempt++) {
+    uint32_t before = s->sequence.load(std::memory_order_acquire);
+    if (before & 1) {
+      backOff(attempt); // a writer is mid-update
+      continue;
+    }
+    metrics = s->metrics;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (s->sequence.load(std::memory_order_relaxed) == before)
+      return true;
+    backOff(attempt);
+  }
+}
+
+size_t MetricsRegistry::snapshotAll() const {
+  size_t count = _count.load(std::memory_order_acquire);
+  for (size_t id = 0; id < count; id++) {
+    snapshot((int)id, _render[id]);
+  }
+  return count;
+}
+
+size_t MetricsRegistry::renderPrometheus(char *buffer, size_t size) const {
+  const size_t count = snapshotAll();
+  TextWriter out(buffer, size);
+
+  for (const Family &family : FAMILIES) {
+    out.print("# HELP %s %s\n# TYPE %s %s\n", family.name, family.help,
+              family.name, family.type);
+    for (size_t id = 0; id < count; id++) {
+      out.print("%s{channel=\"%s\"} %" PRId64 "\n", family.name,
+                _slots[id].name, family.value(_render[id]));
+    }
+  }
+
+  const char *latency = "ed_adc_read_latency_us";
+  out.print("# HELP %s Duration of read() calls\n# TYPE %s histogram\n",
+            latency, latency);
+  for (size_t id = 0; id < count; id++) {
+    const ChannelMetrics &m = _render[id];
+    const char *name = _slots[id].name;
+    uint64_t cumulative = 0;
+    for (size_t b = 0; b < METRICS_LATENCY_BUCKETS; b++) {
+      cumulative += m.latency_buckets[b];
+      if (b < METRICS_LATENCY_BUCKETS - 1) {
+        out.print("%s_bucket{channel=\"%s\",le=\"%" PRId64 "\"} %" PRIu64
+                  "\n",
+                  latency, name, METRICS_LATENCY_BOUNDS_US[b], cumulative);
+      } else {
+        out.print("%s_bucket{channel=\"%s\",le=\"+Inf\"} %" PRIu64 "\n",
+                  latency, name, cumulative);
+      }
+    }
+    out.print("%s_sum{channel=\"%s\"} %" PRId64 "\n", latency, name,
+              m.latency_sum_us);
+    out.print("%s_count{channel=\"%s\"} %" PRIu64 "\n", latency, name,
+              m.latency_count);
+  }
+  return out.length();
+}
+
+size_t MetricsRegistry::binarySize() const {
+  return BINARY_HEADER_SIZE +
+         _count.load(std::memory_order_acquire) * BINARY_CHANNEL_SIZE;
+}
+
+size_t MetricsRegistry::renderBinary(uint8_t *buffer, size_t size) const {
+  const size_t count = snapshotAll();
+  const size_t needed = BINARY_HEADER_SIZE + count * BINARY_CHANNEL_SIZE;
+  if (size < needed)
+    return 0;
+
+  uint8_t *out = buffer;
+  *out++ = 'E';
+  *out++ = 'D';
+  *out++ = 'M';
+  *out++ = METRICS_VERSION;
+  *out++ = (uint8_t)count;
+  for (size_t id = 0; id < count; id++) {
+    const ChannelMetrics &m = _render[id];
+    memcpy(out, _slots[id].name, METRICS_NAME_SIZE);
+    out += METRICS_NAME_SIZE;
+    for (int32_t gauge : {m.last_mv, m.average_mv, m.min_mv, m.max_mv,
+                          m.p30_width_mv, m.p60_width_mv}) {
+      out = putLe(out, (uint32_t)gauge, 4);
+    }
+    for (uint64_t counter : {m.reads, m.partial_reads, m.samples, m.errors,
+                             m.skipped, m.overflows, m.recoveries}) {
+      out = putLe(out, counter, 8);
+    }
+    for (uint32_t bucket : m.latency_buckets) {
+      out = putLe(out, bucket, 4);
+    }
+    out = putLe(out, m.latency_count, 8);
+    out = putLe(out, (uint64_t)m.latency_sum_us, 8);
+  }
+  return needed;
+}
+
+int MetricsRegistry::parseBinary(
+    const uint8_t *data, size_t size,
+    const std::function<void(const char *name, const ChannelMetrics &)>
+        &callback) {
+  if (size < BINARY_HEADER_SIZE || memcmp(data, "EDM", 3) != 0 ||
+      data[3] != METRICS_VERSION)
+    return -1;
+  const size_t count = data[4];
+  if (size < BINARY_HEADER_SIZE + count * BINARY_CHANNEL_SIZE)
+    return -1;
+
+  const uint8_t *in = data + BINARY_HEADER_SIZE;
+  for (size_t id = 0; id < count; id++) {
+    char name[METRICS_NAME_SIZE];
+    memcpy(name, in, METRICS_NAME_SIZE);
+    name[METRICS_NAME_SIZE - 1] = '\0';
+    in += METRICS_NAME_SIZE;
+
+    ChannelMetrics m = {};
+    for (int32_t *gauge : {&m.last_mv, &m.average_mv, &m.min_mv, &m.max_mv,
+                           &m.p30_width_mv, &m.p60_width_mv}) {
+      *gauge = (int32_t)getLe(in, 4);
+    }
+    for (uint64_t *counter :
+         {&m.reads, &m.partial_reads, &m.samples, &m.errors, &m.skipped,
+          &m.overflows, &m.recoveries}) {
+      *counter = getLe(in, 8);
+    }
+    for (uint32_t &bucket : m.latency_buckets) {
+      bucket = getLe(in, 4);
+    }
+    m.latency_count = getLe(in, 8);
+    m.latency_sum_us = (int64_t)getLe(in, 8);
+    if (callback) {
+      callback(name, m);
+    }
+  }
+  return (int)count;
+}
+
+} // namespace ED_ADC
@@ -0,0 +1,125 @@
+#include "ED_adc_pm.h"
+
+#if ED_ADC_HAS_PM_LOCK
+#include "esp_private/esp_clk.h"
+#endif
+
+namespace ED_ADC {
+
+#if ED_ADC_HAS_PM_LOCK
+static inline const char *TAG = "ED_ADC";
+#endif
+
+PmLock &PmLock::instance() {
+  static PmLock lock;
+  return lock;
+}
+
+esp_err_t PmLock::enable(bool enabled) {
+#if ED_ADC_HAS_PM_LOCK
+  if (enabled && !_handle) {
+    esp_err_t err =
+        esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "ed_adc", &_handle);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "PmLock - Failed to create pm lock: %s",
+               esp_err_to_name(err));
+      _handle = nullptr;
+      return err;
+    }
+  }
+#endif
+  _enabled = enabled;
+  return ESP_OK;
+}
+
+PmLockStats PmLock::stats() const {
+  PmLockStats stats;
+  stats.captures = _captures;
+  stats.locked_captures = _locked_captures;
+  stats.protected_captures = _protected_captures;
+  stats.freq_changes_observed = _freq_changes_observed;
+  return stats;
+}
+
+bool PmLock::acquire() {
+  _captures++;
+  if (!_enabled)
+    return false;
+#if ED_ADC_HAS_PM_LOCK
+  if (esp_pm_lock_acquire(_handle) != ESP_OK)
+    return false;
+#endif
+  _locked_captures++;
+  if (dfsActive()) {
+    _protected_captures++;
+  }
+  return true;
+}
+
+void PmLock::release() {
+#if ED_ADC_HAS_PM_LOCK
+  esp_pm_lock_release(_handle);
+#endif
+}
+
+uint32_t PmLock::apbFreqHz() {
+#if ED_ADC_HAS_PM_LOCK
+  // the clock the ADC digital controller runs from
+  return esp_clk_apb_freq();
+#else
+  return 0;
+#endif
+}
+
+bool PmLock::dfsActive() {
+#if ED_ADC_HAS_PM_LOCK
+  esp_pm_config_t config = {};
+  if (esp_pm_get_configuration(&config) != ESP_OK)
+    return false;
+  return config.min_freq_mhz < config.max_freq_mhz;
+#else
+  return false;
+#endif
+}
+
+// PmLock::Guard implementations
+PmLock::Guard::Guard() {
+  PmLock &lock = instance();
+  _tracking = lock.isEnabled();
+  _locked = lock.acquire();
+  _apb_hz = apbFreqHz();
+}
+
+PmLock::Guard::Guard(Guard &&other) noexcept
+    : _active(other._active), _locked(other._locked),
+      _tracking(other._tracking), _changed(other._changed),
+      _apb_hz(other._apb_hz) {
+  other._active = false;
+}
+
+PmLock::Guard::~Guard() { release(); }
+
+void PmLock::Guard::release() {
+  if (!_active)
+    return;
+  check();
+  _active = false;
+  if (_locked) {
+    instance().release();
+  }
+}
+
+void PmLock::Guard::check() {
+  if (!_active)
+    return;
+  const uint32_t apb_hz = apbFreqHz();
+  if (apb_hz == _apb_hz)
+    return;
+  _apb_hz = apb_hz;
+  if (!_changed) {
+    _changed = true;
+    instance()._freq_changes_observed++;
+  }
+}
+
+} // namespace ED_ADC
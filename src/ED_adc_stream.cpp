@@ -0,0 +1,325 @@
+#include "ED_adc_stream.h"
+#include <algorithm>
+
+namespace ED_ADC {
+
+static inline const char *TAG = "ED_ADC";
+
+namespace {
+// longest accepted COBS frame; well above any packet a streamer produces
+constexpr size_t MAX_FRAME_SIZE = 16384;
+
+void putLe(uint8_t *out, uint64_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    out[i] = (value >> (8 * i)) & 0xFF;
+  }
+}
+
+uint64_t getLe(const uint8_t *in, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value |= (uint64_t)in[i] << (8 * i);
+  }
+  return value;
+}
+
+size_t packedSize(size_t count) { return count / 2 * 3 + count % 2 * 2; }
+} // namespace
+
+uint16_t streamCrc16(const uint8_t *data, size_t length) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+size_t cobsEncode(const uint8_t *data, size_t length, uint8_t *out) {
+  size_t write = 1;
+  size_t code_index = 0;
+  uint8_t code = 1;
+  for (size_t read = 0; read < length; read++) {
+    if (data[read] == 0) {
+      out[code_index] = code;
+      code = 1;
+      code_index = write++;
+      continue;
+    }
+    out[write++] = data[read];
+    if (++code == 0xFF) {
+      out[code_index] = code;
+      code = 1;
+      code_index = write++;
+    }
+  }
+  out[code_index] = code;
+  return write;
+}
+
+size_t cobsDecode(const uint8_t *data, size_t length, uint8_t *out) {
+  size_t read = 0;
+  size_t write = 0;
+  while (read < length) {
+    uint8_t code = data[read++];
+    if (code == 0 || read + code - 1 > length)
+      return 0;
+    for (uint8_t i = 1; i < code; i++) {
+      out[write++] = data[read++];
+    }
+    if (code < 0xFF && read < length) {
+      out[write++] = 0;
+    }
+  }
+  return write;
+}
+
+// transports
+esp_err_t FileTransport::write(const uint8_t *data, size_t length) {
+  if (!_file)
+    return ESP_ERR_INVALID_STATE;
+  if (fwrite(data, 1, length, _file) != length)
+    return ESP_FAIL;
+  return ESP_OK;
+}
+
+esp_err_t MemoryTransport::write(const uint8_t *data, size_t length) {
+  _data.insert(_data.end(), data, data + length);
+  return ESP_OK;
+}
+
+// SampleStreamer implementations
+SampleStreamer::SampleStreamer(ByteTransport &transport,
+                               const StreamConfig &config)
+    : _transport(transport), _config(config) {
+  _config.samples_per_packet = std::max<uint16_t>(config.samples_per_packet, 1);
+  const size_t packet_size = STREAM_HEADER_SIZE +
+                             packedSize(_config.samples_per_packet) +
+                             STREAM_CRC_SIZE;
+  for (Slot &slot : _slots) {
+    // allocated once: push() never allocates
+    slot.packet.reserve(packet_size);
+    slot.frame.resize(packet_size + packet_size / 254 + 2);
+  }
+}
+
+SampleStreamer::~SampleStreamer() {
+#if defined(ESP_PLATFORM)
+  stopSender();
+#endif
+}
+
+size_t SampleStreamer::push(const uint16_t *codes, size_t count,
+                            int64_t t_us) {
+  size_t accepted = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (!_open) {
+      if (_slots[_fill].ready.load(std::memory_order_acquire)) {
+        // the sender still owns this buffer: drop rather than wait
+        _gap = true;
+        _dropped.fetch_add(count - i, std::memory_order_relaxed);
+        break;
+      }
+      begin(t_us + (int64_t)i * _config.sample_period_us);
+    }
+
+    std::vector<uint8_t> &packet = _slots[_fill].packet;
+    uint16_t code = codes[i] & 0xFFF;
+    if (_pending_code < 0) {
+      _pending_code = code;
+    } else {
+      packet.push_back(_pending_code & 0xFF);
+      packet.push_back((_pending_code >> 8) | ((code & 0x0F) << 4));
+      packet.push_back(code >> 4);
+      _pending_code = -1;
+    }
+    accepted++;
+    if (++_in_packet == _config.samples_per_packet) {
+      finish();
+    }
+  }
+  return accepted;
+}
+
+void SampleStreamer::begin(int64_t t_us) {
+  if (_gap) {
+    // let the decoder count the dropped data as a lost packet
+    _sequence++;
+    _gap = false;
+  }
+  std::vector<uint8_t> &packet = _slots[_fill].packet;
+  packet.resize(STREAM_HEADER_SIZE);
+  packet[0] = STREAM_VERSION;
+  packet[1] = _config.channel_id;
+  putLe(&packet[2], _sequence, 2);
+  putLe(&packet[4], (uint64_t)t_us, 8);
+  putLe(&packet[12], _config.sample_period_us, 4);
+  _in_packet = 0;
+  _pending_code = -1;
+  _open = true;
+}
+
+void SampleStreamer::finish() {
+  Slot &slot = _slots[_fill];
+  std::vector<uint8_t> &packet = slot.packet;
+  if (_pending_code >= 0) {
+    packet.push_back(_pending_code & 0xFF);
+    packet.push_back(_pending_code >> 8);
+    _pending_code = -1;
+  }
+  putLe(&packet[16], _in_packet, 2);
+  uint16_t crc = streamCrc16(packet.data(), packet.size());
+  packet.push_back(crc & 0xFF);
+  packet.push_back(crc >> 8);
+
+  size_t length = cobsEncode(packet.data(), packet.size(), slot.frame.data());
+  slot.frame[length] = 0x00;
+  slot.frame.resize(length + 1); // capacity is kept
+  slot.ready.store(true, std::memory_order_release);
+
+  _samples.fetch_add(_in_packet, std::memory_order_relaxed);
+  _sequence++;
+  _open = false;
+  _fill ^= 1;
+  notifySender();
+}
+
+void SampleStreamer::seal() {
+  if (_open && _in_packet > 0) {
+    finish();
+  }
+}
+
+size_t SampleStreamer::pump() {
+  size_t written = 0;
+  while (_slots[_send].ready.load(std::memory_order_acquire)) {
+    Slot &slot = _slots[_send];
+    esp_err_t err = _transport.write(slot.frame.data(), slot.frame.size());
+    if (err != ESP_OK) {
+      _write_errors.fetch_add(1, std::memory_order_relaxed);
+      ESP_LOGW(TAG, "SampleStreamer - write failed: %s", esp_err_to_name(err));
+    } else {
+      _bytes.fetch_add(slot.frame.size(), std::memory_order_relaxed);
+    }
+    _packets.fetch_add(1, std::memory_order_relaxed);
+    slot.frame.resize(slot.frame.capacity());
+    slot.ready.store(false, std::memory_order_release);
+    _send ^= 1;
+    written++;
+  }
+  return written;
+}
+
+void SampleStreamer::flush() {
+  seal();
+#if defined(ESP_PLATFORM)
+  if (_sender.isRunning()) {
+    notifySender();
+    while (_slots[0].ready.load() || _slots[1].ready.load()) {
+      vTaskDelay(1);
+    }
+    return;
+  }
+#endif
+  pump();
+}
+
+StreamStats SampleStreamer::stats() const {
+  StreamStats stats = {};
+  stats.packets = _packets.load();
+  stats.samples = _samples.load();
+  stats.bytes = _bytes.load();
+  stats.dropped_samples = _dropped.load();
+  stats.write_errors = _write_errors.load();
+  return stats;
+}
+
+#if defined(ESP_PLATFORM)
+esp_err_t SampleStreamer::startSender(const TaskConfig &config) {
+  return _sender.start(config, [this] {
+    while (!_sender.stopRequested()) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      pump();
+    }
+  });
+}
+
+void SampleStreamer::stopSender() { _sender.stop(); }
+
+void SampleStreamer::notifySender() { _sender.notify(); }
+#else
+void SampleStreamer::notifySender() {}
+#endif
+
+// StreamDecoder implementations
+StreamDecoder::StreamDecoder(Callback callback)
+    : _callback(std::move(callback)) {}
+
+void StreamDecoder::feed(const uint8_t *data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    if (data[i] != 0x00) {
+      if (_frame.size() < MAX_FRAME_SIZE) {
+        _frame.push_back(data[i]);
+      }
+      continue;
+    }
+    if (!_frame.empty()) {
+      decodeFrame();
+      _frame.clear();
+    }
+  }
+}
+
+void StreamDecoder::decodeFrame() {
+  if (_frame.size() >= MAX_FRAME_SIZE) {
+    _stats.framing_errors++;
+    return;
+  }
+  _packet.resize(_frame.size());
+  size_t length = cobsDecode(_frame.data(), _frame.size(), _packet.data());
+  if (length < STREAM_HEADER_SIZE + STREAM_CRC_SIZE ||
+      _packet[0] != STREAM_VERSION) {
+    _stats.framing_errors++;
+    return;
+  }
+  const size_t body = length - STREAM_CRC_SIZE;
+  if (streamCrc16(_packet.data(), body) != getLe(&_packet[body], 2)) {
+    _stats.crc_errors++;
+    return;
+  }
+  const size_t count = getLe(&_packet[16], 2);
+  if (STREAM_HEADER_SIZE + packedSize(count) != body) {
+    _stats.framing_errors++;
+    return;
+  }
+
+  _decoded.channel_id = _packet[1];
+  _decoded.sequence = getLe(&_packet[2], 2);
+  _decoded.timestamp_us = (int64_t)getLe(&_packet[4], 8);
+  _decoded.sample_period_us = getLe(&_packet[12], 4);
+  _decoded.samples.resize(count);
+  const uint8_t *in = &_packet[STREAM_HEADER_SIZE];
+  size_t i = 0;
+  for (; i + 1 < count; i += 2, in += 3) {
+    _decoded.samples[i] = in[0] | ((in[1] & 0x0F) << 8);
+    _decoded.samples[i + 1] = (in[1] >> 4) | (in[2] << 4);
+  }
+  if (i < count) {
+    _decoded.samples[i] = in[0] | ((in[1] & 0x0F) << 8);
+  }
+
+  if (_has_sequence && _decoded.sequence != _next_sequence) {
+    _stats.lost_sequences += (uint16_t)(_decoded.sequence - _next_sequence);
+  }
+  _has_sequence = true;
+  _next_sequence = _decoded.sequence + 1;
+  _stats.packets++;
+  _stats.samples += count;
+  if (_callback) {
+    _callback(_decoded);
+  }
+}
+
+} // namespace ED_ADC
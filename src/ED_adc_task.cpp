@@ -0,0 +1,173 @@
+#include "ED_adc_task.h"
+
+#if defined(ESP_PLATFORM)
+#include <algorithm>
+
+namespace ED_ADC {
+
+static inline const char *TAG = "ED_ADC";
+
+// WorkerTask implementations
+WorkerTask::~WorkerTask() {
+  stop();
+  if (_exited) {
+    vSemaphoreDelete(_exited);
+  }
+}
+
+esp_err_t WorkerTask::start(const TaskConfig &config, Body body) {
+  if (_task)
+    return ESP_ERR_INVALID_STATE;
+  if (!_exited) {
+    _exited = xSemaphoreCreateBinary();
+    if (!_exited)
+      return ESP_ERR_NO_MEM;
+  }
+  _body = std::move(body);
+  _stop_requested = false;
+  BaseType_t ok =
+      xTaskCreatePinnedToCore(entry, config.name, config.stack_size, this,
+                              config.priority, &_task, config.core_id);
+  if (ok != pdPASS) {
+    ESP_LOGE(TAG, "WorkerTask - Failed to create task %s", config.name);
+    _task = nullptr;
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+void WorkerTask::stop() {
+  if (!_task)
+    return;
+  _stop_requested = true;
+  xTaskNotifyGive(_task);
+  xSemaphoreTake(_exited, portMAX_DELAY);
+  _task = nullptr;
+}
+
+void WorkerTask::notify() {
+  if (_task) {
+    xTaskNotifyGive(_task);
+  }
+}
+
+uint32_t WorkerTask::stackHighWater() const {
+  return _task ? uxTaskGetStackHighWaterMark(_task) : _stack_free.load();
+}
+
+void WorkerTask::entry(void *arg) {
+  WorkerTask *self = static_cast<WorkerTask *>(arg);
+  self->_body();
+  self->_stack_free = uxTaskGetStackHighWaterMark(NULL);
+  xSemaphoreGive(self->_exited);
+  vTaskDelete(NULL);
+}
+
+// SamplerTask implementations
+SamplerTask::SamplerTask(ADCChannel &channel, const TaskConfig &config)
+    : _channel(channel), _config(config) {}
+
+SamplerTask::~SamplerTask() { stop(); }
+
+esp_err_t SamplerTask::start(uint32_t period_ms, int sample_count,
+                             int sample_delay_ms, Callback callback) {
+  if (_worker.isRunning())
+    return ESP_ERR_INVALID_STATE;
+
+  _period_ms = period_ms;
+  _sample_count = sample_count;
+  _sample_delay_ms = sample_delay_ms;
+  _callback = std::move(callback);
+  _cancel.reset();
+  portENTER_CRITICAL(&_stats_lock);
+  _stats = {};
+  _latency_sum_us = 0;
+  portEXIT_CRITICAL(&_stats_lock);
+
+  return _worker.start(_config, [this] { run(); });
+}
+
+void SamplerTask::stop() {
+  if (!_worker.isRunning())
+    return;
+  // flagged first, so the cancelled read is not handed to the callback
+  _worker.requestStop();
+  _cancel.cancel();
+  _worker.stop(); // also cuts the wait for the next period short
+}
+
+SchedulingStats SamplerTask::schedulingStats() const {
+  portENTER_CRITICAL(&_stats_lock);
+  SchedulingStats stats = _stats;
+  portEXIT_CRITICAL(&_stats_lock);
+  return stats;
+}
+
+void SamplerTask::run() {
+  const TickType_t period = std::max<TickType_t>(pdMS_TO_TICKS(_period_ms), 1);
+  const int64_t period_us = (int64_t)period * portTICK_PERIOD_MS * 1000;
+  CaptureOptions options;
+  options.cancel = &_cancel;
+
+  // start on a tick edge, so expected_us is the time of the tick
+  // next_wake counts from and the latency has no sub-tick phase in it
+  vTaskDelay(1);
+  TickType_t next_wake = xTaskGetTickCount();
+  int64_t expected_us = esp_timer_get_time();
+
+  while (!_worker.stopRequested()) {
+    ADCReadResult result = {};
+    esp_err_t err =
+        _channel.read(_sample_count, _sample_delay_ms, result, options);
+    if (_worker.stopRequested())
+      break;
+    if (_callback) {
+      _callback(result, err);
+    }
+
+    // wait for the next period; a notification from stop() ends it early
+    next_wake += period;
+    expected_us += period_us;
+    TickType_t now = xTaskGetTickCount();
+    if ((int32_t)(now - next_wake) > 0) {
+      // the read overran: resume on the schedule instead of firing back to
+      // back, and keep the overrun out of the latency
+      const TickType_t missed = (now - next_wake + period - 1) / period;
+      next_wake += missed * period;
+      expected_us += (int64_t)missed * period_us;
+      recordOverrun(missed);
+    }
+    if ((int32_t)(next_wake - now) > 0) {
+      ulTaskNotifyTake(pdTRUE, next_wake - now);
+    }
+    if (_worker.stopRequested())
+      break;
+    recordLatency(esp_timer_get_time() - expected_us);
+  }
+}
+
+void SamplerTask::recordOverrun(uint32_t missed_periods) {
+  portENTER_CRITICAL(&_stats_lock);
+  _stats.overruns++;
+  _stats.missed_periods += missed_periods;
+  portEXIT_CRITICAL(&_stats_lock);
+}
+
+void SamplerTask::recordLatency(int64_t latency_us) {
+  portENTER_CRITICAL(&_stats_lock);
+  if (_stats.wakeups == 0) {
+    _stats.min_latency_us = latency_us;
+    _stats.max_latency_us = latency_us;
+  }
+  _stats.wakeups++;
+  _stats.last_latency_us = latency_us;
+  _stats.min_latency_us = std::min(_stats.min_latency_us, latency_us);
+  _stats.max_latency_us = std::max(_stats.max_latency_us, latency_us);
+  _latency_sum_us += latency_us;
+  _stats.avg_latency_us = _latency_sum_us / _stats.wakeups;
+  portEXIT_CRITICAL(&_stats_lock);
+}
+
+} // namespace ED_ADC
+
+#endif // ESP_PLATFORM
@@ -0,0 +1,247 @@
+#include "ED_adc_trace.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#if defined(ESP_PLATFORM)
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
+#else
+#include <chrono>
+#endif
+
+namespace ED_ADC {
+
+static_assert((ED_ADC_TRACE_EVENTS & (ED_ADC_TRACE_EVENTS - 1)) == 0,
+              "ED_ADC_TRACE_EVENTS must be a power of two");
+
+namespace {
+#if ED_ADC_TRACE
+TraceEvent ring[ED_ADC_TRACE_EVENTS];
+std::atomic<uint32_t> head{0};  // events ever recorded, wraps
+std::atomic<uint32_t> first{0}; // head at the last clear()
+#endif
+
+const char *STAGE_NAMES[TRACE_STAGE_COUNT] = {
+    "driver_call", "decode", "calibrate", "statistics", "delivery"};
+
+void putLe(uint8_t *out, uint32_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    out[i] = (value >> (8 * i)) & 0xFF;
+  }
+}
+
+uint32_t getLe(const uint8_t *in, size_t bytes) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value |= (uint32_t)in[i] << (8 * i);
+  }
+  return value;
+}
+
+/// @brief start ticks made monotonic: each start is taken relative to the
+/// previous event, which is closer than half the counter range (see
+/// TraceEvent)
+std::vector<int64_t> unwrapStarts(const TraceEvent *events, size_t count) {
+  std::vector<int64_t> starts(count);
+  int64_t current = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (i > 0) {
+      current += (int32_t)(events[i].start - events[i - 1].start);
+    }
+    starts[i] = current;
+  }
+  return starts;
+}
+} // namespace
+
+uint32_t Tracer::now() {
+#if defined(ESP_PLATFORM)
+  return esp_cpu_get_cycle_count();
+#else
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+uint32_t Tracer::ticksPerUs() {
+#if defined(ESP_PLATFORM)
+  return esp_rom_get_cpu_ticks_per_us();
+#else
+  return 1;
+#endif
+}
+
+void Tracer::record(TraceStage stage, uint8_t channel, uint32_t start,
+                    uint32_t items) {
+#if ED_ADC_TRACE
+  const uint32_t end = now();
+  const uint32_t slot = head.fetch_add(1, std::memory_order_relaxed);
+  TraceEvent &event = ring[slot & (ED_ADC_TRACE_EVENTS - 1)];
+  event.start = start;
+  event.ticks = end - start;
+  event.stage = (uint8_t)stage;
+  event.channel = channel;
+  event.items = (uint16_t)std::min<uint32_t>(items, UINT16_MAX);
+#else
+  (void)stage;
+  (void)channel;
+  (void)start;
+  (void)items;
+#endif
+}
+
+size_t Tracer::snapshot(TraceEvent *out, size_t max) {
+#if ED_ADC_TRACE
+  const uint32_t end = head.load(std::memory_order_acquire);
+  const size_t available = std::min<size_t>(
+      std::min<uint32_t>(end - first.load(), ED_ADC_TRACE_EVENTS), max);
+  const uint32_t start = end - (uint32_t)available;
+  for (size_t i = 0; i < available; i++) {
+    out[i] = ring[(start + i) & (ED_ADC_TRACE_EVENTS - 1)];
+  }
+  return available;
+#else
+  (void)out;
+  (void)max;
+  return 0;
+#endif
+}
+
+uint32_t Tracer::recorded() {
+#if ED_ADC_TRACE
+  return head.load() - first.load();
+#else
+  return 0;
+#endif
+}
+
+void Tracer::clear() {
+#if ED_ADC_TRACE
+  first.store(head.load());
+#endif
+}
+
+esp_err_t Tracer::writeDump(FILE *file) {
+  std::vector<TraceEvent> events(ED_ADC_TRACE ? ED_ADC_TRACE_EVENTS : 0);
+  const size_t count = snapshot(events.data(), events.size());
+
+  uint8_t header[12] = {'E', 'D', 'T', '1'};
+  putLe(&header[4], ticksPerUs(), 4);
+  putLe(&header[8], (uint32_t)count, 4);
+  if (fwrite(header, 1, sizeof(header), file) != sizeof(header))
+    return ESP_FAIL;
+  for (size_t i = 0; i < count; i++) {
+    uint8_t out[12];
+    putLe(&out[0], events[i].start, 4);
+    putLe(&out[4], events[i].ticks, 4);
+    out[8] = events[i].stage;
+    out[9] = events[i].channel;
+    putLe(&out[10], events[i].items, 2);
+    if (fwrite(out, 1, sizeof(out), file) != sizeof(out))
+      return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+bool Tracer::readDump(FILE *file, std::vector<TraceEvent> &events,
+                      uint32_t &ticks_per_us) {
+  uint8_t header[12];
+  if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+      memcmp(header, "EDT1", 4) != 0)
+    return false;
+  ticks_per_us = getLe(&header[4], 4);
+  const uint32_t count = getLe(&header[8], 4);
+  events.clear();
+  for (uint32_t i = 0; i < count; i++) {
+    uint8_t in[12];
+    if (fread(in, 1, sizeof(in), file) != sizeof(in))
+      return false;
+    TraceEvent event;
+    event.start = getLe(&in[0], 4);
+    event.ticks = getLe(&in[4], 4);
+    event.stage = in[8];
+    event.channel = in[9];
+    event.items = getLe(&in[10], 2);
+    if (event.stage < TRACE_STAGE_COUNT) {
+      events.push_back(event);
+    }
+  }
+  return ticks_per_us > 0;
+}
+
+const char *traceStageName(TraceStage stage) {
+  size_t index = (size_t)stage;
+  return index < TRACE_STAGE_COUNT ? STAGE_NAMES[index] : "unknown";
+}
+
+void traceBreakdown(const TraceEvent *events, size_t count,
+                    uint32_t ticks_per_us,
+                    TraceStageStats stats[TRACE_STAGE_COUNT]) {
+  std::fill_n(stats, TRACE_STAGE_COUNT, TraceStageStats{});
+  if (count == 0 || ticks_per_us == 0)
+    return;
+  const std::vector<int64_t> starts = unwrapStarts(events, count);
+  std::vector<int64_t> self(count);
+  for (size_t i = 0; i < count; i++) {
+    self[i] = events[i].ticks;
+  }
+
+  // events are recorded when they end, so a parent follows its children:
+  // walk in start order and keep the enclosing spans on a stack
+  std::vector<size_t> order(count);
+  for (size_t i = 0; i < count; i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    if (starts[a] != starts[b])
+      return starts[a] < starts[b];
+    return events[a].ticks > events[b].ticks; // parent first
+  });
+  std::vector<size_t> open;
+  for (size_t i : order) {
+    const int64_t end = starts[i] + events[i].ticks;
+    while (!open.empty() &&
+           starts[open.back()] + events[open.back()].ticks < end) {
+      open.pop_back();
+    }
+    if (!open.empty()) {
+      self[open.back()] -= events[i].ticks;
+    }
+    open.push_back(i);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (events[i].stage >= TRACE_STAGE_COUNT)
+      continue;
+    TraceStageStats &s = stats[events[i].stage];
+    const double us = (double)events[i].ticks / ticks_per_us;
+    s.events++;
+    s.items += events[i].items;
+    s.total_us += us;
+    s.self_us += (double)self[i] / ticks_per_us;
+    s.max_us = std::max(s.max_us, us);
+  }
+}
+
+void writeChromeTrace(FILE *file, const TraceEvent *events, size_t count,
+                      uint32_t ticks_per_us) {
+  if (ticks_per_us == 0) {
+    ticks_per_us = 1;
+  }
+  const std::vector<int64_t> starts = unwrapStarts(events, count);
+  fprintf(file, "{\"traceEvents\":[\n");
+  for (size_t i = 0; i < count; i++) {
+    fprintf(file,
+            "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":1,\"tid\":%u,\"args\":{\"items\":%u}}%s\n",
+            traceStageName((TraceStage)events[i].stage),
+            (double)starts[i] / ticks_per_us,
+            (double)events[i].ticks / ticks_per_us, events[i].channel,
+            events[i].items, i + 1 < count ? "," : "");
+  }
+  fprintf(file, "],\"displayTimeUnit\":\"ns\"}\n");
+}
+
+} // namespace ED_ADC
@@ -0,0 +1,220 @@
+#include "ED_adc_ulp.h"
+#include <algorithm>
+
+#if defined(ESP_PLATFORM)
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "soc/soc_caps.h"
+#else
+// host build: plain static storage, no sleep
+#define RTC_DATA_ATTR
+#endif
+
+namespace ED_ADC {
+
+static inline const char *TAG = "ED_ADC";
+
+// kept across deep sleep, cleared on power-on
+RTC_DATA_ATTR static UlpHandoff s_rtc_handoff;
+
+namespace {
+/// @brief code of calibration point i
+uint32_t caliCode(size_t i) { return std::min<uint32_t>(i * 256, 4095); }
+
+#if defined(ESP_PLATFORM) && !SOC_ULP_SUPPORTED
+/// @brief one raw conversion of the armed channel on a oneshot unit opened
+/// for it, the whole ADC work of a timer wake-up
+esp_err_t readArmedChannel(Driver &driver, const UlpHandoff &handoff,
+                           int &raw) {
+  const adc_channel_t channel = (adc_channel_t)handoff.adc_channel;
+  adc_oneshot_unit_handle_t handle = nullptr;
+  esp_err_t err = driver.oneshotNewUnit((adc_unit_t)handoff.adc_unit,
+                                        ADC_ULP_MODE_DISABLE, &handle);
+  if (err != ESP_OK)
+    return err;
+  err = driver.oneshotConfigChannel(
+      handle, channel, (adc_atten_t)handoff.adc_atten, ADC_BITWIDTH_12);
+  if (err == ESP_OK) {
+    err = driver.oneshotRead(handle, channel, &raw);
+  }
+  driver.oneshotDelUnit(handle);
+  return err;
+}
+#endif
+} // namespace
+
+UlpWakeReason ulpProcessSample(UlpHandoff &handoff, uint16_t raw) {
+  if (handoff.capacity == 0 || handoff.capacity > ULP_HANDOFF_CAPACITY)
+    return UlpWakeReason::None;
+  raw &= 0xFFF;
+  handoff.samples[handoff.head] = raw;
+  handoff.head = (handoff.head + 1) % handoff.capacity;
+  if (handoff.count < handoff.capacity)
+    handoff.count++;
+  handoff.sequence = (handoff.sequence + 1) & 0xFFFF;
+
+  UlpWakeReason reason = UlpWakeReason::None;
+  uint32_t diff = raw > handoff.reference_raw ? raw - handoff.reference_raw
+                                              : handoff.reference_raw - raw;
+  if (handoff.low_raw > 0 && raw < handoff.low_raw) {
+    reason = UlpWakeReason::BelowLow;
+  } else if (handoff.high_raw < 4095 && raw > handoff.high_raw) {
+    reason = UlpWakeReason::AboveHigh;
+  } else if (handoff.change_raw > 0 && diff >= handoff.change_raw) {
+    reason = UlpWakeReason::Change;
+  } else if (handoff.batch_wake > 0 && handoff.count >= handoff.batch_wake) {
+    reason = UlpWakeReason::BatchFull;
+  }
+  handoff.wake_reason = (uint32_t)reason;
+  return reason;
+}
+
+UlpWakeReason ulpSimulate(UlpHandoff &handoff, const uint16_t *samples,
+                          size_t count, size_t *consumed) {
+  UlpWakeReason reason = UlpWakeReason::None;
+  size_t i = 0;
+  while (i < count && reason == UlpWakeReason::None) {
+    reason = ulpProcessSample(handoff, samples[i++]);
+  }
+  if (consumed) {
+    *consumed = i;
+  }
+  return reason;
+}
+
+// UlpSampler implementations
+UlpHandoff &UlpSampler::rtcHandoff() { return s_rtc_handoff; }
+
+UlpSampler::UlpSampler(UlpHandoff &handoff) : _handoff(handoff) {}
+
+void UlpSampler::arm(const UlpWakeCondition &condition, uint32_t period_ms,
+                     uint16_t reference_raw) {
+  _handoff = {};
+  _handoff.version = ULP_HANDOFF_VERSION;
+  _handoff.capacity = ULP_HANDOFF_CAPACITY;
+  _handoff.period_ms = period_ms;
+  _handoff.low_raw = condition.low_raw;
+  _handoff.high_raw = condition.high_raw;
+  _handoff.change_raw = condition.change_raw;
+  _handoff.batch_wake =
+      std::min<uint32_t>(condition.batch_wake, ULP_HANDOFF_CAPACITY);
+  _handoff.reference_raw = reference_raw & 0xFFF;
+  _handoff.magic = ULP_HANDOFF_MAGIC; // last: marks the buffer valid
+}
+
+void UlpSampler::arm(ADCChannel &channel, const UlpWakeCondition &condition,
+                     uint32_t period_ms, uint16_t reference_raw) {
+  arm(condition, period_ms, reference_raw);
+  _handoff.adc_unit = channel.unitId();
+  _handoff.adc_channel = channel.channel();
+  _handoff.adc_atten = channel.attenuation();
+  for (size_t i = 0; i < ULP_CALI_POINTS; i++) {
+    _handoff.cali_mv[i] = std::max(channel.rawToVoltage(caliCode(i)), 0);
+  }
+  _handoff.channel_valid = 1;
+}
+
+bool UlpSampler::isArmed() const {
+  return _handoff.magic == ULP_HANDOFF_MAGIC &&
+         _handoff.version == ULP_HANDOFF_VERSION &&
+         _handoff.capacity == ULP_HANDOFF_CAPACITY;
+}
+
+bool UlpSampler::onWake(Driver &driver) {
+  if (!isArmed())
+    return false;
+
+#if !defined(ESP_PLATFORM)
+  (void)driver;
+  return false;
+#else
+  esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+#if SOC_ULP_SUPPORTED
+  (void)driver;
+  return cause == ESP_SLEEP_WAKEUP_ULP;
+#else
+  if (cause != ESP_SLEEP_WAKEUP_TIMER)
+    return false;
+  if (!_handoff.channel_valid) {
+    ESP_LOGE(TAG, "UlpSampler - armed without a channel, nothing to sample");
+    return true;
+  }
+  int raw = 0;
+  if (readArmedChannel(driver, _handoff, raw) != ESP_OK) {
+    // treat a failing conversion as a reason to look at the data
+    return true;
+  }
+  if (ulpProcessSample(_handoff, raw) == UlpWakeReason::None) {
+    sleep();
+  }
+  return true;
+#endif
+#endif // ESP_PLATFORM
+}
+
+UlpWakeReason UlpSampler::wakeReason() const {
+  return static_cast<UlpWakeReason>(_handoff.wake_reason);
+}
+
+size_t UlpSampler::takeSamples(ADCChannel &channel,
+                               std::vector<int> &voltages) {
+  return drain(voltages,
+               [&](uint16_t raw) { return channel.rawToVoltage(raw); });
+}
+
+size_t UlpSampler::takeSamples(std::vector<int> &voltages) {
+  return drain(voltages, [&](uint16_t raw) { return cachedVoltage(raw); });
+}
+
+int UlpSampler::cachedVoltage(uint16_t raw) const {
+  if (!_handoff.channel_valid)
+    return raw;
+  raw &= 0xFFF;
+  const size_t i = std::min<size_t>(raw / 256, ULP_CALI_POINTS - 2);
+  const int low = caliCode(i);
+  const int high = caliCode(i + 1);
+  const int low_mv = _handoff.cali_mv[i];
+  const int high_mv = _handoff.cali_mv[i + 1];
+  return low_mv + (high_mv - low_mv) * (raw - low) / (high - low);
+}
+
+template <typename Convert>
+size_t UlpSampler::drain(std::vector<int> &voltages, Convert convert) {
+  if (!isArmed())
+    return 0;
+  const uint32_t count = _handoff.count;
+  const uint32_t capacity = _handoff.capacity;
+  uint32_t index = (_handoff.head + capacity - count) % capacity;
+  voltages.reserve(voltages.size() + count);
+  for (uint32_t i = 0; i < count; i++) {
+    voltages.push_back(convert(_handoff.samples[index]));
+    index = (index + 1) % capacity;
+  }
+  if (count > 0) {
+    _handoff.reference_raw =
+        _handoff.samples[(_handoff.head + capacity - 1) % capacity];
+  }
+  _handoff.count = 0;
+  _handoff.wake_reason = (uint32_t)UlpWakeReason::None;
+  return count;
+}
+
+void UlpSampler::sleep() {
+#if !defined(ESP_PLATFORM)
+  ESP_LOGW(TAG, "UlpSampler - deep sleep is not available on host");
+#else
+#if SOC_ULP_SUPPORTED
+  esp_err_t err = esp_sleep_enable_ulp_wakeup();
+#else
+  esp_err_t err =
+      esp_sleep_enable_timer_wakeup((uint64_t)_handoff.period_ms * 1000);
+#endif
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "UlpSampler - Failed to enable wake-up: %s",
+             esp_err_to_name(err));
+  }
+  esp_deep_sleep_start();
+#endif
+}
+
+} // namespace ED_ADC
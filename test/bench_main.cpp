@@ -0,0 +1,94 @@
+// Runs runBenchmarks() on the host and gates against a recorded baseline.
+//   ed_adc_bench --record [--baseline FILE]  write the baseline
+//   ed_adc_bench [--baseline FILE]           compare with it (gateBench())
+// Options: --tolerance FRACTION (default 0.15), --runs N.
+// Exit status: 0 no regression (or recorded), 1 regression or benchmark
+// missing from the run, 2 usage error or unreadable baseline. The baseline
+// defaults to bench_baseline.csv in the working directory.
+//
+// test/bench_baseline.csv is the committed baseline read by the
+// bench_check target. Timings only compare on the machine they were taken
+// on: before gating on another machine, regenerate it there from an
+// accepted build with the bench_record target (on a quiet machine, in a
+// Release build) and commit it with the change that moved the gate.
+#include "ED_adc_bench.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace ED_ADC;
+
+namespace {
+int usage() {
+  fprintf(stderr, "usage: ed_adc_bench [--record] [--baseline FILE] "
+                  "[--tolerance FRACTION] [--runs N]\n");
+  return 2;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  bool record = false;
+  const char *baseline_path = "bench_baseline.csv";
+  BenchConfig config;
+  for (int i = 1; i < argc; i++) {
+    const bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--record") == 0) {
+      record = true;
+    } else if (strcmp(argv[i], "--baseline") == 0 && has_value) {
+      baseline_path = argv[++i];
+    } else if (strcmp(argv[i], "--tolerance") == 0 && has_value) {
+      config.tolerance = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--runs") == 0 && has_value) {
+      config.runs = (uint32_t)atoi(argv[++i]);
+    } else {
+      return usage();
+    }
+  }
+
+  std::vector<BenchResult> baseline;
+  if (!record) {
+    // read first, so a missing baseline fails before the long run
+    FILE *file = fopen(baseline_path, "r");
+    const bool ok = file && readBenchResults(file, baseline);
+    if (file) {
+      fclose(file);
+    }
+    if (!ok) {
+      fprintf(stderr,
+              "ed_adc_bench: no baseline in %s, write one with --record\n",
+              baseline_path);
+      return 2;
+    }
+  }
+
+  if (record) {
+    const std::vector<BenchResult> current = runBenchmarks(config);
+    if (current.empty()) {
+      fprintf(stderr, "ed_adc_bench: the benchmarks could not run\n");
+      return 2;
+    }
+    writeBenchResults(stdout, current);
+    FILE *file = fopen(baseline_path, "w");
+    bool ok = file && writeBenchResults(file, current) == ESP_OK;
+    if (file && fclose(file) != 0) {
+      ok = false;
+    }
+    if (!ok) {
+      fprintf(stderr, "ed_adc_bench: cannot write %s\n", baseline_path);
+      return 2;
+    }
+    printf("baseline written to %s\n", baseline_path);
+    return 0;
+  }
+
+  std::vector<BenchResult> current;
+  std::vector<BenchComparison> report;
+  const size_t failures = gateBench(baseline, config, current, report);
+  writeBenchResults(stdout, current);
+  writeBenchComparison(stdout, report);
+  if (failures > 0) {
+    printf("%zu benchmark(s) regressed or missing\n", failures);
+    return 1;
+  }
+  return 0;
+}
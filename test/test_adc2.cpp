@@ -0,0 +1,204 @@
+// Adc2Scheduler against the simulated radio of SimDriver: the backoff while
+// Wi-Fi holds ADC2, the queue draining in one idle window, reads expiring
+// after max_wait_ms, the statistics, and the checks of submit().
+#include "ED_adc_adc2.h"
+#include "test_check.h"
+#include <vector>
+
+using namespace ED_ADC;
+
+namespace {
+
+class Fixture {
+public:
+  explicit Fixture(const Adc2SchedulerConfig &config = {}) : sim(clock) {
+    adc2 = ADCUnit::create(ADC_UNIT_2, ADC_ULP_MODE_DISABLE, sim);
+    channels[0] = ADCChannel::create(adc2.get(), ADC_CHANNEL_0,
+                                     ADC_ATTEN_DB_12);
+    channels[1] = ADCChannel::create(adc2.get(), ADC_CHANNEL_1,
+                                     ADC_ATTEN_DB_12);
+    scheduler = std::make_unique<Adc2Scheduler>(*adc2, config);
+  }
+
+  /// @brief sleeps until the next attempt is due and polls, as a task
+  /// calling poll() at every tick would
+  size_t pollWhenDue() {
+    const int64_t wait_us = scheduler->nextAttemptUs() - clock.nowUs();
+    if (wait_us > 0) {
+      clock.advanceUs(wait_us);
+    }
+    return scheduler->poll();
+  }
+
+  VirtualClock clock;
+  SimDriver sim;
+  std::unique_ptr<ADCUnit> adc2;
+  std::unique_ptr<ADCChannel> channels[2];
+  std::unique_ptr<Adc2Scheduler> scheduler;
+};
+
+/// @brief completion of a queued read
+struct Completion {
+  esp_err_t err;
+  int voltage_mv;
+  int64_t wait_us;
+  int64_t at_us;
+};
+
+Adc2Scheduler::Callback record(Fixture &fx, std::vector<Completion> &done) {
+  return [&fx, &done](esp_err_t err, int mv, int64_t wait_us) {
+    done.push_back({err, mv, wait_us, fx.clock.nowUs()});
+  };
+}
+
+/// @brief the wait after each refusal doubles from retry_ms up to
+/// max_retry_ms, and is reset once a conversion succeeds
+void testBackoff() {
+  Fixture fx;
+  const int64_t busy_until_us = 60000;
+  fx.sim.setAdc2Contention(
+      [&](int64_t t_us) { return t_us < busy_until_us; });
+  std::vector<Completion> done;
+  CHECK_EQ(fx.scheduler->submit(*fx.channels[0], record(fx, done)), ESP_OK);
+
+  std::vector<int64_t> backoffs_us;
+  while (fx.pollWhenDue() == 0) {
+    CHECK(fx.scheduler->contended());
+    backoffs_us.push_back(fx.scheduler->nextAttemptUs() - fx.clock.nowUs());
+  }
+  // refused at 0, 1, 3, 7, 15, 31 and 47 ms (plus 20 us per conversion)
+  const std::vector<int64_t> expected = {1000,  2000,  4000, 8000,
+                                         16000, 16000, 16000};
+  CHECK(backoffs_us == expected);
+  CHECK(!fx.scheduler->contended());
+  CHECK_EQ(fx.scheduler->nextAttemptUs(), 0);
+  CHECK_EQ(done.size(), 1);
+  if (!done.empty()) {
+    CHECK_EQ(done[0].err, ESP_OK);
+    CHECK_GE(done[0].at_us, busy_until_us);
+    CHECK_LE(done[0].at_us, busy_until_us + 16000 + 8 * 20);
+  }
+  CHECK_EQ(fx.sim.stats().adc2_contentions, expected.size());
+
+  // a refusal after the success starts again at retry_ms
+  fx.sim.setAdc2Contention([](int64_t) { return true; });
+  fx.scheduler->submit(*fx.channels[0], record(fx, done));
+  fx.pollWhenDue();
+  CHECK_EQ(fx.scheduler->nextAttemptUs() - fx.clock.nowUs(), 1000);
+}
+
+/// @brief reads queued while the radio is busy all complete in the first
+/// poll of the idle window, in submission order
+void testQueueDrainsInOneWindow() {
+  Fixture fx;
+  // busy for the first 30 ms of every 50 ms
+  fx.sim.setAdc2Contention(SimDriver::periodicContention(50000, 30000));
+  std::vector<Completion> done;
+  for (int i = 0; i < 5; i++) {
+    CHECK_EQ(fx.scheduler->submit(*fx.channels[i % 2], record(fx, done)),
+             ESP_OK);
+  }
+  CHECK_EQ(fx.scheduler->pending(), 5);
+  size_t completed = 0;
+  int polls = 0;
+  while (completed == 0 && polls++ < 100) {
+    completed = fx.pollWhenDue();
+  }
+  CHECK_EQ(completed, 5);
+  CHECK_EQ(fx.scheduler->pending(), 0);
+  CHECK_EQ(done.size(), 5);
+  for (size_t i = 0; i < done.size(); i++) {
+    CHECK_EQ(done[i].err, ESP_OK);
+    CHECK_GE(done[i].at_us, 30000);
+    CHECK_LE(done[i].at_us, 50000); // the same window
+    // one conversion of 20 us after the other
+    CHECK_EQ(done[i].wait_us, done[0].wait_us + (int64_t)i * 20);
+  }
+
+  const Adc2Stats stats = fx.scheduler->stats();
+  CHECK_EQ(stats.submitted, 5);
+  CHECK_EQ(stats.completed, 5);
+  CHECK_EQ(stats.expired, 0);
+  CHECK_EQ(stats.contentions, fx.sim.stats().adc2_contentions);
+  CHECK_EQ(stats.max_wait_us, done[4].wait_us);
+  int64_t total_us = 0;
+  for (const Completion &completion : done) {
+    total_us += completion.wait_us;
+  }
+  CHECK_EQ(stats.total_wait_us, total_us);
+  // from the first refusal to the conversion that got through
+  CHECK_GE(stats.max_busy_us, 30000 - 20);
+  CHECK_LE(stats.max_busy_us, 30000 + 16000);
+}
+
+/// @brief reads still refused after max_wait_ms fail with ESP_ERR_TIMEOUT,
+/// the queued ones behind them too; read() blocks until then
+void testExpiry() {
+  Adc2SchedulerConfig config;
+  config.max_wait_ms = 50;
+  Fixture fx(config);
+  fx.sim.setAdc2Contention([](int64_t) { return true; });
+  std::vector<Completion> done;
+  fx.scheduler->submit(*fx.channels[0], record(fx, done));
+  fx.scheduler->submit(*fx.channels[1], record(fx, done));
+  int polls = 0;
+  while (fx.scheduler->pending() > 0 && polls++ < 100) {
+    fx.pollWhenDue();
+  }
+  CHECK_EQ(done.size(), 2);
+  for (const Completion &completion : done) {
+    CHECK_EQ(completion.err, ESP_ERR_TIMEOUT);
+    CHECK_GE(completion.wait_us, 50000);
+    CHECK_LE(completion.wait_us, 50000 + 16000);
+  }
+  CHECK_EQ(fx.scheduler->stats().expired, 2);
+  CHECK_EQ(fx.scheduler->stats().completed, 0);
+
+  int voltage = -1;
+  int64_t wait_us = 0;
+  const int64_t start_us = fx.clock.nowUs();
+  CHECK_EQ(fx.scheduler->read(*fx.channels[0], voltage, &wait_us),
+           ESP_ERR_TIMEOUT);
+  CHECK_GE(wait_us, 50000);
+  CHECK_EQ(fx.clock.nowUs() - start_us, wait_us);
+  CHECK_EQ(fx.scheduler->stats().expired, 3);
+
+  // once the radio lets go, read() gets the voltage
+  fx.sim.setAdc2Contention(nullptr);
+  CHECK_EQ(fx.scheduler->read(*fx.channels[0], voltage, &wait_us), ESP_OK);
+  CHECK_EQ(voltage, fx.channels[0]->rawToVoltage(2048));
+  CHECK_EQ(wait_us, 20);
+}
+
+/// @brief submit() refuses a full queue and a channel of another unit
+void testSubmitChecks() {
+  Adc2SchedulerConfig config;
+  config.queue_depth = 2;
+  Fixture fx(config);
+  fx.sim.setAdc2Contention([](int64_t) { return true; });
+  CHECK_EQ(fx.scheduler->submit(*fx.channels[0], nullptr), ESP_OK);
+  CHECK_EQ(fx.scheduler->submit(*fx.channels[1], nullptr), ESP_OK);
+  CHECK_EQ(fx.scheduler->submit(*fx.channels[0], nullptr), ESP_ERR_NO_MEM);
+  CHECK_EQ(fx.scheduler->stats().rejected, 1);
+  CHECK_EQ(fx.scheduler->stats().submitted, 2);
+
+  auto adc1 = ADCUnit::create(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, fx.sim);
+  auto other = ADCChannel::create(adc1.get(), ADC_CHANNEL_0, ADC_ATTEN_DB_12);
+  fx.scheduler->poll(); // frees nothing while the radio is busy
+  CHECK_EQ(fx.scheduler->submit(*other, nullptr), ESP_ERR_INVALID_ARG);
+  fx.sim.setAdc2Contention(nullptr);
+  fx.pollWhenDue();
+  CHECK_EQ(fx.scheduler->submit(*other, nullptr), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(fx.scheduler->stats().submitted, 2);
+  CHECK_EQ(fx.scheduler->stats().completed, 2);
+}
+
+} // namespace
+
+int main() {
+  testBackoff();
+  testQueueDrainsInOneWindow();
+  testExpiry();
+  testSubmitChecks();
+  return ED_ADC_test::testResult();
+}
@@ -0,0 +1,230 @@
+// readAsync() and FrameStream on an Executor over a SimDriver and a
+// VirtualClock: two reads interleave at their delays in simulated time, a
+// read gives the same result as read() with the same conversions failing,
+// and cancellation or a deadline stop a read in the middle of a delay.
+#include "ED_adc_async.h"
+#include "test_check.h"
+#include <set>
+#include <utility>
+#include <vector>
+
+using namespace ED_ADC;
+
+namespace {
+constexpr int64_t POLL_US = ADCChannel::CANCEL_POLL_MS * 1000;
+
+/// @brief a SimDriver that logs its oneshot conversions and fails the calls
+/// listed in failing with ESP_ERR_TIMEOUT, before converting
+class RecordingDriver : public SimDriver {
+public:
+  explicit RecordingDriver(VirtualClock &clock) : SimDriver(clock) {}
+
+  std::set<uint32_t> failing;
+  std::vector<std::pair<adc_channel_t, int64_t>> calls; // channel, start
+
+  esp_err_t oneshotRead(adc_oneshot_unit_handle_t handle,
+                        adc_channel_t channel, int *raw) override {
+    calls.push_back({channel, _clock.nowUs()});
+    if (failing.count(_calls++))
+      return ESP_ERR_TIMEOUT;
+    return SimDriver::oneshotRead(handle, channel, raw);
+  }
+
+private:
+  uint32_t _calls = 0;
+};
+
+class Fixture {
+public:
+  Fixture() : sim(clock), executor(clock), token(clock) {
+    // a code per channel and millisecond
+    sim.setSignal([](adc_channel_t channel, int64_t t_us) {
+      return 1000 + 500 * channel + (int)(t_us / 1000 % 7) * 10;
+    });
+    unit = ADCUnit::create(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim);
+    channels[0] =
+        ADCChannel::create(unit.get(), ADC_CHANNEL_0, ADC_ATTEN_DB_12);
+    channels[1] =
+        ADCChannel::create(unit.get(), ADC_CHANNEL_1, ADC_ATTEN_DB_12);
+  }
+
+  VirtualClock clock;
+  RecordingDriver sim;
+  Executor executor;
+  CancelToken token;
+  std::unique_ptr<ADCUnit> unit;
+  std::unique_ptr<ADCChannel> channels[2];
+};
+
+/// @brief runs a readAsync() to completion as a top level task
+Task<void> readInto(Executor &executor, ADCChannel &channel, int count,
+                    int delay_ms, ADCReadResult &result, esp_err_t &err,
+                    CaptureOptions options = {}) {
+  err = co_await channel.readAsync(executor, count, delay_ms, result,
+                                   options);
+}
+
+bool sameResult(const ADCReadResult &a, const ADCReadResult &b) {
+  return a.average_mv == b.average_mv && a.min_mv == b.min_mv &&
+         a.max_mv == b.max_mv && a.p30_width_mv == b.p30_width_mv &&
+         a.p60_width_mv == b.p60_width_mv &&
+         a.sample_count == b.sample_count &&
+         a.error_count == b.error_count &&
+         a.skipped_count == b.skipped_count && a.partial == b.partial &&
+         a.stop_reason == b.stop_reason;
+}
+
+/// @brief 5 samples every 10 ms on channel 0 and every 25 ms on channel 1,
+/// on one executor: the conversions come in time order, each read's as
+/// they would from read() alone
+void testInterleaving() {
+  Fixture fx;
+  ADCReadResult results[2];
+  esp_err_t errs[2] = {ESP_FAIL, ESP_FAIL};
+  fx.executor.spawn(
+      readInto(fx.executor, *fx.channels[0], 5, 10, results[0], errs[0]));
+  fx.executor.spawn(
+      readInto(fx.executor, *fx.channels[1], 5, 25, results[1], errs[1]));
+  fx.executor.run();
+  CHECK_EQ(errs[0], ESP_OK);
+  CHECK_EQ(errs[1], ESP_OK);
+  CHECK_EQ(fx.executor.pending(), 0);
+
+  const adc_channel_t order[] = {ADC_CHANNEL_0, ADC_CHANNEL_1, ADC_CHANNEL_0,
+                                 ADC_CHANNEL_0, ADC_CHANNEL_1, ADC_CHANNEL_0,
+                                 ADC_CHANNEL_0, ADC_CHANNEL_1, ADC_CHANNEL_1,
+                                 ADC_CHANNEL_1};
+  CHECK_EQ(fx.sim.calls.size(), 10);
+  int64_t last_start_us[2] = {-1, -1};
+  for (size_t i = 0; i < fx.sim.calls.size() && i < 10; i++) {
+    const auto [channel, start_us] = fx.sim.calls[i];
+    CHECK_EQ(channel, order[i]);
+    // the delay is slept in slices of up to 10 ms, and a conversion of the
+    // other channel may hold each wake-up for 20 us
+    const int64_t delay_us = channel == ADC_CHANNEL_0 ? 10000 : 25000;
+    const int64_t slices = (delay_us + POLL_US - 1) / POLL_US;
+    int64_t &last_us = last_start_us[channel];
+    if (last_us >= 0) {
+      CHECK_GE(start_us - last_us, delay_us + 20);
+      CHECK_LE(start_us - last_us, delay_us + 20 + slices * 20);
+    }
+    last_us = start_us;
+  }
+  CHECK_LE(fx.clock.nowUs(), 100000 + 4 * (20 + 3 * 20) + 20);
+
+  // each read alone, with read(), on its own simulated unit
+  for (int i = 0; i < 2; i++) {
+    Fixture alone;
+    ADCReadResult expected;
+    CHECK_EQ(alone.channels[i]->read(5, i == 0 ? 10 : 25, expected), ESP_OK);
+    CHECK(sameResult(results[i], expected));
+  }
+}
+
+/// @brief with the same conversions failing, readAsync() retries, skips
+/// and aborts as read() does
+void testRetryMatchesRead() {
+  for (const bool skip : {false, true}) {
+    CaptureOptions options;
+    options.retry.max_retries = 2;
+    options.retry.skip_failed = skip;
+    const std::set<uint32_t> failing = {3, 7, 8, 9};
+
+    Fixture async;
+    async.sim.failing = failing;
+    ADCReadResult result;
+    esp_err_t err = ESP_OK;
+    async.executor.spawn(readInto(async.executor, *async.channels[0], 10, 5,
+                                  result, err, options));
+    async.executor.run();
+
+    Fixture sync;
+    sync.sim.failing = failing;
+    ADCReadResult expected;
+    CHECK_EQ(sync.channels[0]->read(10, 5, expected, options), err);
+    CHECK(sameResult(result, expected));
+    CHECK_EQ(async.clock.nowUs(), sync.clock.nowUs());
+    // call 3 is retried once; calls 7 to 9 exhaust the retries of sample 6
+    CHECK_EQ(result.error_count, 4);
+    CHECK_EQ(result.skipped_count, skip ? 1 : 0);
+    CHECK_EQ(result.sample_count, skip ? 9 : 6);
+    CHECK_EQ(err, skip ? ESP_OK : ESP_ERR_TIMEOUT);
+    CHECK_EQ(result.stop_reason,
+             skip ? StopReason::Complete : StopReason::Fault);
+  }
+}
+
+Task<void> cancelAfter(Executor &executor, CancelToken &token, uint32_t ms) {
+  co_await executor.sleepFor(ms);
+  token.cancel();
+}
+
+/// @brief a cancel from another task during a 100 ms delay stops the read
+/// at the end of the slice it falls in; a deadline stops it the same way
+void testCancelAndDeadline() {
+  Fixture fx;
+  CaptureOptions options;
+  options.cancel = &fx.token;
+  ADCReadResult result;
+  esp_err_t err = ESP_FAIL;
+  fx.executor.spawn(readInto(fx.executor, *fx.channels[0], 10, 100, result,
+                             err, options));
+  fx.executor.spawn(cancelAfter(fx.executor, fx.token, 250));
+  fx.executor.run();
+  CHECK_EQ(err, ESP_OK); // samples 0 to 2 were taken
+  CHECK_EQ(result.sample_count, 3);
+  CHECK(result.partial);
+  CHECK_EQ(result.stop_reason, StopReason::Cancelled);
+  CHECK_GE(fx.token.lastLatencyUs(), 0);
+  CHECK_LE(fx.token.lastLatencyUs(), POLL_US);
+
+  Fixture late;
+  options = {};
+  options.deadline_us = late.clock.nowUs() + 150000;
+  late.executor.spawn(readInto(late.executor, *late.channels[0], 10, 100,
+                               result, err, options));
+  late.executor.run();
+  CHECK_EQ(result.sample_count, 2);
+  CHECK_EQ(result.stop_reason, StopReason::Deadline);
+  CHECK_LE(late.clock.nowUs(), 150000 + POLL_US);
+}
+
+/// @brief the stream delivers every sample converted at 20 kHz, in frames
+/// of at least 128, while a readAsync() shares the executor
+void testFrameStream() {
+  Fixture fx;
+  int frames = 0;
+  int wrong = 0;
+  int64_t samples = 0;
+  int64_t last_frame_us = 0;
+  auto consume = [&]() -> Task<void> {
+    FrameStream stream = fx.channels[0]->openStream(fx.executor);
+    while (frames < 20 && co_await stream.nextFrame() == ESP_OK) {
+      frames++;
+      wrong += stream.frame().size() < 128 || stream.gapBefore();
+      samples += stream.frame().size();
+      last_frame_us = fx.clock.nowUs();
+    }
+  };
+  ADCReadResult result;
+  esp_err_t err = ESP_FAIL;
+  fx.executor.spawn(consume());
+  fx.executor.spawn(
+      readInto(fx.executor, *fx.channels[1], 10, 10, result, err));
+  fx.executor.run();
+  CHECK_EQ(frames, 20);
+  CHECK_EQ(wrong, 0);
+  CHECK_EQ(err, ESP_OK);
+  CHECK_EQ(result.sample_count, 10);
+  CHECK_EQ(samples, last_frame_us / 50);
+}
+
+} // namespace
+
+int main() {
+  testInterleaving();
+  testRetryMatchesRead();
+  testCancelAndDeadline();
+  testFrameStream();
+  return ED_ADC_test::testResult();
+}
@@ -0,0 +1,202 @@
+// Cancellation and deadlines of read() and sampleForDuration() on a
+// SimDriver: the stop reason, the partial flag, and how long the sampling
+// loop took to stop, in simulated time.
+#include "ED_adc.h"
+#include "test_check.h"
+#include <functional>
+
+using namespace ED_ADC;
+
+namespace {
+
+/// @brief a VirtualClock that runs an action when a sleep passes a given
+/// time, as another task cancelling in the middle of a delay would
+class AlarmClock : public VirtualClock {
+public:
+  void setAlarm(int64_t at_us, std::function<void()> action) {
+    _alarm_us = at_us;
+    _action = std::move(action);
+  }
+  void delayMs(uint32_t ms) override {
+    const int64_t end_us = nowUs() + (int64_t)ms * 1000;
+    if (_action && _alarm_us <= end_us) {
+      advanceUs(_alarm_us - nowUs());
+      std::function<void()> action = std::move(_action);
+      _action = nullptr;
+      action();
+    }
+    advanceUs(end_us - nowUs());
+  }
+
+private:
+  int64_t _alarm_us = 0;
+  std::function<void()> _action;
+};
+
+class Fixture {
+public:
+  Fixture() : sim(clock), token(clock) {
+    sim.setSignal([this](adc_channel_t, int64_t t_us) {
+      if (cancel_at_us > 0 && t_us >= cancel_at_us && !token.isCancelled()) {
+        token.cancel();
+        cancelled_at_us = clock.nowUs();
+      }
+      return 2048;
+    });
+    unit = ADCUnit::create(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim);
+    channel = ADCChannel::create(unit.get(), ADC_CHANNEL_0, ADC_ATTEN_DB_12);
+    options.cancel = &token;
+  }
+
+  /// @brief cancels from the sleep that passes at_us
+  void cancelInDelay(int64_t at_us) {
+    clock.setAlarm(at_us, [this] {
+      token.cancel();
+      cancelled_at_us = clock.nowUs();
+    });
+  }
+
+  AlarmClock clock;
+  SimDriver sim;
+  CancelToken token;
+  std::unique_ptr<ADCUnit> unit;
+  std::unique_ptr<ADCChannel> channel;
+  CaptureOptions options;
+  int64_t cancel_at_us = 0; // cancels from the conversion at that time
+  int64_t cancelled_at_us = -1;
+};
+
+constexpr int64_t POLL_US = ADCChannel::CANCEL_POLL_MS * 1000;
+constexpr int64_t CONVERSION_US = 20; // SimDriver default
+
+/// @brief a read of 50 samples 100 ms apart, cancelled 3 ms into a poll
+/// slice of the delay after the 13th sample
+void testReadCancelled() {
+  Fixture fx;
+  const int64_t start_us = fx.clock.nowUs();
+  fx.cancelInDelay(start_us + 1203000);
+  ADCReadResult result;
+  CHECK_EQ(fx.channel->read(50, 100, result, fx.options), ESP_OK);
+  const int64_t stop_us = fx.clock.nowUs();
+
+  CHECK_EQ(result.stop_reason, StopReason::Cancelled);
+  CHECK(result.partial);
+  CHECK_EQ(result.sample_count, 13);
+  CHECK_GE(fx.cancelled_at_us, 0);
+  // the rest of the 10 ms slice the cancel fell into
+  CHECK_LE(stop_us - fx.cancelled_at_us, POLL_US);
+  CHECK_EQ(fx.token.lastLatencyUs(), stop_us - fx.cancelled_at_us);
+
+  // a token that is still set stops the next read before its first sample
+  CHECK_EQ(fx.channel->read(50, 100, result, fx.options),
+           ESP_ERR_INVALID_STATE);
+  CHECK_EQ(result.stop_reason, StopReason::Cancelled);
+  CHECK(result.partial);
+  CHECK_EQ(result.sample_count, 0);
+  CHECK_EQ(fx.clock.nowUs(), stop_us);
+  CHECK_EQ(fx.token.lastLatencyUs(), stop_us - fx.cancelled_at_us);
+
+  // after reset() the token lets a read complete
+  fx.token.reset();
+  CHECK_EQ(fx.channel->read(5, 1, result, fx.options), ESP_OK);
+  CHECK_EQ(result.stop_reason, StopReason::Complete);
+  CHECK(!result.partial);
+  CHECK_EQ(result.sample_count, 5);
+}
+
+/// @brief a cancel during a conversion, without a delay between samples,
+/// keeps that sample and is seen before the next conversion
+void testReadCancelledBetweenSamples() {
+  Fixture fx;
+  fx.cancel_at_us = fx.clock.nowUs() + 100 * CONVERSION_US;
+  ADCReadResult result;
+  CHECK_EQ(fx.channel->read(1000, 0, result, fx.options), ESP_OK);
+  CHECK_EQ(result.stop_reason, StopReason::Cancelled);
+  CHECK(result.partial);
+  CHECK_EQ(result.sample_count, 100); // conversions end 20 us apart
+  CHECK_LE(fx.token.lastLatencyUs(), CONVERSION_US);
+}
+
+void testReadDeadline() {
+  Fixture fx;
+  const int64_t start_us = fx.clock.nowUs();
+  fx.options.cancel = nullptr;
+  fx.options.deadline_us = start_us + 1234567;
+  ADCReadResult result;
+  CHECK_EQ(fx.channel->read(50, 100, result, fx.options), ESP_OK);
+  const int64_t stop_us = fx.clock.nowUs();
+
+  CHECK_EQ(result.stop_reason, StopReason::Deadline);
+  CHECK(result.partial);
+  CHECK_EQ(result.sample_count, 13);
+  CHECK_GE(stop_us, fx.options.deadline_us);
+  CHECK_LE(stop_us - fx.options.deadline_us, POLL_US);
+
+  // a deadline already past: nothing is converted
+  CHECK_EQ(fx.channel->read(50, 100, result, fx.options), ESP_ERR_TIMEOUT);
+  CHECK_EQ(result.stop_reason, StopReason::Deadline);
+  CHECK_EQ(result.sample_count, 0);
+}
+
+/// @brief a 1 s capture at 20 kHz, cancelled from the conversion at 300 ms
+void testCaptureCancelled() {
+  Fixture fx;
+  const uint32_t rate = fx.unit->continuousConfig().sample_freq_hz;
+  const int64_t frame = fx.unit->continuousConfig().conv_frame_size / 2;
+  const int64_t frame_us = frame * 1000000 / rate;
+  const int64_t start_us = fx.clock.nowUs();
+  fx.cancel_at_us = start_us + 300000;
+  CaptureInfo info;
+  std::vector<int> samples =
+      fx.channel->sampleForDuration(1000, fx.options, &info);
+  const int64_t stop_us = fx.clock.nowUs();
+
+  CHECK_EQ(info.stop_reason, StopReason::Cancelled);
+  CHECK(info.partial);
+  CHECK_EQ(info.error, ESP_OK);
+  CHECK_EQ(samples.size(), info.samples);
+  CHECK_GE(fx.cancelled_at_us, fx.cancel_at_us);
+  // stopped at the latest after the frame the cancel fell into
+  CHECK_LE(stop_us - fx.cancelled_at_us, frame_us);
+  CHECK_EQ(fx.token.lastLatencyUs(), stop_us - fx.cancelled_at_us);
+  CHECK_LE(info.elapsed_us, 300000 + 2 * frame_us);
+  CHECK_GE((int64_t)info.samples, 300000 * rate / 1000000 - frame);
+  CHECK_LE((int64_t)info.samples, info.elapsed_us * rate / 1000000);
+
+  // a token that is still set stops the next capture before its first frame
+  samples = fx.channel->sampleForDuration(1000, fx.options, &info);
+  CHECK_EQ(info.stop_reason, StopReason::Cancelled);
+  CHECK(info.partial);
+  CHECK_EQ(info.samples, 0);
+  CHECK_EQ(samples.size(), 0);
+}
+
+void testCaptureDeadline() {
+  Fixture fx;
+  const uint32_t rate = fx.unit->continuousConfig().sample_freq_hz;
+  const int64_t frame = fx.unit->continuousConfig().conv_frame_size / 2;
+  const int64_t frame_us = frame * 1000000 / rate;
+  fx.options.cancel = nullptr;
+  fx.options.deadline_us = fx.clock.nowUs() + 500000;
+  CaptureInfo info;
+  std::vector<int> samples =
+      fx.channel->sampleForDuration(1000, fx.options, &info);
+  const int64_t stop_us = fx.clock.nowUs();
+
+  CHECK_EQ(info.stop_reason, StopReason::Deadline);
+  CHECK(info.partial);
+  CHECK_EQ(samples.size(), info.samples);
+  CHECK_GE(stop_us, fx.options.deadline_us);
+  CHECK_LE(stop_us - fx.options.deadline_us, frame_us);
+  CHECK_GE((int64_t)info.samples, 500000 * rate / 1000000 - frame);
+}
+} // namespace
+
+int main() {
+  testReadCancelled();
+  testReadCancelledBetweenSamples();
+  testReadDeadline();
+  testCaptureCancelled();
+  testCaptureDeadline();
+  return ED_ADC_test::testResult();
+}
@@ -0,0 +1,157 @@
+// A 10 s continuous capture at 20 kHz on a SimDriver and a VirtualClock,
+// checked sample by sample: every code is a fixed-seed function of the time
+// it was converted at, so counts, timestamps and overflow losses are exact.
+#include "ED_adc.h"
+#include "test_check.h"
+#include <vector>
+
+using namespace ED_ADC;
+
+namespace {
+constexpr uint64_t SEED = 0x5eed0082;
+
+/// @brief the code converted at t_us (splitmix64 of seed and time)
+int codeAt(int64_t t_us) {
+  uint64_t z = SEED + (uint64_t)t_us * 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return (int)((z ^ (z >> 31)) & 0xFFF);
+}
+
+class Fixture {
+public:
+  Fixture() : sim(clock) {
+    sim.setSignal([](adc_channel_t, int64_t t_us) { return codeAt(t_us); });
+    unit = ADCUnit::create(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim);
+    channel = ADCChannel::create(unit.get(), ADC_CHANNEL_0, ADC_ATTEN_DB_12);
+    const ContinuousConfig &config = unit->continuousConfig();
+    period_us = 1000000 / config.sample_freq_hz;
+    frame = config.conv_frame_size / 2;
+    frame_us = frame * period_us;
+  }
+
+  VirtualClock clock;
+  SimDriver sim;
+  std::unique_ptr<ADCUnit> unit;
+  std::unique_ptr<ADCChannel> channel;
+  int64_t period_us;
+  int64_t frame; // samples
+  int64_t frame_us;
+};
+
+constexpr uint32_t DURATION_MS = 10000;
+
+/// @brief frames and codes of captureFrames() against the simulated time
+void testCaptureFrames() {
+  Fixture fx;
+  CHECK_EQ(fx.period_us, 50);
+  CHECK_EQ(fx.frame_us, 6400);
+  const int64_t start_us = fx.clock.nowUs();
+  int64_t frames = 0;
+  int64_t samples = 0;
+  int64_t wrong_times = 0;
+  int64_t wrong_codes = 0;
+  CaptureInfo info;
+  esp_err_t err = fx.channel->captureFrames(
+      DURATION_MS,
+      [&](const uint16_t *codes, size_t count, int64_t t_us) {
+        frames++;
+        wrong_times += t_us != start_us + frames * fx.frame_us ||
+                       (int64_t)count != fx.frame;
+        for (size_t i = 0; i < count; i++) {
+          samples++;
+          wrong_codes += codes[i] != codeAt(start_us + samples * fx.period_us);
+        }
+      },
+      {}, &info);
+  CHECK_EQ(err, ESP_OK);
+  CHECK_EQ(wrong_times, 0);
+  CHECK_EQ(wrong_codes, 0);
+
+  // 10 s are 1562.5 frames: the read after frame 1562 waits for the next
+  // one past the end of the capture, which then stops
+  const int64_t whole_frames = DURATION_MS * 1000LL / fx.frame_us;
+  CHECK_EQ(whole_frames, 1562);
+  CHECK_EQ(frames, whole_frames);
+  CHECK_EQ(info.samples, whole_frames * fx.frame);
+  CHECK_EQ(samples, info.samples);
+  CHECK_EQ(info.elapsed_us, (whole_frames + 1) * fx.frame_us);
+  CHECK_EQ(fx.clock.nowUs() - start_us, info.elapsed_us);
+  CHECK(!info.partial);
+  CHECK_EQ(info.stop_reason, StopReason::Complete);
+  CHECK_EQ(info.overflows, 0);
+  CHECK_EQ(info.recoveries, 0);
+  CHECK_EQ(info.first_gap_index, -1);
+  const SimStats stats = fx.sim.stats();
+  CHECK_EQ(stats.samples_dropped, 0);
+  // the converter stopped before the last wait produced its frame
+  CHECK_EQ(stats.samples_produced, whole_frames * fx.frame);
+}
+
+/// @brief two runs of sampleForDuration() give the same millivolts
+void testSampleForDurationRepeats() {
+  std::vector<int> runs[2];
+  for (std::vector<int> &mv : runs) {
+    Fixture fx;
+    const int64_t start_us = fx.clock.nowUs();
+    CaptureInfo info;
+    mv = fx.channel->sampleForDuration(DURATION_MS, {}, &info);
+    CHECK_EQ(info.expected_samples, 200000);
+    CHECK_EQ(info.samples, 1562 * fx.frame);
+    CHECK_EQ(mv.size(), info.samples);
+    CHECK_EQ(info.decimation, 1);
+    CHECK(!info.partial);
+    int64_t wrong = 0;
+    for (size_t i = 0; i < mv.size(); i++) {
+      const int64_t t_us = start_us + (int64_t)(i + 1) * fx.period_us;
+      wrong += mv[i] != fx.channel->rawToVoltage(codeAt(t_us));
+    }
+    CHECK_EQ(wrong, 0);
+  }
+  CHECK(runs[0] == runs[1]);
+}
+
+/// @brief a consumer that stalls for 50 ms after frame 10: the 1024-byte
+/// pool keeps the first 512 samples of the stall and drops the other 488
+void testOverflow() {
+  Fixture fx;
+  const int64_t stall_us = 50000;
+  const int64_t start_us = fx.clock.nowUs();
+  const int64_t kept = 512;
+  const int64_t dropped = stall_us / fx.period_us - kept;
+  const int64_t before = 10 * fx.frame;
+  int64_t frames = 0;
+  int64_t samples = 0;
+  int64_t wrong_codes = 0;
+  CaptureInfo info;
+  fx.channel->captureFrames(
+      1000,
+      [&](const uint16_t *codes, size_t count, int64_t) {
+        for (size_t i = 0; i < count; i++) {
+          // after the stall, the dropped samples are missing
+          const int64_t n = samples + (samples < before + kept ? 0 : dropped);
+          wrong_codes += codes[i] != codeAt(start_us + (n + 1) * fx.period_us);
+          samples++;
+        }
+        if (++frames == 10) {
+          fx.clock.advanceUs(stall_us);
+        }
+      },
+      {}, &info);
+  CHECK_EQ(wrong_codes, 0);
+  CHECK_EQ(dropped, 488);
+  CHECK_EQ(fx.sim.stats().samples_dropped, dropped);
+  CHECK_EQ(fx.sim.stats().pool_overflows, 1);
+  CHECK_EQ(info.overflows, 1);
+  CHECK_EQ(info.recoveries, 0); // 50 ms is within frame_timeout_ms
+  CHECK(!info.partial);
+  CHECK_EQ(info.samples, samples);
+}
+} // namespace
+
+int main() {
+  testCaptureFrames();
+  testSampleForDurationRepeats();
+  testOverflow();
+  return ED_ADC_test::testResult();
+}
@@ -0,0 +1,48 @@
+// Checks shared by the host tests: a failed check prints its line and the
+// values, the test goes on, and main() returns testResult().
+#pragma once
+#include <cstdio>
+#include <cstring>
+
+namespace ED_ADC_test {
+
+inline int failures = 0;
+
+inline const char *baseName(const char *path) {
+  const char *slash = strrchr(path, '/');
+  return slash ? slash + 1 : path;
+}
+
+inline void check(bool ok, long long actual, const char *op,
+                  long long expected, const char *what, const char *file,
+                  int line) {
+  if (ok)
+    return;
+  failures++;
+  fprintf(stderr, "%s:%d: %s is %lld, expected %s %lld\n", baseName(file),
+          line, what, actual, op, expected);
+}
+
+/// @brief prints the outcome; the exit status of the test
+inline int testResult() {
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  printf("all passed\n");
+  return 0;
+}
+
+} // namespace ED_ADC_test
+
+#define ED_ADC_CHECK_OP(actual, op, expected)                                  \
+  do {                                                                         \
+    const long long actual_ = (long long)(actual);                             \
+    const long long expected_ = (long long)(expected);                         \
+    ED_ADC_test::check(actual_ op expected_, actual_, #op, expected_,          \
+                       #actual, __FILE__, __LINE__);                           \
+  } while (0)
+#define CHECK_EQ(actual, expected) ED_ADC_CHECK_OP(actual, ==, expected)
+#define CHECK_LE(actual, expected) ED_ADC_CHECK_OP(actual, <=, expected)
+#define CHECK_GE(actual, expected) ED_ADC_CHECK_OP(actual, >=, expected)
+#define CHECK(condition) CHECK_EQ((bool)(condition), true)
@@ -0,0 +1,276 @@
+// Error paths of captureFrames() and read() on a FaultInjectingDriver over
+// a SimDriver: single timeouts, read errors, overflows and stalls injected
+// at given driver calls, and the CaptureInfo / ADCReadResult they lead to.
+#include "ED_adc.h"
+#include "test_check.h"
+#include <map>
+
+using namespace ED_ADC;
+
+namespace {
+
+/// @brief injects the faults of a script: call n of oneshotRead() or
+/// continuousRead() runs with the FaultConfig given for it, every other
+/// call with the fallback (rates of 1 make a fault certain)
+class ScriptedFaults : public FaultInjectingDriver {
+public:
+  explicit ScriptedFaults(Driver &inner) : FaultInjectingDriver(inner) {}
+
+  std::map<uint32_t, FaultConfig> oneshot;
+  std::map<uint32_t, FaultConfig> continuous;
+  FaultConfig fallback;
+
+  esp_err_t oneshotRead(adc_oneshot_unit_handle_t handle,
+                        adc_channel_t channel, int *raw) override {
+    use(oneshot, _oneshot_calls++);
+    return FaultInjectingDriver::oneshotRead(handle, channel, raw);
+  }
+  esp_err_t continuousRead(adc_continuous_handle_t handle, uint8_t *buffer,
+                           uint32_t length, uint32_t *bytes_read,
+                           uint32_t timeout_ms) override {
+    use(continuous, _continuous_calls++);
+    return FaultInjectingDriver::continuousRead(handle, buffer, length,
+                                                bytes_read, timeout_ms);
+  }
+
+private:
+  void use(const std::map<uint32_t, FaultConfig> &script, uint32_t call) {
+    auto it = script.find(call);
+    setConfig(it != script.end() ? it->second : fallback);
+  }
+
+  uint32_t _oneshot_calls = 0;
+  uint32_t _continuous_calls = 0;
+};
+
+FaultConfig timeout() {
+  FaultConfig config;
+  config.oneshot_timeout_rate = 1.0f;
+  config.read_timeout_rate = 1.0f;
+  return config;
+}
+
+FaultConfig readError() {
+  FaultConfig config;
+  config.oneshot_error_rate = 1.0f;
+  config.read_error_rate = 1.0f;
+  return config;
+}
+
+FaultConfig overflow() {
+  FaultConfig config;
+  config.overflow_rate = 1.0f;
+  return config;
+}
+
+FaultConfig stall() {
+  FaultConfig config;
+  config.stall_rate = 1.0f;
+  return config;
+}
+
+class Fixture {
+public:
+  Fixture() : sim(clock), faults(sim) {
+    unit = ADCUnit::create(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, faults);
+    channel = ADCChannel::create(unit.get(), ADC_CHANNEL_0, ADC_ATTEN_DB_12);
+    frame = unit->continuousConfig().conv_frame_size / 2;
+  }
+
+  /// @brief 1 s capture (it always starts here, faults only show in info);
+  /// returns the samples delivered
+  uint64_t capture(CaptureInfo &info, const CaptureOptions &options = {}) {
+    uint64_t delivered = 0;
+    esp_err_t err = channel->captureFrames(
+        1000, [&](const uint16_t *, size_t count, int64_t) {
+          delivered += count;
+        },
+        options, &info);
+    CHECK_EQ(err, ESP_OK);
+    return delivered;
+  }
+
+  VirtualClock clock;
+  SimDriver sim;
+  ScriptedFaults faults;
+  std::unique_ptr<ADCUnit> unit;
+  std::unique_ptr<ADCChannel> channel;
+  int64_t frame;
+};
+
+// SimDriver answers every other continuous read with a frame: call 2k waits
+// for frame k and times out, call 2k + 1 delivers it. 1 s holds 156 whole
+// frames of 6.4 ms
+constexpr uint32_t FRAME_10_CALL = 21;
+constexpr int64_t FRAMES = 156;
+
+void testCaptureWithoutFaults() {
+  Fixture fx;
+  CaptureInfo info;
+  CHECK_EQ(fx.capture(info), FRAMES * fx.frame);
+  CHECK_EQ(info.samples, FRAMES * fx.frame);
+  CHECK_EQ(info.overflows, 0);
+  CHECK_EQ(info.read_errors, 0);
+  CHECK_EQ(info.recoveries, 0);
+  CHECK_EQ(info.first_gap_index, -1);
+  CHECK_EQ(info.stop_reason, StopReason::Complete);
+}
+
+/// @brief a poll that times out keeps the data for the next one
+void testCaptureTimeout() {
+  Fixture fx;
+  fx.faults.continuous[FRAME_10_CALL] = timeout();
+  CaptureInfo info;
+  CHECK_EQ(fx.capture(info), FRAMES * fx.frame);
+  CHECK_EQ(fx.faults.stats().read_timeouts, 1);
+  CHECK_EQ(info.read_errors, 0); // timeouts are not errors
+  CHECK_EQ(info.recoveries, 0);
+  CHECK(!info.partial);
+}
+
+/// @brief a failed read is counted, the next one gets the frame
+void testCaptureReadError() {
+  Fixture fx;
+  fx.faults.continuous[FRAME_10_CALL] = readError();
+  CaptureInfo info;
+  CHECK_EQ(fx.capture(info), FRAMES * fx.frame);
+  CHECK_EQ(info.read_errors, 1);
+  CHECK_EQ(info.recoveries, 0);
+  CHECK_EQ(info.first_gap_index, -1);
+  CHECK_EQ(info.stop_reason, StopReason::Complete);
+  CHECK_EQ(info.error, ESP_OK);
+}
+
+/// @brief max_read_errors failures in a row restart the driver
+void testCaptureFailingReads() {
+  Fixture fx;
+  CaptureOptions options;
+  for (uint32_t i = 0; i < options.max_read_errors; i++) {
+    fx.faults.continuous[FRAME_10_CALL + i] = readError();
+  }
+  CaptureInfo info;
+  const uint64_t delivered = fx.capture(info, options);
+  CHECK_EQ(info.read_errors, options.max_read_errors);
+  CHECK_EQ(info.recoveries, 1);
+  CHECK_EQ(info.first_gap_index, 10 * fx.frame);
+  // the wait of call 20, the failing reads took no time
+  CHECK_EQ(info.downtime_us, 6400);
+  CHECK_EQ(fx.unit->recoveryStats().recoveries, 1);
+  CHECK_EQ(info.samples, delivered);
+  CHECK_EQ(info.stop_reason, StopReason::Complete);
+  CHECK(!info.partial);
+}
+
+/// @brief an overflow loses the frame of that read
+void testCaptureOverflow() {
+  Fixture fx;
+  fx.faults.continuous[FRAME_10_CALL] = overflow();
+  CaptureInfo info;
+  CHECK_EQ(fx.capture(info), (FRAMES - 1) * fx.frame);
+  CHECK_EQ(info.overflows, 1);
+  CHECK_EQ(fx.faults.stats().overflows, 1);
+  CHECK_EQ(info.recoveries, 0);
+  CHECK_EQ(info.first_gap_index, -1);
+  CHECK(!info.partial);
+}
+
+/// @brief a stalled driver is restarted after frame_timeout_ms
+void testCaptureStall() {
+  Fixture fx;
+  fx.faults.continuous[FRAME_10_CALL] = stall();
+  CaptureOptions options;
+  CaptureInfo info;
+  const uint64_t delivered = fx.capture(info, options);
+  const int64_t timeout_us = options.frame_timeout_ms * 1000LL;
+  const int64_t frame_us = fx.frame * 50;
+  CHECK_EQ(fx.faults.stats().stalls, 1);
+  CHECK_EQ(info.recoveries, 1);
+  CHECK_EQ(info.first_gap_index, 10 * fx.frame);
+  CHECK_GE(info.downtime_us, timeout_us);
+  CHECK_LE(info.downtime_us, timeout_us + frame_us);
+  CHECK_EQ(info.samples, delivered);
+  CHECK_LE((int64_t)delivered,
+           (1000000 - info.downtime_us) / frame_us * fx.frame);
+  CHECK(!info.partial);
+}
+
+/// @brief a driver that stalls after every restart ends the capture
+void testCaptureUnrecoverable() {
+  Fixture fx;
+  fx.faults.fallback = stall();
+  CaptureOptions options;
+  CaptureInfo info;
+  fx.capture(info, options);
+  CHECK_EQ(info.recoveries, options.max_recoveries);
+  CHECK_EQ(info.first_gap_index, 0);
+  CHECK_EQ(info.samples, 0);
+  CHECK_EQ(info.stop_reason, StopReason::Fault);
+  CHECK(info.partial);
+  CHECK_EQ(info.error, ESP_FAIL);
+}
+
+/// @brief a timeout on sample 5 is retried after backoff_ms
+void testReadRetry() {
+  Fixture fx;
+  fx.faults.oneshot[5] = timeout();
+  CaptureOptions options;
+  options.retry.max_retries = 2;
+  ADCReadResult result;
+  const int64_t start_us = fx.clock.nowUs();
+  CHECK_EQ(fx.channel->read(20, 0, result, options), ESP_OK);
+  CHECK_EQ(result.sample_count, 20);
+  CHECK_EQ(result.error_count, 1);
+  CHECK_EQ(result.skipped_count, 0);
+  CHECK(!result.partial);
+  // the injected timeout fails without converting: 20 conversions of
+  // 20 us and one backoff
+  CHECK_EQ(fx.clock.nowUs() - start_us,
+           20 * 20 + options.retry.backoff_ms * 1000);
+}
+
+/// @brief a sample whose retries all fail is skipped, or ends the read
+void testReadSkipAndAbort() {
+  Fixture fx;
+  for (uint32_t call = 5; call < 8; call++) {
+    fx.faults.oneshot[call] = readError();
+  }
+  CaptureOptions options;
+  options.retry.max_retries = 2;
+  options.retry.skip_failed = true;
+  ADCReadResult result;
+  const int64_t start_us = fx.clock.nowUs();
+  CHECK_EQ(fx.channel->read(20, 0, result, options), ESP_OK);
+  CHECK_EQ(result.sample_count, 19);
+  CHECK_EQ(result.error_count, 3);
+  CHECK_EQ(result.skipped_count, 1);
+  CHECK_EQ(result.stop_reason, StopReason::Complete);
+  CHECK(!result.partial);
+  // injected errors fail before converting; backoff 1 ms, then 2 ms
+  CHECK_EQ(fx.clock.nowUs() - start_us, 19 * 20 + 3000);
+
+  // the same faults without skipping: the read keeps its first 5 samples
+  Fixture abort;
+  for (uint32_t call = 5; call < 8; call++) {
+    abort.faults.oneshot[call] = readError();
+  }
+  options.retry.skip_failed = false;
+  CHECK_EQ(abort.channel->read(20, 0, result, options), ESP_FAIL);
+  CHECK_EQ(result.sample_count, 5);
+  CHECK_EQ(result.error_count, 3);
+  CHECK_EQ(result.stop_reason, StopReason::Fault);
+  CHECK(result.partial);
+}
+} // namespace
+
+int main() {
+  testCaptureWithoutFaults();
+  testCaptureTimeout();
+  testCaptureReadError();
+  testCaptureFailingReads();
+  testCaptureOverflow();
+  testCaptureStall();
+  testCaptureUnrecoverable();
+  testReadRetry();
+  testReadSkipAndAbort();
+  return ED_ADC_test::testResult();
+}
@@ -0,0 +1,298 @@
+// DataLogger and LogReader round trips on RamLogStorage and FileLogStorage:
+// record contents, overwriting of the oldest segments, resuming after a new
+// logger is created, skipping of corrupt pages, write amplification, and
+// the read order after the page sequence wraps around.
+#include "ED_adc_log.h"
+#include "ED_adc_stream.h"
+#include "test_check.h"
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unistd.h>
+
+using namespace ED_ADC;
+
+namespace {
+constexpr size_t SMALL_PAGE = 256; // 5 results per page
+constexpr size_t RESULTS_PER_SMALL_PAGE =
+    (SMALL_PAGE - LOG_PAGE_HEADER_SIZE) / (LOG_RECORD_HEADER_SIZE + 34);
+
+/// @brief the result logged as record i
+ADCReadResult resultOf(int i) {
+  ADCReadResult result = {};
+  result.average_mv = i;
+  result.min_mv = i - 100;
+  result.max_mv = i + 100;
+  result.p30_width_mv = i % 7;
+  result.p60_width_mv = i % 3;
+  result.sample_count = 1000 + i;
+  result.error_count = i % 2;
+  result.skipped_count = i % 5;
+  result.partial = i % 4 == 0;
+  result.stop_reason = result.partial ? StopReason::Deadline
+                                      : StopReason::Complete;
+  return result;
+}
+
+bool sameResult(const ADCReadResult &a, const ADCReadResult &b) {
+  return a.average_mv == b.average_mv && a.min_mv == b.min_mv &&
+         a.max_mv == b.max_mv && a.p30_width_mv == b.p30_width_mv &&
+         a.p60_width_mv == b.p60_width_mv &&
+         a.sample_count == b.sample_count &&
+         a.error_count == b.error_count &&
+         a.skipped_count == b.skipped_count && a.partial == b.partial &&
+         a.stop_reason == b.stop_reason;
+}
+
+/// @brief logs results first..last - 1 at t = i ms, writing as it goes
+void logResults(DataLogger &logger, int first, int last) {
+  for (int i = first; i < last; i++) {
+    CHECK(logger.logResult(1, resultOf(i), i * 1000LL));
+    logger.pump();
+  }
+  logger.flush();
+}
+
+/// @brief indexes of the result records, in read order; checks each one
+std::vector<int> readResults(LogStorage &storage,
+                             LogReaderStats *stats = nullptr) {
+  std::vector<int> indexes;
+  int wrong = 0;
+  LogReader reader(storage);
+  reader.forEach([&](const LogRecord &record) {
+    ADCReadResult result;
+    if (!LogReader::decodeResult(record, result)) {
+      wrong++;
+      return;
+    }
+    const int i = result.average_mv;
+    wrong += !sameResult(result, resultOf(i)) || record.t_us != i * 1000LL ||
+             record.channel_id != 1;
+    indexes.push_back(i);
+  });
+  CHECK_EQ(wrong, 0);
+  if (stats) {
+    *stats = reader.stats();
+  }
+  return indexes;
+}
+
+std::vector<int> range(int first, int last) {
+  std::vector<int> values;
+  for (int i = first; i < last; i++) {
+    values.push_back(i);
+  }
+  return values;
+}
+
+/// @brief a valid page without records, as a logger that ran up to
+/// sequence would have left it
+void writeEmptyPage(LogStorage &storage, size_t segment, uint32_t sequence) {
+  std::vector<uint8_t> page(storage.pageSize(), 0xFF);
+  const uint8_t header[LOG_PAGE_HEADER_SIZE] = {
+      LOG_PAGE_MAGIC & 0xFF, LOG_PAGE_MAGIC >> 8, 0, 0, LOG_VERSION, 0xFF,
+      (uint8_t)sequence, (uint8_t)(sequence >> 8), (uint8_t)(sequence >> 16),
+      (uint8_t)(sequence >> 24), LOG_PAGE_HEADER_SIZE, 0};
+  std::copy(header, header + sizeof(header), page.begin());
+  const uint16_t crc = streamCrc16(&page[4], LOG_PAGE_HEADER_SIZE - 4);
+  page[2] = crc & 0xFF;
+  page[3] = crc >> 8;
+  CHECK_EQ(storage.erase(segment), ESP_OK);
+  CHECK_EQ(storage.writePage(segment, 0, page.data()), ESP_OK);
+}
+
+uint32_t pageSequence(LogStorage &storage, size_t segment, size_t page) {
+  std::vector<uint8_t> data(storage.pageSize());
+  storage.readPage(segment, page, data.data());
+  return data[6] | data[7] << 8 | data[8] << 16 | (uint32_t)data[9] << 24;
+}
+
+/// @brief results and a burst of samples come back as logged
+void testRoundTrip(LogStorage &storage) {
+  DataLogger logger(storage);
+  std::vector<uint16_t> codes(1001);
+  for (size_t i = 0; i < codes.size(); i++) {
+    codes[i] = (uint32_t)(i * 2654435761u) >> 20; // 12 bits
+  }
+  for (int i = 0; i < 20; i++) {
+    CHECK(logger.logResult(1, resultOf(i), i * 1000LL));
+    logger.pump();
+  }
+  const int64_t t0_us = 50000;
+  for (size_t done = 0; done < codes.size(); done += 100) {
+    const size_t count = std::min<size_t>(100, codes.size() - done);
+    CHECK_EQ(logger.logSamples(2, &codes[done], count,
+                               t0_us + (int64_t)done * 50, 50),
+             count);
+    logger.pump();
+  }
+  logger.flush();
+  CHECK_EQ(logger.stats().dropped_records, 0);
+  CHECK_EQ(logger.stats().write_errors, 0);
+
+  std::vector<int> results;
+  std::vector<uint16_t> samples;
+  int wrong = 0;
+  LogReader reader(storage);
+  reader.forEach([&](const LogRecord &record) {
+    ADCReadResult result;
+    uint32_t period = 0;
+    if (LogReader::decodeResult(record, result)) {
+      wrong += !sameResult(result, resultOf(result.average_mv));
+      results.push_back(result.average_mv);
+    } else {
+      wrong += record.t_us != t0_us + (int64_t)samples.size() * 50;
+      wrong += LogReader::decodeSamples(record, samples, &period) == 0 ||
+               period != 50 || record.channel_id != 2;
+    }
+  });
+  CHECK_EQ(wrong, 0);
+  CHECK(results == range(0, 20));
+  CHECK(samples == codes);
+  CHECK_EQ(reader.stats().records, logger.stats().records);
+  CHECK_EQ(reader.stats().pages, logger.stats().pages_written);
+  CHECK_EQ(reader.stats().corrupt_pages, 0);
+}
+
+/// @brief 100 results in 20 pages on a ring of 3 segments of 2 pages: the
+/// last 6 pages remain, the oldest data was overwritten
+void testWrap() {
+  RamLogStorage storage(3, 2, SMALL_PAGE);
+  DataLogger logger(storage);
+  logResults(logger, 0, 100);
+  CHECK_EQ(RESULTS_PER_SMALL_PAGE, 5);
+  CHECK_EQ(logger.stats().pages_written, 20);
+  CHECK_EQ(logger.stats().erases, 10);
+  CHECK(readResults(storage) == range(70, 100));
+}
+
+/// @brief each new logger continues after the newest page, in a fresh
+/// segment, and the reader sees one log. reopen() gives the storage as
+/// found after a reset
+void testResume(const std::function<LogStorage &()> &reopen) {
+  {
+    DataLogger logger(reopen());
+    logResults(logger, 0, 7); // 2 pages of segment 0
+  }
+  {
+    DataLogger logger(reopen());
+    logResults(logger, 7, 14);
+    CHECK_EQ(logger.stats().pages_written, 2);
+  }
+  LogStorage &storage = reopen();
+  {
+    DataLogger logger(storage);
+    logResults(logger, 14, 15);
+  }
+  CHECK_EQ(pageSequence(storage, 1, 0), 2);
+  CHECK_EQ(pageSequence(storage, 2, 0), 4);
+  LogReaderStats stats;
+  CHECK(readResults(storage, &stats) == range(0, 15));
+  CHECK_EQ(stats.pages, 5);
+}
+
+/// @brief a damaged page is skipped, the pages around it are read
+void testCorruptPage() {
+  RamLogStorage storage(4, 4, SMALL_PAGE);
+  DataLogger logger(storage);
+  logResults(logger, 0, 15); // pages 0 to 2 of segment 0
+  storage.data()[SMALL_PAGE + 40] ^= 0x10;
+  LogReaderStats stats;
+  std::vector<int> expected = range(0, 5);
+  for (int i = 10; i < 15; i++) {
+    expected.push_back(i);
+  }
+  CHECK(readResults(storage, &stats) == expected);
+  CHECK_EQ(stats.corrupt_pages, 1);
+  CHECK_EQ(stats.pages, 2);
+  CHECK_EQ(stats.records, 10);
+}
+
+/// @brief whole pages cost page size over the record bytes they hold; a
+/// page sealed after every record costs much more
+void testWriteAmplification() {
+  RamLogStorage storage(8, 8, 4096);
+  DataLogger logger(storage);
+  logResults(logger, 0, 1000);
+  const uint32_t per_page = (4096 - LOG_PAGE_HEADER_SIZE) / 46; // 88
+  const uint32_t pages = (1000 + per_page - 1) / per_page;
+  LoggerStats stats = logger.stats();
+  CHECK_EQ(stats.pages_written, pages);
+  CHECK_EQ(stats.logged_bytes, 1000 * 46);
+  CHECK_EQ(stats.bytes_written, pages * 4096);
+  CHECK(std::fabs(stats.write_amplification - pages * 4096.0 / 46000) <
+        1e-4);
+
+  RamLogStorage sealed_storage(8, 8, 4096);
+  DataLogger sealed(sealed_storage);
+  for (int i = 0; i < 10; i++) {
+    sealed.logResult(1, resultOf(i), i * 1000LL);
+    sealed.flush();
+  }
+  stats = sealed.stats();
+  CHECK_EQ(stats.pages_written, 10);
+  CHECK(std::fabs(stats.write_amplification - 4096.0 / 46) < 1e-3);
+}
+
+/// @brief a log whose page sequence passes 2^32 - 1 is read in write order,
+/// and a new logger resumes after its newest page
+void testSequenceWrap() {
+  RamLogStorage storage(4, 2, SMALL_PAGE);
+  writeEmptyPage(storage, 0, UINT32_MAX - 2);
+  {
+    DataLogger logger(storage);
+    logResults(logger, 0, 20); // sequences 2^32 - 2 to 1, segments 1 and 2
+  }
+  CHECK_EQ(pageSequence(storage, 1, 0), UINT32_MAX - 1);
+  CHECK_EQ(pageSequence(storage, 2, 0), 0);
+  CHECK(readResults(storage) == range(0, 20));
+
+  {
+    DataLogger logger(storage);
+    logResults(logger, 20, 21);
+  }
+  CHECK_EQ(pageSequence(storage, 3, 0), 2);
+  CHECK(readResults(storage) == range(0, 21));
+}
+} // namespace
+
+int main() {
+  RamLogStorage ram(4, 4, SMALL_PAGE);
+  testRoundTrip(ram);
+  testWrap();
+  RamLogStorage resumed(4, 4, SMALL_PAGE);
+  testResume([&]() -> LogStorage & { return resumed; });
+  testCorruptPage();
+  testWriteAmplification();
+  testSequenceWrap();
+
+  char dir[] = "/tmp/ed_adc_logXXXXXX";
+  if (!mkdtemp(dir)) {
+    perror("mkdtemp");
+    return 1;
+  }
+  const std::string prefix = std::string(dir) + "/segment";
+  auto removeFiles = [&] {
+    for (int i = 0; i < 4; i++) {
+      remove((prefix + std::to_string(i) + ".log").c_str());
+    }
+  };
+  {
+    FileLogStorage files(prefix.c_str(), 4, 4, SMALL_PAGE);
+    testRoundTrip(files);
+  }
+  removeFiles();
+  std::unique_ptr<FileLogStorage> files;
+  testResume([&]() -> LogStorage & {
+    files.reset();
+    files = std::make_unique<FileLogStorage>(prefix.c_str(), 4, 4,
+                                             SMALL_PAGE);
+    return *files;
+  });
+  files.reset();
+  removeFiles();
+  rmdir(dir);
+  return ED_ADC_test::testResult();
+}
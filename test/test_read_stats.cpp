@@ -0,0 +1,284 @@
+// Statistics of read(), readStreamed(), readHistogram() and CodeHistogram
+// on a SimDriver, compared with a reference that sorts the samples.
+// Usage: test_read_stats [seed]
+#include "ED_adc.h"
+#include "test_check.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace ED_ADC;
+
+namespace {
+using ED_ADC_test::failures;
+
+/// @brief the figures of a read, computed the plain way
+struct Reference {
+  int count;
+  int average;
+  int min;
+  int max;
+  int p30_width; // sorted[(n-1)*70/100] - sorted[(n-1)*30/100]
+  int p60_width; // sorted[(n-1)*60/100] - sorted[(n-1)*40/100]
+  std::vector<int> sorted;
+};
+
+Reference reference(std::vector<int> values) {
+  Reference ref = {};
+  std::sort(values.begin(), values.end());
+  const uint64_t last = values.size() - 1;
+  int64_t sum = 0;
+  for (int value : values) {
+    sum += value;
+  }
+  ref.count = (int)values.size();
+  ref.average = (int)(sum / (int64_t)values.size());
+  ref.min = values.front();
+  ref.max = values.back();
+  ref.p30_width = values[last * 70 / 100] - values[last * 30 / 100];
+  ref.p60_width = values[last * 60 / 100] - values[last * 40 / 100];
+  ref.sorted = std::move(values);
+  return ref;
+}
+
+/// @brief a channel whose oneshot conversions return codes in turn
+class Fixture {
+public:
+  Fixture() : sim(clock) {
+    sim.setSignal([this](adc_channel_t, int64_t) {
+      return codes[next++ % codes.size()];
+    });
+    unit = ADCUnit::create(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim);
+    channel = std::make_unique<ADCChannel>(unit.get(), ADC_CHANNEL_0,
+                                           ADC_ATTEN_DB_12);
+  }
+
+  /// @brief the next read starts with the first code again
+  void load(const std::vector<int> &values) {
+    codes = values;
+    next = 0;
+  }
+  void rewind() { next = 0; }
+  std::vector<int> millivolts() const {
+    std::vector<int> mv;
+    for (int code : codes) {
+      mv.push_back(channel->rawToVoltage(code));
+    }
+    return mv;
+  }
+
+  VirtualClock clock;
+  SimDriver sim;
+  std::unique_ptr<ADCUnit> unit;
+  std::unique_ptr<ADCChannel> channel;
+  std::vector<int> codes = {2048};
+  size_t next = 0;
+};
+
+void checkResult(const ADCReadResult &result, const Reference &ref,
+                 int line) {
+  if (result.sample_count != ref.count || result.average_mv != ref.average ||
+      result.min_mv != ref.min || result.max_mv != ref.max ||
+      result.p30_width_mv != ref.p30_width ||
+      result.p60_width_mv != ref.p60_width || result.partial) {
+    failures++;
+    fprintf(stderr,
+            "test_read_stats.cpp:%d: n=%d avg=%d min=%d max=%d p30=%d "
+            "p60=%d partial=%d, expected n=%d avg=%d min=%d max=%d p30=%d "
+            "p60=%d\n",
+            line, result.sample_count, result.average_mv, result.min_mv,
+            result.max_mv, result.p30_width_mv, result.p60_width_mv,
+            result.partial, ref.count, ref.average, ref.min, ref.max,
+            ref.p30_width, ref.p60_width);
+  }
+}
+
+/// @brief read(), readStreamed() and readHistogram() of the loaded codes
+/// against the reference
+void checkReads(Fixture &fx, int line) {
+  const int n = (int)fx.codes.size();
+  const Reference ref = reference(fx.millivolts());
+
+  ADCReadResult result;
+  fx.rewind();
+  CHECK_EQ(fx.channel->read(n, 0, result), ESP_OK);
+  checkResult(result, ref, line);
+
+  fx.rewind();
+  CHECK_EQ(fx.channel->readStreamed(n, 0, result), ESP_OK);
+  checkResult(result, ref, line);
+
+  const Reference raw = reference(fx.codes);
+  CodeHistogram hist;
+  fx.rewind();
+  CHECK_EQ(fx.channel->readHistogram(n, 0, hist), ESP_OK);
+  CHECK_EQ(hist.total(), n);
+  CHECK_EQ(hist.minValue(), raw.min);
+  CHECK_EQ(hist.maxValue(), raw.max);
+  CHECK_EQ(hist.percentileWidth(30), raw.p30_width);
+  CHECK_EQ(hist.percentileWidth(60), raw.p60_width);
+  for (int rank : {0, n / 3, n / 2, n - 1}) {
+    CHECK_EQ(hist.valueAtRank(rank), raw.sorted[rank]);
+  }
+}
+
+std::vector<int> randomCodes(std::mt19937 &rng, int n) {
+  std::vector<int> codes(n);
+  const int centre = std::uniform_int_distribution<int>(0, 4095)(rng);
+  const double spread = std::uniform_real_distribution<double>(0, 40)(rng);
+  std::normal_distribution<double> noise(centre, spread);
+  std::uniform_int_distribution<int> any(0, 4095);
+  const int shape = rng() % 3;
+  for (int &code : codes) {
+    if (shape == 0) {
+      code = any(rng);
+    } else if (shape == 1) {
+      code = std::clamp((int)noise(rng), 0, 4095);
+    } else {
+      // two levels, as a signal switching during the read
+      code = std::clamp((int)noise(rng) + (int)(rng() % 2) * 300, 0, 4095);
+    }
+  }
+  return codes;
+}
+
+void testRandomReads(std::mt19937 &rng) {
+  Fixture fx;
+  for (int i = 0; i < 300; i++) {
+    const int n = std::uniform_int_distribution<int>(1, 2000)(rng);
+    fx.load(randomCodes(rng, n));
+    checkReads(fx, __LINE__);
+  }
+}
+
+void testEdgeCases() {
+  Fixture fx;
+  fx.load({1234}); // n=1
+  checkReads(fx, __LINE__);
+  fx.load(std::vector<int>(1000, 1234)); // all equal
+  checkReads(fx, __LINE__);
+  fx.load({0}); // code 0
+  checkReads(fx, __LINE__);
+  fx.load({4095}); // full scale
+  checkReads(fx, __LINE__);
+
+  std::vector<int> rails;
+  for (int i = 0; i < 999; i++) {
+    rails.push_back(i % 2 ? 4095 : 0);
+  }
+  fx.load(rails);
+  checkReads(fx, __LINE__);
+  ADCReadResult result;
+  fx.rewind();
+  fx.channel->read((int)rails.size(), 0, result);
+  CHECK_EQ(result.min_mv, 0);
+  CHECK_EQ(result.max_mv, fx.channel->rawToVoltage(4095));
+  CHECK_EQ(result.p30_width_mv, fx.channel->rawToVoltage(4095));
+}
+
+/// @brief enough full-scale samples that their sum exceeds 32 bits
+void testSumOverflow() {
+  Fixture fx;
+  const int full_mv = fx.channel->rawToVoltage(4095);
+  const int n = (int)(UINT32_MAX / full_mv) + 1000;
+  fx.load({4095, 4094});
+  const int64_t mv_sum = (int64_t)(n / 2) * full_mv +
+                         (int64_t)(n / 2) * fx.channel->rawToVoltage(4094);
+  const int average = (int)(mv_sum / n);
+
+  ADCReadResult result;
+  CHECK_EQ(fx.channel->read(n, 0, result), ESP_OK);
+  CHECK_EQ(result.sample_count, n);
+  CHECK_EQ(result.average_mv, average);
+  fx.rewind();
+  CHECK_EQ(fx.channel->readStreamed(n, 0, result), ESP_OK);
+  CHECK_EQ(result.sample_count, n);
+  CHECK_EQ(result.average_mv, average);
+}
+
+void testHistogram(std::mt19937 &rng) {
+  for (int i = 0; i < 200; i++) {
+    const uint16_t width = 1 + rng() % 8;
+    CodeHistogram a(HistogramUnit::Millivolts, width);
+    CodeHistogram b(HistogramUnit::Millivolts, width);
+    std::vector<int> binned;
+    uint64_t clipped = 0;
+    const int n = 1 + rng() % 3000;
+    for (int j = 0; j < n; j++) {
+      // a few values beyond either end of the bins
+      const int value = std::uniform_int_distribution<int>(
+          -50, (int)CodeHistogram::BINS * width + 50)(rng);
+      (j % 2 ? a : b).add(value);
+      const int bin = std::clamp(value / width, 0,
+                                 (int)CodeHistogram::BINS - 1);
+      clipped += value < 0 || value / width >= (int)CodeHistogram::BINS;
+      binned.push_back(bin * width);
+    }
+    CHECK_EQ(a.merge(b), ESP_OK);
+    const Reference ref = reference(binned);
+    CHECK_EQ(a.total(), n);
+    CHECK_EQ(a.clipped(), clipped);
+    CHECK_EQ(a.minValue(), ref.min);
+    CHECK_EQ(a.maxValue(), ref.max);
+    CHECK_EQ(a.percentileWidth(30), ref.p30_width);
+    CHECK_EQ(a.percentileWidth(60), ref.p60_width);
+    const int rank = rng() % n;
+    CHECK_EQ(a.valueAtRank(rank), ref.sorted[rank]);
+
+    std::vector<uint8_t> packed(a.encode(nullptr, 0));
+    CHECK_EQ(a.encode(packed.data(), packed.size()), packed.size());
+    CodeHistogram decoded;
+    CHECK_EQ(CodeHistogram::decode(packed.data(), packed.size(), decoded),
+             true);
+    CHECK_EQ(decoded.binWidth(), width);
+    CHECK_EQ(decoded.total(), a.total());
+    CHECK_EQ(decoded.clipped(), a.clipped());
+    for (size_t bin = 0; bin < CodeHistogram::BINS; bin++) {
+      if (decoded.count(bin) != a.count(bin)) {
+        CHECK_EQ(decoded.count(bin), a.count(bin));
+        break;
+      }
+    }
+  }
+}
+
+void testPercentileRanks(std::mt19937 &rng) {
+  for (int i = 0; i < 100000; i++) {
+    const uint64_t n = 1 + (rng() % 2 ? rng() % 100 : (uint64_t)rng() << 8);
+    const int8_t p = 10 + rng() % 81;
+    const int low_p = std::min<int>(p, 100 - p);
+    uint64_t lower, upper;
+    percentileRanks(n, p, lower, upper);
+    if (lower > upper || upper >= n || lower != (n - 1) * low_p / 100 ||
+        upper != (n - 1) * (100 - low_p) / 100) {
+      failures++;
+      fprintf(stderr, "percentileRanks(%llu, %d) = %llu, %llu\n",
+              (unsigned long long)n, p, (unsigned long long)lower,
+              (unsigned long long)upper);
+      return;
+    }
+  }
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  const unsigned seed = argc > 1 ? (unsigned)strtoul(argv[1], nullptr, 0)
+                                  : std::random_device{}();
+  printf("seed %u\n", seed);
+  std::mt19937 rng(seed);
+
+  testRandomReads(rng);
+  testEdgeCases();
+  testSumOverflow();
+  testHistogram(rng);
+  testPercentileRanks(rng);
+
+  if (failures) {
+    printf("%d failures (seed %u)\n", failures, seed);
+    return 1;
+  }
+  printf("all passed\n");
+  return 0;
+}
@@ -0,0 +1,191 @@
+// The unit registry behind ADCUnit::create() and ADCUnit::acquire(): shared
+// units and their reference counts, the driver unit being deleted with the
+// last reference, re-acquiring after a release, create/acquire conflicts,
+// ULP mode mismatches, and acquire/release cycles on several threads.
+#include "ED_adc.h"
+#include "test_check.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace ED_ADC;
+
+namespace {
+
+/// @brief a SimDriver that counts its oneshot units and, like the ESP-IDF
+/// driver, refuses a unit that is already open
+class CountingDriver : public SimDriver {
+public:
+  explicit CountingDriver(VirtualClock &clock) : SimDriver(clock) {}
+
+  esp_err_t oneshotNewUnit(adc_unit_t unit, adc_ulp_mode_t ulp_mode,
+                           adc_oneshot_unit_handle_t *handle) override {
+    if (open[unit].exchange(true))
+      return ESP_ERR_NOT_FOUND;
+    created++;
+    const int live = ++live_units;
+    int peak = peak_units.load();
+    while (live > peak && !peak_units.compare_exchange_weak(peak, live)) {
+    }
+    return SimDriver::oneshotNewUnit(unit, ulp_mode, handle);
+  }
+  esp_err_t oneshotDelUnit(adc_oneshot_unit_handle_t handle) override {
+    // SimDriver hands out unit + 1 as the handle
+    open[(uintptr_t)handle - 1] = false;
+    deleted++;
+    live_units--;
+    return SimDriver::oneshotDelUnit(handle);
+  }
+
+  std::atomic<bool> open[2] = {};
+  std::atomic<int> created{0};
+  std::atomic<int> deleted{0};
+  std::atomic<int> live_units{0};
+  std::atomic<int> peak_units{0};
+};
+
+/// @brief acquire() hands out one instance per unit; channels keep it
+/// alive, and the driver unit goes with the last reference
+void testSharedUnit() {
+  VirtualClock clock;
+  CountingDriver sim(clock);
+  std::shared_ptr<ADCUnit> a =
+      ADCUnit::acquire(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim);
+  std::shared_ptr<ADCUnit> b =
+      ADCUnit::acquire(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim);
+  CHECK(a != nullptr);
+  CHECK(a == b);
+  CHECK_EQ(a.use_count(), 2);
+  CHECK_EQ(sim.created.load(), 1);
+
+  auto channel = ADCChannel::create(a, ADC_CHANNEL_0, ADC_ATTEN_DB_12);
+  CHECK_EQ(a.use_count(), 3);
+  a.reset();
+  b.reset();
+  CHECK_EQ(sim.deleted.load(), 0); // the channel still holds the unit
+  int mv = 0;
+  CHECK_EQ(channel->readVoltage(mv), ESP_OK);
+  // the same instance for a new caller while the channel lives
+  std::shared_ptr<ADCUnit> c =
+      ADCUnit::acquire(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim);
+  CHECK_EQ(c.use_count(), 2);
+  CHECK_EQ(sim.created.load(), 1);
+  c.reset();
+  channel.reset();
+  CHECK_EQ(sim.deleted.load(), 1);
+  CHECK_EQ(sim.live_units.load(), 0);
+
+  // released: the next acquire() opens the driver unit again
+  std::shared_ptr<ADCUnit> d =
+      ADCUnit::acquire(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim);
+  CHECK(d != nullptr);
+  CHECK_EQ(d.use_count(), 1);
+  CHECK_EQ(sim.created.load(), 2);
+}
+
+/// @brief create() and acquire() exclude each other per unit and driver;
+/// a released unit can be taken either way
+void testCreateAndAcquire() {
+  VirtualClock clock;
+  CountingDriver sim(clock);
+  CountingDriver other_sim(clock);
+  {
+    auto owned = ADCUnit::create(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim);
+    CHECK(owned != nullptr);
+    CHECK(ADCUnit::create(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim) == nullptr);
+    CHECK(ADCUnit::acquire(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim) ==
+          nullptr);
+    // another unit, or the same unit on another driver, is free
+    CHECK(ADCUnit::create(ADC_UNIT_2, ADC_ULP_MODE_DISABLE, sim) != nullptr);
+    CHECK(ADCUnit::acquire(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, other_sim) !=
+          nullptr);
+  }
+  CHECK_EQ(sim.live_units.load(), 0);
+  CHECK_EQ(other_sim.live_units.load(), 0);
+  {
+    auto shared = ADCUnit::acquire(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim);
+    CHECK(shared != nullptr);
+    CHECK(ADCUnit::create(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim) == nullptr);
+  }
+  CHECK(ADCUnit::create(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim) != nullptr);
+  // every refusal was the registry's, the driver never saw a second open
+  CHECK_EQ(sim.created.load(), sim.deleted.load());
+  CHECK_EQ(sim.created.load(), 4);
+}
+
+/// @brief a unit in use with one ULP mode is not handed out with another
+void testUlpModeMismatch() {
+  VirtualClock clock;
+  CountingDriver sim(clock);
+  {
+    auto unit = ADCUnit::acquire(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim);
+    CHECK(ADCUnit::acquire(ADC_UNIT_1, ADC_ULP_MODE_FSM, sim) == nullptr);
+    CHECK(ADCUnit::acquire(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim) == unit);
+  }
+  auto ulp = ADCUnit::acquire(ADC_UNIT_1, ADC_ULP_MODE_FSM, sim);
+  CHECK(ulp != nullptr);
+  CHECK(ADCUnit::acquire(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim) == nullptr);
+  CHECK_EQ(sim.created.load(), 2);
+}
+
+/// @brief many create/destroy and acquire/release cycles leak no entry and
+/// no driver unit
+void testCycles() {
+  VirtualClock clock;
+  CountingDriver sim(clock);
+  int failed = 0;
+  for (int i = 0; i < 1000; i++) {
+    if (i % 2 == 0) {
+      auto unit = ADCUnit::create(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim);
+      auto channel =
+          ADCChannel::create(unit.get(), ADC_CHANNEL_0, ADC_ATTEN_DB_12);
+      failed += !unit || !channel;
+    } else {
+      auto unit = ADCUnit::acquire(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim);
+      auto channel = ADCChannel::create(unit, ADC_CHANNEL_0, ADC_ATTEN_DB_12);
+      failed += !unit || !channel;
+    }
+  }
+  CHECK_EQ(failed, 0);
+  CHECK_EQ(sim.created.load(), 1000);
+  CHECK_EQ(sim.deleted.load(), 1000);
+}
+
+/// @brief threads acquiring and releasing the same unit: each acquire()
+/// either shares the live unit or waits for the last release to finish,
+/// so the driver never sees the unit opened twice
+void testConcurrentAcquire() {
+  VirtualClock clock;
+  CountingDriver sim(clock);
+  std::atomic<int> failed{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < 2000; i++) {
+        auto unit = ADCUnit::acquire(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim);
+        if (!unit) {
+          failed++;
+        }
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  CHECK_EQ(failed.load(), 0);
+  CHECK_EQ(sim.peak_units.load(), 1);
+  CHECK_EQ(sim.live_units.load(), 0);
+  CHECK_EQ(sim.created.load(), sim.deleted.load());
+}
+
+} // namespace
+
+int main() {
+  testSharedUnit();
+  testCreateAndAcquire();
+  testUlpModeMismatch();
+  testCycles();
+  testConcurrentAcquire();
+  return ED_ADC_test::testResult();
+}
@@ -0,0 +1,111 @@
+// measureSettling() on a SimDriver whose sampling capacitor keeps half of
+// the previous conversion: the learned discard count, the reads it makes
+// accurate after a channel switch, and the refusal of a channel on another
+// unit.
+#include "ED_adc.h"
+#include "test_check.h"
+#include <cstdlib>
+
+using namespace ED_ADC;
+
+namespace {
+constexpr int HIGH_CODE = 3000; // channel 0
+constexpr int LOW_CODE = 1000;  // channel 1
+
+class Fixture {
+public:
+  Fixture() : sim(clock) {
+    sim.setSignal([](adc_channel_t channel, int64_t) {
+      return channel == ADC_CHANNEL_0 ? HIGH_CODE : LOW_CODE;
+    });
+    sim.setChargeRetention(0.5f);
+    unit = ADCUnit::create(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim);
+    channel = ADCChannel::create(unit.get(), ADC_CHANNEL_0, ADC_ATTEN_DB_12);
+    other = ADCChannel::create(unit.get(), ADC_CHANNEL_1, ADC_ATTEN_DB_12);
+  }
+
+  /// @brief mV of channel read right after a conversion of other
+  int readAfterSwitch() {
+    int mv = 0;
+    other->readVoltage(mv);
+    CHECK_EQ(channel->readVoltage(mv), ESP_OK);
+    return mv;
+  }
+
+  VirtualClock clock;
+  SimDriver sim;
+  std::unique_ptr<ADCUnit> unit;
+  std::unique_ptr<ADCChannel> channel;
+  std::unique_ptr<ADCChannel> other;
+};
+
+/// @brief the error halves with every conversion after a switch: the
+/// discard count is where it falls within tolerance_mv, and applying it
+/// makes the first read after a switch accurate
+void testLearnedDiscard() {
+  Fixture fx;
+  const int settled_mv = fx.channel->rawToVoltage(HIGH_CODE);
+  CHECK_GE(std::abs(fx.readAfterSwitch() - settled_mv), 100);
+
+  SettlingConfig config;
+  SettlingResult result;
+  CHECK_EQ(fx.channel->measureSettling(*fx.other, result, config), ESP_OK);
+  CHECK_LE(std::abs(result.settled_mv - settled_mv), 1);
+  // once settled, a switch away takes the capacitor half way to 1000 and
+  // the first conversion back half way to 3000 again: 500 codes low (more
+  // on the first probe, which starts from the read above), halved with
+  // every further conversion, are within 2 mV after 8
+  const int error_mv = fx.channel->rawToVoltage(HIGH_CODE - 500) - settled_mv;
+  CHECK_LE(result.first_error_mv, error_mv);
+  CHECK_GE(result.first_error_mv, 2 * error_mv);
+  CHECK_EQ(result.discard, 8);
+  CHECK_EQ(fx.channel->settlingDiscard(), result.discard);
+
+  const uint32_t discarded = fx.channel->discardedSamples();
+  CHECK_LE(std::abs(fx.readAfterSwitch() - settled_mv),
+           config.tolerance_mv);
+  CHECK_EQ(fx.channel->discardedSamples() - discarded, result.discard);
+}
+
+/// @brief a probe that is not applied leaves the channel as it was
+void testWithoutApply() {
+  Fixture fx;
+  fx.channel->setSettlingDiscard(3);
+  SettlingConfig config;
+  config.apply = false;
+  SettlingResult result;
+  CHECK_EQ(fx.channel->measureSettling(*fx.other, result, config), ESP_OK);
+  CHECK_EQ(result.discard, 8);
+  CHECK_EQ(fx.channel->settlingDiscard(), 3);
+}
+
+/// @brief the other channel must be on the same unit, and the probe at
+/// least two conversions long
+void testInvalidArguments() {
+  Fixture fx;
+  auto adc2 = ADCUnit::create(ADC_UNIT_2, ADC_ULP_MODE_DISABLE, fx.sim);
+  auto elsewhere =
+      ADCChannel::create(adc2.get(), ADC_CHANNEL_0, ADC_ATTEN_DB_12);
+  fx.channel->setSettlingDiscard(3);
+  const uint64_t reads = fx.sim.stats().oneshot_reads;
+  SettlingResult result;
+  CHECK_EQ(fx.channel->measureSettling(*elsewhere, result),
+           ESP_ERR_INVALID_ARG);
+  CHECK_EQ(fx.sim.stats().oneshot_reads, reads); // nothing converted
+  CHECK_EQ(fx.channel->settlingDiscard(), 3);
+  CHECK_EQ(result.discard, 0);
+
+  SettlingConfig config;
+  config.samples = 1;
+  CHECK_EQ(fx.channel->measureSettling(*fx.other, result, config),
+           ESP_ERR_INVALID_ARG);
+}
+
+} // namespace
+
+int main() {
+  testLearnedDiscard();
+  testWithoutApply();
+  testInvalidArguments();
+  return ED_ADC_test::testResult();
+}
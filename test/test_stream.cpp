@@ -0,0 +1,248 @@
+// SampleStreamer looped back into a StreamDecoder through a MemoryTransport:
+// samples, timestamps and sequence numbers survive the packing, CRC and
+// COBS framing; dropped data, corrupted bytes and a stream joined mid-packet
+// show in the statistics. Prints the encode and decode throughput.
+#include "ED_adc_stream.h"
+#include "test_check.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+using namespace ED_ADC;
+
+namespace {
+constexpr unsigned SEED = 91;
+constexpr int64_t T0_US = 1000000;
+
+std::vector<uint16_t> randomCodes(std::mt19937 &rng, size_t n) {
+  std::vector<uint16_t> codes(n);
+  for (uint16_t &code : codes) {
+    // zeros and full scale often, to exercise the COBS runs
+    const uint32_t r = rng();
+    code = r % 4 == 0 ? 0 : r % 4 == 1 ? 0xFFF : (r >> 8) & 0xFFF;
+  }
+  return codes;
+}
+
+/// @brief the decoded samples, each with the timestamp of its packet
+/// extrapolated by the sample period
+struct Received {
+  std::vector<uint16_t> codes;
+  std::vector<int64_t> times;
+  std::vector<uint16_t> sequences;
+};
+
+StreamDecoder::Callback collect(Received &received) {
+  return [&received](const StreamPacket &packet) {
+    received.sequences.push_back(packet.sequence);
+    for (size_t i = 0; i < packet.samples.size(); i++) {
+      received.codes.push_back(packet.samples[i]);
+      received.times.push_back(packet.timestamp_us +
+                               (int64_t)i * packet.sample_period_us);
+    }
+  };
+}
+
+/// @brief feeds the stream in pieces of random size
+void feedInChunks(StreamDecoder &decoder, const std::vector<uint8_t> &bytes,
+                  std::mt19937 &rng) {
+  for (size_t done = 0; done < bytes.size();) {
+    const size_t chunk = std::min<size_t>(1 + rng() % 700, bytes.size() - done);
+    decoder.feed(bytes.data() + done, chunk);
+    done += chunk;
+  }
+}
+
+void testCrcAndCobs(std::mt19937 &rng) {
+  // check value of CRC-16/CCITT-FALSE
+  const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+  CHECK_EQ(streamCrc16(check, sizeof(check)), 0x29B1);
+
+  for (size_t length : {1, 2, 253, 254, 255, 508, 1000}) {
+    std::vector<uint8_t> data(length);
+    for (uint8_t &byte : data) {
+      byte = rng() % 3 == 0 ? 0 : (uint8_t)rng();
+    }
+    if (length == 254 || length == 508) {
+      std::fill(data.begin(), data.end(), 0x55); // runs without a zero
+    }
+    std::vector<uint8_t> encoded(length + length / 254 + 1);
+    const size_t size = cobsEncode(data.data(), length, encoded.data());
+    CHECK_LE(size, encoded.size());
+    encoded.resize(size);
+    CHECK_EQ(std::count(encoded.begin(), encoded.end(), 0), 0);
+    std::vector<uint8_t> decoded(size);
+    CHECK_EQ(cobsDecode(encoded.data(), size, decoded.data()), length);
+    decoded.resize(length);
+    CHECK(decoded == data);
+  }
+}
+
+/// @brief pushes frames of random size, pumping after each; a frame of
+/// at most one packet always fits the two buffers, so nothing is dropped
+void testLoopback(std::mt19937 &rng) {
+  MemoryTransport wire;
+  StreamConfig config;
+  config.channel_id = 3;
+  SampleStreamer streamer(wire, config);
+  const std::vector<uint16_t> codes = randomCodes(rng, 100001); // odd count
+  for (size_t done = 0; done < codes.size();) {
+    const size_t count =
+        std::min<size_t>(1 + rng() % config.samples_per_packet,
+                         codes.size() - done);
+    CHECK_EQ(streamer.push(&codes[done], count,
+                           T0_US + (int64_t)done * config.sample_period_us),
+             count);
+    streamer.pump();
+    done += count;
+  }
+  streamer.flush();
+
+  Received received;
+  StreamDecoder decoder(collect(received));
+  feedInChunks(decoder, wire.data(), rng);
+
+  const StreamStats sent = streamer.stats();
+  const StreamDecoderStats got = decoder.stats();
+  const uint32_t packets = (codes.size() + config.samples_per_packet - 1) /
+                           config.samples_per_packet;
+  CHECK_EQ(sent.packets, packets);
+  CHECK_EQ(sent.samples, codes.size());
+  CHECK_EQ(sent.bytes, wire.data().size());
+  CHECK_EQ(sent.dropped_samples, 0);
+  CHECK_EQ(sent.write_errors, 0);
+  CHECK_EQ(got.packets, packets);
+  CHECK_EQ(got.samples, codes.size());
+  CHECK_EQ(got.crc_errors, 0);
+  CHECK_EQ(got.framing_errors, 0);
+  CHECK_EQ(got.lost_sequences, 0);
+  CHECK(received.codes == codes);
+  int64_t wrong_times = 0;
+  for (size_t i = 0; i < received.times.size(); i++) {
+    wrong_times +=
+        received.times[i] != T0_US + (int64_t)i * config.sample_period_us;
+  }
+  CHECK_EQ(wrong_times, 0);
+  for (size_t i = 0; i < received.sequences.size(); i++) {
+    CHECK_EQ(received.sequences[i], (uint16_t)i);
+  }
+  // a full packet: 18 + 360 + 2 bytes, COBS overhead and delimiter
+  CHECK_LE(wire.data().size(), (uint64_t)packets * 383);
+}
+
+/// @brief a producer that outruns the sender: the third packet finds both
+/// buffers full and is dropped, and the sequence skips over it
+void testDroppedPacket(std::mt19937 &rng) {
+  MemoryTransport wire;
+  SampleStreamer streamer(wire);
+  const size_t per_packet = StreamConfig().samples_per_packet;
+  const std::vector<uint16_t> codes = randomCodes(rng, 4 * per_packet);
+  CHECK_EQ(streamer.push(codes.data(), 3 * per_packet, T0_US),
+           2 * per_packet);
+  CHECK_EQ(streamer.stats().dropped_samples, per_packet);
+  CHECK_EQ(streamer.pump(), 2);
+  CHECK_EQ(streamer.push(&codes[3 * per_packet], per_packet, T0_US),
+           per_packet);
+  streamer.flush();
+
+  Received received;
+  StreamDecoder decoder(collect(received));
+  feedInChunks(decoder, wire.data(), rng);
+  const StreamDecoderStats got = decoder.stats();
+  CHECK_EQ(got.packets, 3);
+  CHECK_EQ(got.lost_sequences, 1);
+  CHECK_EQ(got.samples, 3 * per_packet);
+  CHECK_EQ(received.sequences.size(), 3);
+  if (received.sequences.size() == 3) {
+    CHECK_EQ(received.sequences[2], 3);
+  }
+  std::vector<uint16_t> expected(codes.begin(),
+                                 codes.begin() + 2 * per_packet);
+  expected.insert(expected.end(), codes.begin() + 3 * per_packet,
+                  codes.end());
+  CHECK(received.codes == expected);
+}
+
+/// @brief a flipped byte costs its packet only; a decoder that joins the
+/// stream mid-packet resynchronises at the next delimiter
+void testCorruption(std::mt19937 &rng) {
+  MemoryTransport wire;
+  SampleStreamer streamer(wire);
+  const std::vector<uint16_t> codes = randomCodes(rng, 10 * 240);
+  for (size_t done = 0; done < codes.size(); done += 240) {
+    streamer.push(&codes[done], 240, T0_US);
+    streamer.pump();
+  }
+  streamer.flush();
+  std::vector<uint8_t> bytes = wire.data();
+
+  // a bit flipped inside packet 4
+  const size_t packet_size = bytes.size() / 10;
+  std::vector<uint8_t> flipped = bytes;
+  size_t at = 4 * packet_size + 100;
+  flipped[at] ^= flipped[at] == 0x01 ? 0x03 : 0x01; // never becomes 0x00
+  Received received;
+  StreamDecoder decoder(collect(received));
+  feedInChunks(decoder, flipped, rng);
+  StreamDecoderStats got = decoder.stats();
+  CHECK_EQ(got.packets, 9);
+  CHECK_EQ(got.crc_errors + got.framing_errors, 1);
+  CHECK_EQ(got.lost_sequences, 1);
+
+  // joined in the middle of packet 2
+  Received late;
+  StreamDecoder joined(collect(late));
+  at = 2 * packet_size + 50;
+  feedInChunks(joined, std::vector<uint8_t>(bytes.begin() + at, bytes.end()),
+               rng);
+  got = joined.stats();
+  CHECK_EQ(got.packets, 7);
+  CHECK_EQ(got.crc_errors + got.framing_errors, 1); // the partial packet
+  CHECK_EQ(got.lost_sequences, 0);
+  CHECK(late.codes ==
+        std::vector<uint16_t>(codes.begin() + 3 * 240, codes.end()));
+}
+
+/// @brief encode and decode rates on this machine, for information
+void reportThroughput(std::mt19937 &rng) {
+  using Clock = std::chrono::steady_clock;
+  const std::vector<uint16_t> codes = randomCodes(rng, 2000000);
+  MemoryTransport wire;
+  wire.data().reserve(codes.size() * 2);
+  SampleStreamer streamer(wire);
+  const Clock::time_point start = Clock::now();
+  for (size_t done = 0; done < codes.size(); done += 240) {
+    streamer.push(&codes[done], std::min<size_t>(240, codes.size() - done),
+                  0);
+    streamer.pump();
+  }
+  streamer.flush();
+  const Clock::time_point encoded = Clock::now();
+  uint64_t samples = 0;
+  StreamDecoder decoder(
+      [&](const StreamPacket &packet) { samples += packet.samples.size(); });
+  decoder.feed(wire.data().data(), wire.data().size());
+  const Clock::time_point decoded = Clock::now();
+  CHECK_EQ(samples, codes.size());
+
+  auto msps = [&](Clock::duration elapsed) {
+    return codes.size() /
+           std::chrono::duration<double, std::micro>(elapsed).count();
+  };
+  printf("%.3f bytes/sample on the wire, encode %.1f Msample/s, "
+         "decode %.1f Msample/s\n",
+         (double)wire.data().size() / codes.size(), msps(encoded - start),
+         msps(decoded - encoded));
+}
+} // namespace
+
+int main() {
+  std::mt19937 rng(SEED);
+  testCrcAndCobs(rng);
+  testLoopback(rng);
+  testDroppedPacket(rng);
+  testCorruption(rng);
+  reportThroughput(rng);
+  return ED_ADC_test::testResult();
+}
@@ -0,0 +1,205 @@
+// The wake condition of the background sampler, run through ulpSimulate()
+// across several wakes: which sample wakes the CPU and why, the history
+// takeSamples() hands over, the moving change reference, the ring keeping
+// the newest samples, and the calibration cached by arm().
+#include "ED_adc_ulp.h"
+#include "test_check.h"
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+using namespace ED_ADC;
+
+namespace {
+
+class Fixture {
+public:
+  Fixture() : sim(clock), sampler(handoff) {
+    unit = ADCUnit::create(ADC_UNIT_1, ADC_ULP_MODE_DISABLE, sim);
+    channel = ADCChannel::create(unit.get(), ADC_CHANNEL_0, ADC_ATTEN_DB_12);
+  }
+
+  /**
+   * @brief runs the sampler over samples from offset until it wakes, and
+   * takes the samples it stored, in mV, as history
+   * @return the wake reason; offset moves past the sample that woke it
+   */
+  UlpWakeReason wake(const std::vector<uint16_t> &samples, size_t &offset,
+                     std::vector<int> &history) {
+    size_t consumed = 0;
+    const UlpWakeReason reason = ulpSimulate(
+        handoff, samples.data() + offset, samples.size() - offset, &consumed);
+    offset += consumed;
+    CHECK_EQ(sampler.wakeReason(), reason);
+    history.clear();
+    sampler.takeSamples(*channel, history);
+    return reason;
+  }
+
+  /// @brief mV of samples[first, last), as takeSamples() gives them
+  std::vector<int> expected(const std::vector<uint16_t> &samples,
+                            size_t first, size_t last) {
+    std::vector<int> mv;
+    for (size_t i = first; i < last; i++) {
+      mv.push_back(channel->rawToVoltage(samples[i] & 0xFFF));
+    }
+    return mv;
+  }
+
+  VirtualClock clock;
+  SimDriver sim;
+  UlpHandoff handoff = {};
+  UlpSampler sampler;
+  std::unique_ptr<ADCUnit> unit;
+  std::unique_ptr<ADCChannel> channel;
+};
+
+/// @brief a level that drops below low_raw and later rises above high_raw:
+/// one wake each, and each hands over the samples since the previous one
+void testThresholds() {
+  Fixture fx;
+  UlpWakeCondition condition;
+  condition.low_raw = 1000;
+  condition.high_raw = 3000;
+  condition.batch_wake = 0;
+  fx.sampler.arm(*fx.channel, condition, 100, 2000);
+  CHECK(fx.sampler.isArmed());
+
+  // the thresholds themselves do not wake
+  std::vector<uint16_t> samples = {2000, 1000, 3000, 1500, 999, // wake 1
+                                   2500, 2600, 3001,            // wake 2
+                                   2000, 2000};
+  size_t offset = 0;
+  std::vector<int> history;
+  CHECK_EQ(fx.wake(samples, offset, history), UlpWakeReason::BelowLow);
+  CHECK_EQ(offset, 5);
+  CHECK(history == fx.expected(samples, 0, 5));
+  CHECK_EQ(fx.wake(samples, offset, history), UlpWakeReason::AboveHigh);
+  CHECK_EQ(offset, 8);
+  CHECK(history == fx.expected(samples, 5, 8));
+  CHECK_EQ(fx.wake(samples, offset, history), UlpWakeReason::None);
+  CHECK_EQ(offset, samples.size());
+  CHECK(history == fx.expected(samples, 8, 10));
+  CHECK_EQ(fx.handoff.sequence, samples.size());
+}
+
+/// @brief the change condition measures from the reference given to arm(),
+/// then from the newest sample handed over at each wake
+void testChangeReference() {
+  Fixture fx;
+  UlpWakeCondition condition;
+  condition.change_raw = 100;
+  condition.batch_wake = 0;
+  fx.sampler.arm(*fx.channel, condition, 100, 2000);
+
+  std::vector<uint16_t> samples = {2050, 1901, 2099, 2100, // +100: wake 1
+                                   2150, 2199, 2000,       // -100: wake 2
+                                   2099, 1901, 2099};
+  size_t offset = 0;
+  std::vector<int> history;
+  CHECK_EQ(fx.wake(samples, offset, history), UlpWakeReason::Change);
+  CHECK_EQ(offset, 4);
+  CHECK_EQ(fx.handoff.reference_raw, 2100);
+  CHECK_EQ(fx.wake(samples, offset, history), UlpWakeReason::Change);
+  CHECK_EQ(offset, 7);
+  CHECK_EQ(fx.handoff.reference_raw, 2000);
+  CHECK(history == fx.expected(samples, 4, 7));
+  CHECK_EQ(fx.wake(samples, offset, history), UlpWakeReason::None);
+  CHECK_EQ(history.size(), 3);
+}
+
+/// @brief a sample meeting several conditions reports the first of low,
+/// high, change and batch; codes are masked to 12 bits
+void testPriorityAndMasking() {
+  Fixture fx;
+  UlpWakeCondition condition;
+  condition.low_raw = 1000;
+  condition.high_raw = 3000;
+  condition.change_raw = 500;
+  condition.batch_wake = 3;
+  fx.sampler.arm(*fx.channel, condition, 100, 2000);
+
+  size_t consumed = 0;
+  uint16_t batch[] = {2000, 2100, 1900};
+  CHECK_EQ(ulpSimulate(fx.handoff, batch, 3, &consumed),
+           UlpWakeReason::BatchFull);
+  CHECK_EQ(consumed, 3);
+  std::vector<int> mv;
+  fx.sampler.takeSamples(mv);
+  uint16_t low[] = {1800, 10, 2000}; // 10: low and change
+  CHECK_EQ(ulpSimulate(fx.handoff, low, 3, &consumed),
+           UlpWakeReason::BelowLow);
+  CHECK_EQ(consumed, 2);
+  fx.sampler.takeSamples(mv);
+  uint16_t high[] = {0xF000 | 3500}; // 3500: high and change
+  CHECK_EQ(ulpSimulate(fx.handoff, high, 1, &consumed),
+           UlpWakeReason::AboveHigh);
+  CHECK_EQ(fx.handoff.samples[(fx.handoff.head + ULP_HANDOFF_CAPACITY - 1) %
+                              ULP_HANDOFF_CAPACITY],
+           3500);
+}
+
+/// @brief without a wake the ring keeps the newest ULP_HANDOFF_CAPACITY
+/// samples, oldest first; batch_wake above the capacity is clamped to it
+void testRingAndBatch() {
+  Fixture fx;
+  UlpWakeCondition condition;
+  condition.batch_wake = 0;
+  fx.sampler.arm(*fx.channel, condition, 100);
+  std::vector<uint16_t> samples;
+  for (int i = 0; i < 45; i++) {
+    samples.push_back(100 * i);
+  }
+  size_t offset = 0;
+  std::vector<int> history;
+  CHECK_EQ(fx.wake(samples, offset, history), UlpWakeReason::None);
+  CHECK(history == fx.expected(samples, 45 - ULP_HANDOFF_CAPACITY, 45));
+  CHECK_EQ(fx.handoff.sequence, 45);
+
+  condition.batch_wake = 100;
+  fx.sampler.arm(*fx.channel, condition, 100);
+  CHECK_EQ(fx.handoff.batch_wake, ULP_HANDOFF_CAPACITY);
+  offset = 0;
+  CHECK_EQ(fx.wake(samples, offset, history), UlpWakeReason::BatchFull);
+  CHECK_EQ(offset, ULP_HANDOFF_CAPACITY);
+  CHECK(history == fx.expected(samples, 0, ULP_HANDOFF_CAPACITY));
+  CHECK_EQ(fx.wake(samples, offset, history), UlpWakeReason::None);
+  CHECK_EQ(history.size(), 45 - ULP_HANDOFF_CAPACITY);
+}
+
+/// @brief the calibration arm() caches gives the channel's mV at its points
+/// and interpolates between them; a handoff never armed gives nothing
+void testCachedCalibration() {
+  Fixture fx;
+  UlpSampler unarmed(fx.handoff);
+  std::vector<int> mv;
+  CHECK(!unarmed.isArmed());
+  CHECK_EQ(unarmed.takeSamples(mv), 0);
+  CHECK(!unarmed.onWake(fx.sim)); // no deep sleep on host
+
+  fx.sampler.arm(*fx.channel, UlpWakeCondition(), 100);
+  int worst = 0;
+  for (int raw = 0; raw < 4096; raw++) {
+    const int error = fx.sampler.cachedVoltage(raw) -
+                      fx.channel->rawToVoltage(raw);
+    worst = std::max(worst, std::abs(error));
+    if (raw % 256 == 0 || raw == 4095) {
+      CHECK_EQ(error, 0);
+    }
+  }
+  CHECK_LE(worst, 1); // the simulated calibration is linear
+
+  fx.sampler.arm(UlpWakeCondition(), 100); // no channel: raw codes
+  CHECK_EQ(fx.sampler.cachedVoltage(1234), 1234);
+}
+
+} // namespace
+
+int main() {
+  testThresholds();
+  testChangeReference();
+  testPriorityAndMasking();
+  testRingAndBatch();
+  testCachedCalibration();
+  return ED_ADC_test::testResult();
+}